@@ -0,0 +1,224 @@
+#ifndef CPPJIEBA_DICT_IMAGE_HPP
+#define CPPJIEBA_DICT_IMAGE_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace cppjieba {
+
+using namespace std;
+
+// A compiled dictionary, model and IDF table in one file, so that startup maps it instead of
+// parsing text. Arrays are stored as they are laid out in memory, each aligned to 8 bytes, and
+// the large ones are used in place. The header records the size and modification time of every
+// source file, and images whose sources changed since are refused, as are other versions.
+//
+// Images are only meant to be read on the machine that compiled them.
+class ImageWriter {
+ public:
+  template <class T>
+  void Put(const T& value) {
+    Append(&value, sizeof(T));
+  }
+
+  template <class T>
+  void PutArray(const T* values, size_t count) {
+    Put<uint64_t>(count);
+    Append(values, count * sizeof(T));
+  }
+
+  template <class T>
+  void PutArray(const vector<T>& values) {
+    PutArray(values.empty() ? NULL : &values[0], values.size());
+  }
+
+  // Strings as offsets into the concatenated bytes
+  void PutStrings(const vector<string>& strings) {
+    vector<uint32_t> offsets(1, 0);
+    string bytes;
+    for (size_t i = 0; i < strings.size(); i++) {
+      bytes += strings[i];
+      offsets.push_back(uint32_t(bytes.size()));
+    }
+    PutArray(offsets);
+    PutArray(bytes.data(), bytes.size());
+  }
+
+  // Bytes as they are, such as a header
+  void PutBytes(const string& bytes) {
+    Append(bytes.data(), bytes.size());
+  }
+
+  const string& Data() const {
+    return data_;
+  }
+
+  // Written next to the target and renamed over it, so that readers never see half an image
+  bool WriteTo(const string& path) const {
+    const string tmp = path + ".tmp";
+    FILE* file = fopen(tmp.c_str(), "wb");
+    if (file == NULL) {
+      return false;
+    }
+    const bool written = fwrite(data_.data(), 1, data_.size(), file) == data_.size();
+    if (fclose(file) != 0 || !written) {
+      remove(tmp.c_str());
+      return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+ private:
+  void Append(const void* bytes, size_t size) {
+    data_.append(static_cast<const char*>(bytes), size);
+    data_.resize((data_.size() + 7) / 8 * 8, '\0');
+  }
+
+  string data_;
+}; // class ImageWriter
+
+// Throws runtime_error rather than reading past the end of a damaged image
+class ImageReader {
+ public:
+  ImageReader(const char* begin, const char* end)
+   : cursor_(begin), end_(end) {
+  }
+
+  template <class T>
+  T Get() {
+    T value;
+    memcpy(&value, Take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  // Points into the image; count is set to the number of elements
+  template <class T>
+  const T* GetArray(size_t& count) {
+    const uint64_t stored = Get<uint64_t>();
+    if (stored > uint64_t(end_ - cursor_) / sizeof(T)) {
+      throw runtime_error("dictionary image is truncated");
+    }
+    count = size_t(stored);
+    return reinterpret_cast<const T*>(Take(count * sizeof(T)));
+  }
+
+  template <class T>
+  vector<T> GetVector() {
+    size_t count = 0;
+    const T* values = GetArray<T>(count);
+    return vector<T>(values, values + count);
+  }
+
+  vector<string> GetStrings() {
+    size_t offsetCount = 0, byteCount = 0;
+    const uint32_t* offsets = GetArray<uint32_t>(offsetCount);
+    const char* bytes = GetArray<char>(byteCount);
+    vector<string> strings;
+    for (size_t i = 1; i < offsetCount; i++) {
+      if (offsets[i - 1] > offsets[i] || offsets[i] > byteCount) {
+        throw runtime_error("dictionary image has a bad string table");
+      }
+      strings.push_back(string(bytes + offsets[i - 1], offsets[i] - offsets[i - 1]));
+    }
+    return strings;
+  }
+
+ private:
+  const char* Take(size_t size) {
+    if (size > size_t(end_ - cursor_)) {
+      throw runtime_error("dictionary image is truncated");
+    }
+    const char* taken = cursor_;
+    const size_t aligned = (size + 7) / 8 * 8;
+    cursor_ = aligned < size_t(end_ - cursor_) ? cursor_ + aligned : end_;
+    return taken;
+  }
+
+  const char* cursor_;
+  const char* end_;
+}; // class ImageReader
+
+class DictImage {
+ public:
+  static const uint32_t VERSION = 2;
+
+  DictImage(): data_(NULL), size_(0), header_size_(0) {
+  }
+  ~DictImage() {
+    if (data_ != NULL) {
+      munmap(data_, size_);
+    }
+  }
+
+  // Maps the image read-only, if it exists and was compiled from the sources as they are now
+  bool Open(const string& path, const vector<string>& sources) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < off_t(Header().size())) {
+      close(fd);
+      return false;
+    }
+    void* data = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+
+    const string expected = Header(sources);
+    if (expected.size() > size_t(st.st_size) || memcmp(data, expected.data(), expected.size()) != 0) {
+      munmap(data, size_t(st.st_size));
+      return false;
+    }
+    data_ = data;
+    size_ = size_t(st.st_size);
+    header_size_ = expected.size();
+    return true;
+  }
+
+  // The sections after the header
+  ImageReader Reader() const {
+    const char* begin = static_cast<const char*>(data_);
+    return ImageReader(begin + header_size_, begin + size_);
+  }
+
+  // Magic, version and the state of every source file
+  static string Header(const vector<string>& sources = vector<string>()) {
+    ImageWriter writer;
+    writer.Put<uint64_t>(0x314547414d494a33ULL); // "3JIMAGE1"
+    writer.Put<uint32_t>(uint32_t(VERSION));
+    writer.Put<uint32_t>(uint32_t(sources.size()));
+    for (size_t i = 0; i < sources.size(); i++) {
+      struct stat st;
+      if (stat(sources[i].c_str(), &st) != 0) {
+        memset(&st, 0, sizeof(st));
+      }
+      writer.Put<int64_t>(int64_t(st.st_size));
+      writer.Put<int64_t>(int64_t(st.st_mtime));
+    }
+
+    return writer.Data();
+  }
+
+ private:
+  DictImage(const DictImage&);
+  DictImage& operator=(const DictImage&);
+
+  void* data_;
+  size_t size_;
+  size_t header_size_;
+}; // class DictImage
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_DICT_IMAGE_HPP
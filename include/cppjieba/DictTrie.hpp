@@ -4,6 +4,8 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <cstring>
 #include <cstdlib>
@@ -36,6 +38,79 @@ class DictTrie {
     Init(dict_path, user_dict_paths, user_word_weight_opt);
   }
 
+  // Reads what Save wrote, with the user dictionaries and weights as they were then
+  explicit DictTrie(ImageReader& reader): trie_(NULL) {
+    size_t count = 0, tagCount = 0, offsetCount = 0, runeCount = 0;
+    const double* weights = reader.GetArray<double>(count);
+    const uint32_t* tagIds = reader.GetArray<uint32_t>(tagCount);
+    const uint32_t* offsets = reader.GetArray<uint32_t>(offsetCount);
+    const Rune* runes = reader.GetArray<Rune>(runeCount);
+    const vector<string> tags = reader.GetStrings();
+    if (tagCount != count || offsetCount != count + 1) {
+      throw runtime_error("dictionary image has a bad word table");
+    }
+
+    static_node_infos_.resize(count);
+    vector<const DictUnit*> entries(count);
+    for (size_t i = 0; i < count; i++) {
+      if (offsets[i] > offsets[i + 1] || offsets[i + 1] > runeCount || tagIds[i] >= tags.size()) {
+        throw runtime_error("dictionary image has a bad word table");
+      }
+      DictUnit& unit = static_node_infos_[i];
+      unit.word.reserve(offsets[i + 1] - offsets[i]);
+      for (uint32_t j = offsets[i]; j < offsets[i + 1]; j++) {
+        unit.word.push_back(runes[j]);
+      }
+      unit.weight = weights[i];
+      unit.tag = tags[tagIds[i]];
+      entries[i] = &unit;
+    }
+
+    freq_sum_ = reader.Get<double>();
+    min_weight_ = reader.Get<double>();
+    max_weight_ = reader.Get<double>();
+    median_weight_ = reader.Get<double>();
+    user_word_default_weight_ = reader.Get<double>();
+    const vector<Rune> singles = reader.GetVector<Rune>();
+    user_dict_single_chinese_word_.insert(singles.begin(), singles.end());
+    user_word_begin_ = reader.Get<uint32_t>();
+    for (size_t i = user_word_begin_; i < static_node_infos_.size(); i++) {
+      user_words_.insert(UserWordKey(static_node_infos_[i].word));
+    }
+
+    trie_ = new Trie(reader, entries);
+    FindShadowed();
+    static_units_ = make_shared<const vector<DictUnit> >(std::move(static_node_infos_));
+  }
+
+  // A copy to edit, sharing the words of other instead of copying them. Only the trie and
+  // the words inserted since loading are copied
+  DictTrie(const DictTrie& other)
+    : static_units_(other.static_units_),
+      active_node_infos_(other.active_node_infos_),
+      trie_(NULL),
+      freq_sum_(other.freq_sum_),
+      min_weight_(other.min_weight_),
+      max_weight_(other.max_weight_),
+      median_weight_(other.median_weight_),
+      user_word_default_weight_(other.user_word_default_weight_),
+      user_dict_single_chinese_word_(other.user_dict_single_chinese_word_),
+      user_word_begin_(other.user_word_begin_),
+      user_words_(other.user_words_),
+      shadowed_(other.shadowed_) {
+    unordered_map<const DictUnit*, const DictUnit*> moved;
+    deque<DictUnit>::const_iterator from = other.active_node_infos_.begin();
+    for (deque<DictUnit>::const_iterator to = active_node_infos_.begin(); to != active_node_infos_.end(); ++to, ++from) {
+      moved[&*from] = &*to;
+    }
+    for (map<vector<Rune>, const DictUnit*>::iterator it = shadowed_.begin(); it != shadowed_.end(); ++it) {
+      if (moved.count(it->second)) {
+        it->second = moved[it->second];
+      }
+    }
+    trie_ = new Trie(*other.trie_, moved);
+  }
+
   ~DictTrie() {
     delete trie_;
   }
@@ -45,8 +120,42 @@ class DictTrie {
     if (!MakeNodeInfo(node_info, word, user_word_default_weight_, tag)) {
       return false;
     }
+    const vector<Rune> key = UserWordKey(node_info.word);
+    const DictUnit* shadowed = trie_->Find(node_info.word);
+    if (shadowed != NULL && !user_words_.count(key)) {
+      shadowed_[key] = shadowed;
+    }
     active_node_infos_.push_back(node_info);
     trie_->InsertNode(node_info.word, &active_node_infos_.back());
+    user_words_.insert(key);
+    if (node_info.word.size() == 1) {
+      user_dict_single_chinese_word_.insert(node_info.word[0]);
+    }
+    return true;
+  }
+
+  // False if word was not added by a user dictionary or InsertUserWord. A word of the main
+  // dictionary as well goes back to its entry there
+  bool DeleteUserWord(const string& word) {
+    Unicode runes;
+    if (!DecodeRunesInString(word, runes)) {
+      return false;
+    }
+    const vector<Rune> key = UserWordKey(runes);
+    if (!user_words_.count(key)) {
+      return false;
+    }
+    map<vector<Rune>, const DictUnit*>::iterator shadowed = shadowed_.find(key);
+    if (shadowed != shadowed_.end()) {
+      trie_->InsertNode(runes, shadowed->second);
+      shadowed_.erase(shadowed);
+    } else if (!trie_->DeleteNode(runes)) {
+      return false;
+    }
+    user_words_.erase(key);
+    if (runes.size() == 1) {
+      user_dict_single_chinese_word_.erase(runes[0]);
+    }
     return true;
   }
 
@@ -69,6 +178,50 @@ class DictTrie {
     return min_weight_;
   }
 
+  // Only before any InsertUserWord, whose words are not saved
+  void Save(ImageWriter& writer) const {
+    assert(active_node_infos_.empty());
+    vector<double> weights;
+    vector<uint32_t> tagIds, offsets(1, 0);
+    vector<Rune> runes;
+    vector<string> tags;
+    map<string, uint32_t> tagIndex;
+    const vector<DictUnit>& units = *static_units_;
+    for (size_t i = 0; i < units.size(); i++) {
+      const DictUnit& unit = units[i];
+      weights.push_back(unit.weight);
+      map<string, uint32_t>::const_iterator tag = tagIndex.find(unit.tag);
+      if (tag == tagIndex.end()) {
+        tag = tagIndex.insert(make_pair(unit.tag, uint32_t(tags.size()))).first;
+        tags.push_back(unit.tag);
+      }
+      tagIds.push_back(tag->second);
+      runes.insert(runes.end(), unit.word.begin(), unit.word.end());
+      offsets.push_back(uint32_t(runes.size()));
+    }
+    writer.PutArray(weights);
+    writer.PutArray(tagIds);
+    writer.PutArray(offsets);
+    writer.PutArray(runes);
+    writer.PutStrings(tags);
+
+    writer.Put(freq_sum_);
+    writer.Put(min_weight_);
+    writer.Put(max_weight_);
+    writer.Put(median_weight_);
+    writer.Put(user_word_default_weight_);
+    vector<Rune> singles(user_dict_single_chinese_word_.begin(), user_dict_single_chinese_word_.end());
+    sort(singles.begin(), singles.end());
+    writer.PutArray(singles);
+    writer.Put<uint32_t>(uint32_t(user_word_begin_));
+
+    trie_->Save(writer);
+  }
+
+  size_t GetTrieMemoryUsage() const {
+    return trie_->MemoryUsage();
+  }
+
  private:
   void Init(const string& dict_path, const string& user_dict_paths, UserWordWeightOption user_word_weight_opt) {
     LoadDict(dict_path);
@@ -76,11 +229,27 @@ class DictTrie {
     CalculateWeight(static_node_infos_, freq_sum_);
     SetStaticWordWeights(user_word_weight_opt);
 
+    user_word_begin_ = static_node_infos_.size();
     if (user_dict_paths.size()) {
       LoadUserDict(user_dict_paths);
     }
     Shrink(static_node_infos_);
     CreateTrie(static_node_infos_);
+    FindShadowed();
+    static_units_ = make_shared<const vector<DictUnit> >(std::move(static_node_infos_));
+  }
+
+  // Main dictionary entries of the words the user dictionaries have too
+  void FindShadowed() {
+    if (user_words_.empty()) {
+      return;
+    }
+    for (size_t i = 0; i < user_word_begin_; i++) {
+      set<vector<Rune> >::const_iterator it = user_words_.find(UserWordKey(static_node_infos_[i].word));
+      if (it != user_words_.end()) {
+        shadowed_[*it] = &static_node_infos_[i];
+      }
+    }
   }
   
   void CreateTrie(const vector<DictUnit>& dictUnits) {
@@ -128,6 +297,7 @@ class DictTrie {
           MakeNodeInfo(node_info, buf[0], weight, buf[2]);
         }
         static_node_infos_.push_back(node_info);
+        user_words_.insert(UserWordKey(node_info.word));
         if (node_info.word.size() == 1) {
           user_dict_single_chinese_word_.insert(node_info.word[0]);
         }
@@ -207,11 +377,16 @@ class DictTrie {
     }
   }
 
+  static vector<Rune> UserWordKey(const Unicode& word) {
+    return vector<Rune>(word.begin(), word.end());
+  }
+
   void Shrink(vector<DictUnit>& units) const {
     vector<DictUnit>(units.begin(), units.end()).swap(units);
   }
 
-  vector<DictUnit> static_node_infos_;
+  vector<DictUnit> static_node_infos_; // Only while loading, then moved to static_units_
+  shared_ptr<const vector<DictUnit> > static_units_; // Shared with copies
   deque<DictUnit> active_node_infos_; // must not be vector
   Trie * trie_;
 
@@ -221,6 +396,11 @@ class DictTrie {
   double median_weight_;
   double user_word_default_weight_;
   unordered_set<Rune> user_dict_single_chinese_word_;
+  size_t user_word_begin_; // Static units from here on came from the user dictionaries
+  set<vector<Rune> > user_words_;
+  map<vector<Rune>, const DictUnit*> shadowed_; // Entries that user words replaced, restored on deletion
+
+  DictTrie& operator=(const DictTrie&);
 };
 }
 
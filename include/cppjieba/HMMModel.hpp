@@ -2,7 +2,7 @@
 #define CPPJIEBA_HMMMODEL_H
 
 #include "limonp/StringUtil.hpp"
-#include "Trie.hpp"
+#include "DictTrie.hpp"
 
 namespace cppjieba {
 
@@ -17,6 +17,18 @@ struct HMMModel {
   enum {B = 0, E = 1, M = 2, S = 3, STATUS_SUM = 4};
 
   HMMModel(const string& modelPath) {
+    InitStatus();
+    LoadModel(modelPath);
+    BuildEmitRows();
+  }
+  explicit HMMModel(ImageReader& reader) {
+    InitStatus();
+    LoadImage(reader);
+    BuildEmitRows();
+  }
+  ~HMMModel() {
+  }
+  void InitStatus() {
     memset(startProb, 0, sizeof(startProb));
     memset(transProb, 0, sizeof(transProb));
     statMap[0] = 'B';
@@ -27,9 +39,45 @@ struct HMMModel {
     emitProbVec.push_back(&emitProbE);
     emitProbVec.push_back(&emitProbM);
     emitProbVec.push_back(&emitProbS);
-    LoadModel(modelPath);
   }
-  ~HMMModel() {
+  void Save(ImageWriter& writer) const {
+    writer.PutArray(startProb, STATUS_SUM);
+    writer.PutArray(&transProb[0][0], STATUS_SUM * STATUS_SUM);
+    for (size_t i = 0; i < STATUS_SUM; i++) {
+      vector<pair<Rune, double> > emits(emitProbVec[i]->begin(), emitProbVec[i]->end());
+      sort(emits.begin(), emits.end());
+      vector<Rune> runes;
+      vector<double> probs;
+      for (size_t j = 0; j < emits.size(); j++) {
+        runes.push_back(emits[j].first);
+        probs.push_back(emits[j].second);
+      }
+      writer.PutArray(runes);
+      writer.PutArray(probs);
+    }
+  }
+  void LoadImage(ImageReader& reader) {
+    size_t startCount = 0, transCount = 0;
+    const double* start = reader.GetArray<double>(startCount);
+    const double* trans = reader.GetArray<double>(transCount);
+    if (startCount != STATUS_SUM || transCount != STATUS_SUM * STATUS_SUM) {
+      throw runtime_error("dictionary image has a bad model");
+    }
+    memcpy(startProb, start, sizeof(startProb));
+    memcpy(transProb, trans, sizeof(transProb));
+
+    for (size_t i = 0; i < STATUS_SUM; i++) {
+      size_t runeCount = 0, probCount = 0;
+      const Rune* runes = reader.GetArray<Rune>(runeCount);
+      const double* probs = reader.GetArray<double>(probCount);
+      if (runeCount != probCount) {
+        throw runtime_error("dictionary image has a bad model");
+      }
+      emitProbVec[i]->reserve(runeCount);
+      for (size_t j = 0; j < runeCount; j++) {
+        (*emitProbVec[i])[runes[j]] = probs[j];
+      }
+    }
   }
   void LoadModel(const string& filePath) {
     ifstream ifile(filePath.c_str());
@@ -79,6 +127,31 @@ struct HMMModel {
     }
     return cit->second;
   }
+  // The emission probabilities of B, E, M and S for rune, MIN_DOUBLE where the model has none
+  const double* GetEmitRow(Rune rune) const {
+    const size_t page = rune >> EMIT_PAGE_BITS;
+    const size_t block = page < emitPages.size() ? emitPages[page] : 0;
+    return &emitRows[((block << EMIT_PAGE_BITS) | (rune & EMIT_PAGE_MASK)) * STATUS_SUM];
+  }
+  // Rows are laid out by pages of 256 runes, and only pages with any rune in the model get
+  // theirs, so the CJK block takes some 650 KiB. Block 0 is the page of runes it has none for
+  void BuildEmitRows() {
+    emitPages.clear();
+    emitRows.assign(STATUS_SUM << EMIT_PAGE_BITS, MIN_DOUBLE);
+    for (size_t y = 0; y < STATUS_SUM; y++) {
+      for (EmitProbMap::const_iterator it = emitProbVec[y]->begin(); it != emitProbVec[y]->end(); ++it) {
+        const size_t page = it->first >> EMIT_PAGE_BITS;
+        if (page >= emitPages.size()) {
+          emitPages.resize(page + 1, 0);
+        }
+        if (emitPages[page] == 0) {
+          emitPages[page] = uint32_t(emitRows.size() / (STATUS_SUM << EMIT_PAGE_BITS));
+          emitRows.resize(emitRows.size() + (STATUS_SUM << EMIT_PAGE_BITS), MIN_DOUBLE);
+        }
+        emitRows[((size_t(emitPages[page]) << EMIT_PAGE_BITS) | (it->first & EMIT_PAGE_MASK)) * STATUS_SUM + y] = it->second;
+      }
+    }
+  }
   bool GetLine(ifstream& ifile, string& line) {
     while (getline(ifile, line)) {
       Trim(line);
@@ -122,6 +195,11 @@ struct HMMModel {
   EmitProbMap emitProbM;
   EmitProbMap emitProbS;
   vector<EmitProbMap* > emitProbVec;
+
+  static const size_t EMIT_PAGE_BITS = 8;
+  static const Rune EMIT_PAGE_MASK = (1 << EMIT_PAGE_BITS) - 1;
+  vector<uint32_t> emitPages; // Block of each page of runes
+  vector<double> emitRows;
 }; // struct HMMModel
 
 } // namespace cppjieba
@@ -9,6 +9,45 @@
 #include "SegmentBase.hpp"
 
 namespace cppjieba {
+
+enum ViterbiIsa {
+  VITERBI_REFERENCE,
+  VITERBI_SCALAR,
+  VITERBI_SSE2,
+  VITERBI_AVX2
+}; // enum ViterbiIsa
+
+inline ViterbiIsa DetectViterbiIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return VITERBI_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return VITERBI_SSE2;
+  }
+#endif
+  return VITERBI_SCALAR;
+}
+
+inline ViterbiIsa GetViterbiIsa() {
+  static const ViterbiIsa detected = DetectViterbiIsa();
+  return detected;
+}
+
+inline const char* GetViterbiIsaName(ViterbiIsa isa) {
+  switch (isa) {
+    case VITERBI_AVX2:
+      return "avx2";
+    case VITERBI_SSE2:
+      return "sse2";
+    case VITERBI_SCALAR:
+      return "scalar";
+    default:
+      return "reference";
+  }
+}
+
 class HMMSegment: public SegmentBase {
  public:
   HMMSegment(const string& filePath)
@@ -112,7 +151,7 @@ class HMMSegment: public SegmentBase {
     return begin;
   }
   void InternalCut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res) const {
-    vector<size_t> status;
+    vector<size_t>& status = CutScratch::Local().status;
     Viterbi(begin, end, status);
 
     RuneStrArray::const_iterator left = begin;
@@ -127,7 +166,160 @@ class HMMSegment: public SegmentBase {
     }
   }
 
+ public:
+  // The most likely state of every rune, with the given implementation, which the CPU must
+  // support, or the best one it does. All of them find the same states
   void Viterbi(RuneStrArray::const_iterator begin, 
+        RuneStrArray::const_iterator end, 
+        vector<size_t>& status,
+        ViterbiIsa isa = GetViterbiIsa()) const {
+    if (isa == VITERBI_REFERENCE) {
+      return ViterbiReference(begin, end, status);
+    }
+
+    const size_t X = end - begin;
+    CutScratch& scratch = CutScratch::Local();
+    vector<int>& path = scratch.path;
+    vector<double>& weight = scratch.weight;
+    if (weight.size() < X * HMMModel::STATUS_SUM) {
+      path.resize(X * HMMModel::STATUS_SUM);
+      weight.resize(X * HMMModel::STATUS_SUM);
+    }
+
+    const double* emit = model_->GetEmitRow(begin->rune);
+    for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+      weight[y] = model_->startProb[y] + emit[y];
+      path[y] = -1;
+    }
+    switch (isa) {
+#if defined(__x86_64__) || defined(__i386__)
+     case VITERBI_AVX2:
+      ViterbiAvx2(begin, X, &weight[0], &path[0]);
+      break;
+     case VITERBI_SSE2:
+      ViterbiSse2(begin, X, &weight[0], &path[0]);
+      break;
+#endif
+     default:
+      ViterbiScalar(begin, X, &weight[0], &path[0]);
+      break;
+    }
+
+    const double endE = weight[(X - 1) * HMMModel::STATUS_SUM + HMMModel::E];
+    const double endS = weight[(X - 1) * HMMModel::STATUS_SUM + HMMModel::S];
+    size_t stat = endE >= endS ? HMMModel::E : HMMModel::S;
+    status.resize(X);
+    for (size_t x = X; x-- > 0;) {
+      status[x] = stat;
+      stat = path[x * HMMModel::STATUS_SUM + stat];
+    }
+  }
+
+ private:
+  // Weights and paths are laid out rune by rune, the four states of each next to each other.
+  // Every state takes the first of its best predecessors, or stays at MIN_DOUBLE coming from E
+  // if none beats that, as in ViterbiReference
+  void ViterbiScalar(RuneStrArray::const_iterator begin, size_t X, double* weight, int* path) const {
+    for (size_t x = 1; x < X; x++) {
+      const double* emit = model_->GetEmitRow((begin + x)->rune);
+      const double* prev = weight + (x - 1) * HMMModel::STATUS_SUM;
+      for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+        double best = MIN_DOUBLE;
+        int from = HMMModel::E;
+        for (size_t preY = 0; preY < HMMModel::STATUS_SUM; preY++) {
+          const double tmp = prev[preY] + model_->transProb[preY][y] + emit[y];
+          if (tmp > best) {
+            best = tmp;
+            from = int(preY);
+          }
+        }
+        weight[x * HMMModel::STATUS_SUM + y] = best;
+        path[x * HMMModel::STATUS_SUM + y] = from;
+      }
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  // Only the best weight is carried to the next rune, so it takes the maximum alone, and the
+  // predecessor is worked out beside it: the first candidate equal to the maximum, or E if it
+  // does not beat the floor. Maxima are exact, so this matches taking candidates in order
+  __attribute__((target("sse2")))
+  static inline __m128d SelectSse2(__m128d mask, __m128d a, __m128d b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+  }
+
+  // States B, E in one register and M, S in the other
+  __attribute__((target("sse2")))
+  void ViterbiSse2(RuneStrArray::const_iterator begin, size_t X, double* weight, int* path) const {
+    __m128d trans[HMMModel::STATUS_SUM][2];
+    for (size_t preY = 0; preY < HMMModel::STATUS_SUM; preY++) {
+      trans[preY][0] = _mm_loadu_pd(&model_->transProb[preY][0]);
+      trans[preY][1] = _mm_loadu_pd(&model_->transProb[preY][2]);
+    }
+    const __m128d floor = _mm_set1_pd(MIN_DOUBLE);
+    __m128d prev[2] = { _mm_loadu_pd(weight), _mm_loadu_pd(weight + 2) };
+
+    for (size_t x = 1; x < X; x++) {
+      const double* emit = model_->GetEmitRow((begin + x)->rune);
+      const __m128d from[HMMModel::STATUS_SUM] = {
+        _mm_unpacklo_pd(prev[0], prev[0]), _mm_unpackhi_pd(prev[0], prev[0]),
+        _mm_unpacklo_pd(prev[1], prev[1]), _mm_unpackhi_pd(prev[1], prev[1])
+      };
+      for (size_t half = 0; half < 2; half++) {
+        const __m128d e = _mm_loadu_pd(emit + half * 2);
+        __m128d c[HMMModel::STATUS_SUM];
+        for (size_t preY = 0; preY < HMMModel::STATUS_SUM; preY++) {
+          c[preY] = _mm_add_pd(_mm_add_pd(from[preY], trans[preY][half]), e);
+        }
+        const __m128d top = _mm_max_pd(_mm_max_pd(c[0], c[1]), _mm_max_pd(c[2], c[3]));
+        const __m128d best = _mm_max_pd(top, floor);
+        prev[half] = best;
+
+        __m128d state = _mm_set1_pd(3);
+        state = SelectSse2(_mm_cmpeq_pd(c[2], top), _mm_set1_pd(2), state);
+        state = SelectSse2(_mm_cmpeq_pd(c[1], top), _mm_set1_pd(1), state);
+        state = SelectSse2(_mm_cmpeq_pd(c[0], top), _mm_setzero_pd(), state);
+        state = SelectSse2(_mm_cmpgt_pd(top, floor), state, _mm_set1_pd(HMMModel::E));
+
+        _mm_storeu_pd(weight + x * HMMModel::STATUS_SUM + half * 2, best);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(path + x * HMMModel::STATUS_SUM + half * 2), _mm_cvtpd_epi32(state));
+      }
+    }
+  }
+
+  // All four states in one register
+  __attribute__((target("avx2")))
+  void ViterbiAvx2(RuneStrArray::const_iterator begin, size_t X, double* weight, int* path) const {
+    __m256d trans[HMMModel::STATUS_SUM];
+    for (size_t preY = 0; preY < HMMModel::STATUS_SUM; preY++) {
+      trans[preY] = _mm256_loadu_pd(model_->transProb[preY]);
+    }
+    const __m256d floor = _mm256_set1_pd(MIN_DOUBLE);
+    __m256d prev = _mm256_loadu_pd(weight);
+
+    for (size_t x = 1; x < X; x++) {
+      const __m256d e = _mm256_loadu_pd(model_->GetEmitRow((begin + x)->rune));
+      const __m256d c0 = _mm256_add_pd(_mm256_add_pd(_mm256_permute4x64_pd(prev, 0x00), trans[0]), e);
+      const __m256d c1 = _mm256_add_pd(_mm256_add_pd(_mm256_permute4x64_pd(prev, 0x55), trans[1]), e);
+      const __m256d c2 = _mm256_add_pd(_mm256_add_pd(_mm256_permute4x64_pd(prev, 0xAA), trans[2]), e);
+      const __m256d c3 = _mm256_add_pd(_mm256_add_pd(_mm256_permute4x64_pd(prev, 0xFF), trans[3]), e);
+      const __m256d top = _mm256_max_pd(_mm256_max_pd(c0, c1), _mm256_max_pd(c2, c3));
+      prev = _mm256_max_pd(top, floor);
+
+      __m256d state = _mm256_set1_pd(3);
+      state = _mm256_blendv_pd(state, _mm256_set1_pd(2), _mm256_cmp_pd(c2, top, _CMP_EQ_OQ));
+      state = _mm256_blendv_pd(state, _mm256_set1_pd(1), _mm256_cmp_pd(c1, top, _CMP_EQ_OQ));
+      state = _mm256_blendv_pd(state, _mm256_setzero_pd(), _mm256_cmp_pd(c0, top, _CMP_EQ_OQ));
+      state = _mm256_blendv_pd(_mm256_set1_pd(HMMModel::E), state, _mm256_cmp_pd(top, floor, _CMP_GT_OQ));
+
+      _mm256_storeu_pd(weight + x * HMMModel::STATUS_SUM, prev);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(path + x * HMMModel::STATUS_SUM), _mm256_cvtpd_epi32(state));
+    }
+  }
+#endif
+
+  // As cppjieba had it, kept to check the others against
+  void ViterbiReference(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<size_t>& status) const {
     size_t Y = HMMModel::STATUS_SUM;
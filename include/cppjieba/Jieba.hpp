@@ -14,17 +14,46 @@ class Jieba {
         const string& idfPath, 
         const string& stopWordPath) 
     : dict_trie_(dict_path, user_dict_path),
-      model_(model_path),
+      model_(make_shared<const HMMModel>(model_path)),
       mp_seg_(&dict_trie_),
-      hmm_seg_(&model_),
-      mix_seg_(&dict_trie_, &model_),
+      hmm_seg_(model_.get()),
+      mix_seg_(&dict_trie_, model_.get()),
       full_seg_(&dict_trie_),
-      query_seg_(&dict_trie_, &model_),
-      extractor(&dict_trie_, &model_, idfPath, stopWordPath) {
+      query_seg_(&dict_trie_, model_.get()),
+      extractor(&dict_trie_, model_.get(), idfPath, stopWordPath) {
+  }
+  // From an image written by SaveImage, which must stay open as long as this
+  explicit Jieba(ImageReader reader)
+    : dict_trie_(reader),
+      model_(make_shared<const HMMModel>(reader)),
+      mp_seg_(&dict_trie_),
+      hmm_seg_(model_.get()),
+      mix_seg_(&dict_trie_, model_.get()),
+      full_seg_(&dict_trie_),
+      query_seg_(&dict_trie_, model_.get()),
+      extractor(&dict_trie_, model_.get(), reader) {
+  }
+  // A copy to edit with InsertUserWord and DeleteUserWord, without parsing anything again:
+  // only the trie arrays are copied, and the model and keyword tables are shared with base
+  explicit Jieba(const Jieba& base)
+    : dict_trie_(base.dict_trie_),
+      model_(base.model_),
+      mp_seg_(&dict_trie_),
+      hmm_seg_(model_.get()),
+      mix_seg_(&dict_trie_, model_.get()),
+      full_seg_(&dict_trie_),
+      query_seg_(&dict_trie_, model_.get()),
+      extractor(base.extractor, &dict_trie_, model_.get()) {
   }
   ~Jieba() {
   }
 
+  void SaveImage(ImageWriter& writer) const {
+    dict_trie_.Save(writer);
+    model_->Save(writer);
+    extractor.Save(writer);
+  }
+
   struct LocWord {
     string word;
     size_t begin;
@@ -37,6 +66,17 @@ class Jieba {
   void Cut(const string& sentence, vector<Word>& words, bool hmm = true) const {
     mix_seg_.Cut(sentence, words, hmm);
   }
+  // Words as offsets into the sentence, allocating nothing once the thread has cut a longer one
+  void Cut(const char* sentence, size_t len, vector<WordSpan>& words, bool hmm = true) const {
+    mix_seg_.Cut(sentence, len, words, hmm);
+  }
+  void Cut(const string& sentence, vector<WordSpan>& words, bool hmm = true) const {
+    mix_seg_.Cut(sentence.data(), sentence.size(), words, hmm);
+  }
+  // Short sentences in one go, such as the parts of a query: words of sentences[k] end at ends[k]
+  void Cut(const vector<Sentence>& sentences, vector<WordSpan>& words, vector<size_t>& ends, bool hmm = true) const {
+    mix_seg_.Cut(sentences, words, ends, hmm);
+  }
   void CutAll(const string& sentence, vector<string>& words) const {
     full_seg_.Cut(sentence, words);
   }
@@ -49,6 +89,15 @@ class Jieba {
   void CutForSearch(const string& sentence, vector<Word>& words, bool hmm = true) const {
     query_seg_.Cut(sentence, words, hmm);
   }
+  void CutForSearch(const char* sentence, size_t len, vector<WordSpan>& words, bool hmm = true) const {
+    query_seg_.Cut(sentence, len, words, hmm);
+  }
+  void CutForSearch(const string& sentence, vector<WordSpan>& words, bool hmm = true) const {
+    query_seg_.Cut(sentence.data(), sentence.size(), words, hmm);
+  }
+  void CutForSearch(const vector<Sentence>& sentences, vector<WordSpan>& words, vector<size_t>& ends, bool hmm = true) const {
+    query_seg_.Cut(sentences, words, ends, hmm);
+  }
   void CutHMM(const string& sentence, vector<string>& words) const {
     hmm_seg_.Cut(sentence, words);
   }
@@ -71,6 +120,9 @@ class Jieba {
   bool InsertUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
     return dict_trie_.InsertUserWord(word, tag);
   }
+  bool DeleteUserWord(const string& word) {
+    return dict_trie_.DeleteUserWord(word);
+  }
 
   void ResetSeparators(const string& s) {
     //TODO
@@ -85,12 +137,12 @@ class Jieba {
     return &dict_trie_;
   } 
   const HMMModel* GetHMMModel() const {
-    return &model_;
+    return model_.get();
   }
 
  private:
   DictTrie dict_trie_;
-  HMMModel model_;
+  shared_ptr<const HMMModel> model_; // Shared with copies
   
   // They share the same dict trie and model
   MPSegment mp_seg_;
@@ -3,6 +3,7 @@
 
 #include <cmath>
 #include <set>
+#include <memory>
 #include "MixSegment.hpp"
 
 namespace cppjieba {
@@ -36,9 +37,68 @@ class KeywordExtractor {
     LoadIdfDict(idfPath);
     LoadStopWordDict(stopWordPath);
   }
+  KeywordExtractor(const DictTrie* dictTrie, 
+        const HMMModel* model,
+        ImageReader& reader) 
+    : segment_(dictTrie, model) {
+    const vector<string> words = reader.GetStrings();
+    size_t count = 0;
+    const double* idfs = reader.GetArray<double>(count);
+    if (count != words.size()) {
+      throw runtime_error("dictionary image has a bad IDF table");
+    }
+    unordered_map<string, double>* idfMap = new unordered_map<string, double>();
+    idfMap_.reset(idfMap);
+    idfMap->reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      (*idfMap)[words[i]] = idfs[i];
+    }
+    idfAverage_ = reader.Get<double>();
+
+    const vector<string> stopWords = reader.GetStrings();
+    stopWords_ = make_shared<const unordered_set<string> >(stopWords.begin(), stopWords.end());
+  }
+  // Shares the IDF table and stop words of other, segmenting with another dictionary
+  KeywordExtractor(const KeywordExtractor& other,
+        const DictTrie* dictTrie,
+        const HMMModel* model)
+    : segment_(dictTrie, model),
+      idfMap_(other.idfMap_),
+      idfAverage_(other.idfAverage_),
+      stopWords_(other.stopWords_) {
+  }
   ~KeywordExtractor() {
   }
 
+  void Save(ImageWriter& writer) const {
+    vector<string> words;
+    vector<double> idfs;
+    for (unordered_map<string, double>::const_iterator iter = idfMap_->begin(); iter != idfMap_->end(); ++iter) {
+      words.push_back(iter->first);
+      idfs.push_back(iter->second);
+    }
+    writer.PutStrings(words);
+    writer.PutArray(idfs);
+    writer.Put(idfAverage_);
+    writer.PutStrings(vector<string>(stopWords_->begin(), stopWords_->end()));
+  }
+
+  const unordered_map<string, double>& GetIdfMap() const {
+    return *idfMap_;
+  }
+  const unordered_set<string>& GetStopWords() const {
+    return *stopWords_;
+  }
+
+  // Weight of a word seen count times, as Extract computes it; 0 for the words it leaves out
+  double Weigh(const string& word, double count) const {
+    if (IsSingleWord(word) || stopWords_->find(word) != stopWords_->end()) {
+      return 0.0;
+    }
+    unordered_map<string, double>::const_iterator cit = idfMap_->find(word);
+    return count * (cit != idfMap_->end() ? cit->second : idfAverage_);
+  }
+
   void Extract(const string& sentence, vector<string>& keywords, size_t topN) const {
     vector<Word> topWords;
     Extract(sentence, topWords, topN);
@@ -64,7 +124,7 @@ class KeywordExtractor {
     for (size_t i = 0; i < words.size(); ++i) {
       size_t t = offset;
       offset += words[i].size();
-      if (IsSingleWord(words[i]) || stopWords_.find(words[i]) != stopWords_.end()) {
+      if (IsSingleWord(words[i]) || stopWords_->find(words[i]) != stopWords_->end()) {
         continue;
       }
       wordmap[words[i]].offsets.push_back(t);
@@ -78,8 +138,8 @@ class KeywordExtractor {
     keywords.clear();
     keywords.reserve(wordmap.size());
     for (map<string, Word>::iterator itr = wordmap.begin(); itr != wordmap.end(); ++itr) {
-      unordered_map<string, double>::const_iterator cit = idfMap_.find(itr->first);
-      if (cit != idfMap_.end()) {
+      unordered_map<string, double>::const_iterator cit = idfMap_->find(itr->first);
+      if (cit != idfMap_->end()) {
         itr->second.weight *= cit->second;
       } else {
         itr->second.weight *= idfAverage_;
@@ -93,6 +153,8 @@ class KeywordExtractor {
   }
  private:
   void LoadIdfDict(const string& idfPath) {
+    unordered_map<string, double>* idfMap = new unordered_map<string, double>();
+    idfMap_.reset(idfMap);
     ifstream ifs(idfPath.c_str());
     XCHECK(ifs.is_open()) << "open " << idfPath << " failed";
     string line ;
@@ -112,7 +174,7 @@ class KeywordExtractor {
         continue;
       }
       idf = atof(buf[1].c_str());
-      idfMap_[buf[0]] = idf;
+      (*idfMap)[buf[0]] = idf;
       idfSum += idf;
 
     }
@@ -122,13 +184,15 @@ class KeywordExtractor {
     assert(idfAverage_ > 0.0);
   }
   void LoadStopWordDict(const string& filePath) {
+    unordered_set<string>* stopWords = new unordered_set<string>();
+    stopWords_.reset(stopWords);
     ifstream ifs(filePath.c_str());
     XCHECK(ifs.is_open()) << "open " << filePath << " failed";
     string line ;
     while (getline(ifs, line)) {
-      stopWords_.insert(line);
+      stopWords->insert(line);
     }
-    assert(stopWords_.size());
+    assert(stopWords->size());
   }
 
   static bool Compare(const Word& lhs, const Word& rhs) {
@@ -136,10 +200,10 @@ class KeywordExtractor {
   }
 
   MixSegment segment_;
-  unordered_map<string, double> idfMap_;
+  shared_ptr<const unordered_map<string, double> > idfMap_; // Shared with copies
   double idfAverage_;
 
-  unordered_set<string> stopWords_;
+  shared_ptr<const unordered_set<string> > stopWords_;
 }; // class KeywordExtractor
 
 inline ostream& operator << (ostream& os, const KeywordExtractor::Word& word) {
@@ -56,7 +56,7 @@ class MPSegment: public SegmentTagged {
            RuneStrArray::const_iterator end,
            vector<WordRange>& words,
            size_t max_word_len = MAX_WORD_LENGTH) const {
-    vector<Dag> dags;
+    vector<Dag>& dags = CutScratch::Local().dags;
     dictTrie_->Find(begin, 
           end, 
           dags,
@@ -42,19 +42,29 @@ class MixSegment: public SegmentTagged {
     words.reserve(wrs.size());
     GetWordsFromWordRanges(sentence, wrs, words);
   }
+  // Into the thread's scratch buffers, so that only words grows, and only past its capacity
+  void Cut(const char* sentence, size_t len, vector<WordSpan>& words, bool hmm = true) const {
+    const Sentence one(sentence, len);
+    CutSentences(*this, &one, 1, words, NULL, hmm);
+  }
+  // Many at once, the words of sentences[k] ending at ends[k]
+  void Cut(const vector<Sentence>& sentences, vector<WordSpan>& words, vector<size_t>& ends, bool hmm = true) const {
+    CutSentences(*this, sentences.data(), sentences.size(), words, &ends, hmm);
+  }
 
   void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool hmm) const {
     if (!hmm) {
       mpSeg_.Cut(begin, end, res);
       return;
     }
-    vector<WordRange> words;
+    CutScratch& scratch = CutScratch::Local();
+    vector<WordRange>& words = scratch.mpRes;
     assert(end >= begin);
-    words.reserve(end - begin);
+    words.clear();
     mpSeg_.Cut(begin, end, words);
 
-    vector<WordRange> hmmRes;
-    hmmRes.reserve(end - begin);
+    vector<WordRange>& hmmRes = scratch.hmmRes;
+    hmmRes.clear();
     for (size_t i = 0; i < words.size(); i++) {
       //if mp Get a word, it's ok, put it into result
       if (words[i].left != words[i].right || (words[i].left == words[i].right && mpSeg_.IsUserDictSingleChineseWord(words[i].left->rune))) {
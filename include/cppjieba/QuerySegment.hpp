@@ -46,12 +46,21 @@ class QuerySegment: public SegmentBase {
     words.reserve(wrs.size());
     GetWordsFromWordRanges(sentence, wrs, words);
   }
+  // Into the thread's scratch buffers, so that only words grows, and only past its capacity
+  void Cut(const char* sentence, size_t len, vector<WordSpan>& words, bool hmm = true) const {
+    const Sentence one(sentence, len);
+    CutSentences(*this, &one, 1, words, NULL, hmm);
+  }
+  // Many at once, the words of sentences[k] ending at ends[k]
+  void Cut(const vector<Sentence>& sentences, vector<WordSpan>& words, vector<size_t>& ends, bool hmm = true) const {
+    CutSentences(*this, sentences.data(), sentences.size(), words, &ends, hmm);
+  }
   void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool hmm) const {
     //use mix Cut first
-    vector<WordRange> mixRes;
+    vector<WordRange>& mixRes = CutScratch::Local().mixRes;
+    mixRes.clear();
     mixSeg_.Cut(begin, end, mixRes, hmm);
 
-    vector<WordRange> fullRes;
     for (vector<WordRange>::const_iterator mixResItr = mixRes.begin(); mixResItr != mixRes.end(); mixResItr++) {
       if (mixResItr->Length() > 2) {
         for (size_t i = 0; i + 1 < mixResItr->Length(); i++) {
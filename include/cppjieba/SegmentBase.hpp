@@ -12,6 +12,26 @@ const char* const SPECIAL_SEPARATORS = " \t\n\xEF\xBC\x8C\xE3\x80\x82";
 
 using namespace limonp;
 
+// Buffers that the WordSpan overloads of Cut reuse, so that once they have grown to the longest
+// sentence seen, cutting allocates nothing. One set per thread, with one buffer per segment
+// level, as QuerySegment cuts with MixSegment, which cuts with MPSegment and HMMSegment
+struct CutScratch {
+  vector<RuneStr> runes; // Sized to the longest sentence, not to its runes
+  vector<WordRange> ranges;
+  vector<WordRange> mixRes; // QuerySegment
+  vector<WordRange> mpRes; // MixSegment
+  vector<WordRange> hmmRes; // MixSegment
+  vector<Dag> dags; // MPSegment
+  vector<size_t> status; // HMMSegment
+  vector<int> path; // HMMSegment
+  vector<double> weight; // HMMSegment
+
+  static CutScratch& Local() {
+    static thread_local CutScratch scratch;
+    return scratch;
+  }
+}; // struct CutScratch
+
 class SegmentBase {
  public:
   SegmentBase() {
@@ -38,6 +58,53 @@ class SegmentBase {
     return true;
   }
  protected:
+  // Into runes, which only ever grow so as not to be initialized again. Returns the end
+  RuneStrArray::const_iterator DecodeSentence(const char* s, size_t len, vector<RuneStr>& runes) const {
+    if (runes.size() < len) {
+      runes.resize(len);
+    }
+    const size_t count = DecodeRuneStrs(s, len, runes.data());
+    if (count == DECODE_FAILED) {
+      XLOG(ERROR) << "decode failed. ";
+      return runes.data();
+    }
+    return runes.data() + count;
+  }
+
+  // Up to the next separator, or past it if cursor is on one, as PreFilter splits sentences
+  RuneStrArray::const_iterator NextRange(RuneStrArray::const_iterator cursor, RuneStrArray::const_iterator end) const {
+    RuneStrArray::const_iterator stop = cursor;
+    while (stop != end && !IsIn(symbols_, stop->rune)) {
+      stop++;
+    }
+    return stop == cursor ? stop + 1 : stop;
+  }
+
+  // Cuts each sentence with the range Cut of segment, splitting it as PreFilter does, into the
+  // thread's scratch buffers. Appends the words of every sentence, then if given, where they end
+  template <class Segment>
+  void CutSentences(const Segment& segment, const Sentence* sentences, size_t count,
+        vector<WordSpan>& words, vector<size_t>* ends, bool hmm) const {
+    CutScratch& scratch = CutScratch::Local();
+    words.clear();
+    if (ends != NULL) {
+      ends->clear();
+    }
+    for (size_t k = 0; k < count; k++) {
+      scratch.ranges.clear();
+      RuneStrArray::const_iterator end = DecodeSentence(sentences[k].data, sentences[k].size, scratch.runes);
+      for (RuneStrArray::const_iterator cursor = scratch.runes.data(); cursor != end;) {
+        RuneStrArray::const_iterator next = NextRange(cursor, end);
+        segment.Cut(cursor, next, scratch.ranges, hmm);
+        cursor = next;
+      }
+      GetSpansFromWordRanges(scratch.ranges, words);
+      if (ends != NULL) {
+        ends->push_back(words.size());
+      }
+    }
+  }
+
   unordered_set<Rune> symbols_;
 }; // class SegmentBase
 
@@ -3,8 +3,12 @@
 
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include "limonp/StdExtension.hpp"
 #include "Unicode.hpp"
+#include "DictImage.hpp"
 
 namespace cppjieba {
 
@@ -38,24 +42,77 @@ struct Dag {
 
 typedef Rune TrieKey;
 
-class TrieNode {
- public :
-  TrieNode(): next(NULL), ptValue(NULL) {
-  }
- public:
-  typedef unordered_map<TrieKey, TrieNode*> NextMap;
-  NextMap *next;
-  const DictUnit *ptValue;
-};
-
+// Double-array trie: the child of node s by label l lives at slot base[s] + l, if the check of
+// that slot is s, so lookups never chase pointers or hash runes. Runes are numbered by how
+// often they occur in the keys, and spelled with one label for the 127 most frequent ones, two
+// for the next 8192 and three past that, which keeps siblings within 255 slots of each other.
 class Trie {
  public:
   Trie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers)
-   : root_(new TrieNode) {
+   : mapped_(false) {
     CreateTrie(keys, valuePointers);
   }
-  ~Trie() {
-    DeleteNode(root_);
+
+  // Uses the arrays saved by Save in place, so the image must outlive the trie. Entries are
+  // what the saved values index, in the order they were given to the saved trie
+  Trie(ImageReader& reader, const vector<const DictUnit*>& entries)
+   : entries_(entries), mapped_(true) {
+    size_t valueCount = 0;
+    units_ = reader.GetArray<Unit>(size_);
+    values_ = reader.GetArray<int32_t>(valueCount);
+    codes_ = reader.GetArray<uint32_t>(code_table_size_);
+    const vector<uint32_t> wide = reader.GetVector<uint32_t>();
+    code_count_ = reader.Get<uint32_t>();
+    free_head_ = reader.Get<int32_t>();
+
+    if (size_ == 0 || valueCount != size_ || wide.size() % 2 != 0 || free_head_ >= int32_t(size_)) {
+      throw runtime_error("dictionary image has a bad trie");
+    }
+    for (size_t i = 0; i < size_; i++) {
+      if (values_[i] >= int32_t(entries_.size())) {
+        throw runtime_error("dictionary image has a bad trie");
+      }
+    }
+    for (size_t i = 0; i < wide.size(); i += 2) {
+      wide_codes_[wide[i]] = wide[i + 1];
+    }
+  }
+
+  // A copy to edit, whose entries are those of other, or what moved maps them to
+  Trie(const Trie& other, const unordered_map<const DictUnit*, const DictUnit*>& moved)
+   : unit_store_(other.units_, other.units_ + other.size_),
+     value_store_(other.values_, other.values_ + other.size_),
+     code_store_(other.codes_, other.codes_ + other.code_table_size_),
+     entries_(other.entries_),
+     mapped_(false),
+     trials_(other.mapped_ ? vector<uint8_t>(other.size_, 0) : other.trials_),
+     wide_codes_(other.wide_codes_),
+     code_count_(other.code_count_),
+     free_head_(other.free_head_) {
+    if (!moved.empty()) {
+      for (size_t i = 0; i < entries_.size(); i++) {
+        unordered_map<const DictUnit*, const DictUnit*>::const_iterator it = moved.find(entries_[i]);
+        if (it != moved.end()) {
+          entries_[i] = it->second;
+        }
+      }
+    }
+    Sync();
+  }
+
+  void Save(ImageWriter& writer) const {
+    writer.PutArray(units_, size_);
+    writer.PutArray(values_, size_);
+    writer.PutArray(codes_, code_table_size_);
+
+    vector<uint32_t> wide;
+    for (unordered_map<Rune, uint32_t>::const_iterator iter = wide_codes_.begin(); iter != wide_codes_.end(); ++iter) {
+      wide.push_back(iter->first);
+      wide.push_back(iter->second);
+    }
+    writer.PutArray(wide);
+    writer.Put<uint32_t>(code_count_);
+    writer.Put<int32_t>(free_head_);
   }
 
   const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
@@ -63,111 +120,476 @@ class Trie {
       return NULL;
     }
 
-    const TrieNode* ptNode = root_;
-    TrieNode::NextMap::const_iterator citer;
+    int32_t node = 0;
     for (RuneStrArray::const_iterator it = begin; it != end; it++) {
-      if (NULL == ptNode->next) {
+      node = Next(node, it->rune);
+      if (node < 0) {
         return NULL;
       }
-      citer = ptNode->next->find(it->rune);
-      if (ptNode->next->end() == citer) {
-        return NULL;
-      }
-      ptNode = citer->second;
     }
-    return ptNode->ptValue;
+    return Value(node);
   }
 
   void Find(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<struct Dag>&res, 
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    assert(root_ != NULL);
     res.resize(end - begin);
 
-    const TrieNode *ptNode = NULL;
-    TrieNode::NextMap::const_iterator citer;
     for (size_t i = 0; i < size_t(end - begin); i++) {
       res[i].runestr = *(begin + i);
+      res[i].nexts.clear(); // Dags may be reused
 
-      if (root_->next != NULL && root_->next->end() != (citer = root_->next->find(res[i].runestr.rune))) {
-        ptNode = citer->second;
-      } else {
-        ptNode = NULL;
-      }
-      if (ptNode != NULL) {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, ptNode->ptValue));
-      } else {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, static_cast<const DictUnit*>(NULL)));
-      }
+      int32_t node = Next(0, res[i].runestr.rune);
+      res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, node < 0 ? NULL : Value(node)));
 
-      for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
-        if (ptNode == NULL || ptNode->next == NULL) {
-          break;
-        }
-        citer = ptNode->next->find((begin + j)->rune);
-        if (ptNode->next->end() == citer) {
-          break;
-        }
-        ptNode = citer->second;
-        if (NULL != ptNode->ptValue) {
-          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, ptNode->ptValue));
+      for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= max_word_len && node >= 0; j++) {
+        node = Next(node, (begin + j)->rune);
+        if (node >= 0 && values_[node] >= 0) {
+          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, Value(node)));
         }
       }
     }
   }
 
+  const DictUnit* Find(const Unicode& key) const {
+    int32_t node = 0;
+    for (Unicode::const_iterator citer = key.begin(); citer != key.end() && node >= 0; ++citer) {
+      node = Next(node, *citer);
+    }
+    return key.begin() == key.end() || node < 0 ? NULL : Value(node);
+  }
+
   void InsertNode(const Unicode& key, const DictUnit* ptValue) {
     if (key.begin() == key.end()) {
       return;
     }
+    Detach();
 
-    TrieNode::NextMap::const_iterator kmIter;
-    TrieNode *ptNode = root_;
+    int32_t node = 0;
     for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
-      if (NULL == ptNode->next) {
-        ptNode->next = new TrieNode::NextMap;
+      uint32_t code = Code(*citer);
+      if (code == 0) {
+        code = AddCode(*citer);
+      }
+      uint8_t labels[3];
+      const size_t count = Spell(code, labels);
+      for (size_t i = 0; i < count; i++) {
+        const int32_t next = Child(node, labels[i]);
+        node = next < 0 ? AddChild(node, labels[i]) : next;
+      }
+    }
+    entries_.push_back(ptValue);
+    value_store_[node] = int32_t(entries_.size() - 1);
+  }
+
+  // Leaves the nodes in place, only the key stops ending there
+  bool DeleteNode(const Unicode& key) {
+    int32_t node = 0;
+    for (Unicode::const_iterator citer = key.begin(); citer != key.end() && node >= 0; ++citer) {
+      node = Next(node, *citer);
+    }
+    if (key.begin() == key.end() || node < 0 || values_[node] < 0) {
+      return false;
+    }
+    Detach();
+    value_store_[node] = -1;
+    return true;
+  }
+
+  // Bytes held by the arrays, whether allocated or mapped
+  size_t MemoryUsage() const {
+    return size_ * (sizeof(Unit) + sizeof(int32_t)) + trials_.capacity() + code_table_size_ * sizeof(uint32_t)
+      + entries_.capacity() * sizeof(const DictUnit*) + wide_codes_.size() * (sizeof(Rune) + sizeof(uint32_t) + 2 * sizeof(void*));
+  }
+
+ private:
+  // Used slots hold the base of their children and their parent. Free slots form a circular
+  // list instead, with the next and previous free slots stored as -(slot + 1). Free slots that
+  // failed too many searches leave the list, so that they stop slowing down the next ones
+  struct Unit {
+    int32_t base; // NO_BASE for leaves
+    int32_t check;
+  };
+
+  static const int32_t NO_BASE = -1;
+  static const int32_t UNLISTED = numeric_limits<int32_t>::min();
+  static const uint8_t MAX_TRIALS = 16;
+  static const uint32_t MAX_LABEL = 255;
+  static const Rune DENSE_RUNES = 0x10000; // Runes past the BMP are looked up in wide_codes_
+
+  uint32_t Code(Rune rune) const {
+    if (rune < code_table_size_) {
+      return codes_[rune];
+    }
+    if (rune < DENSE_RUNES || wide_codes_.empty()) {
+      return 0;
+    }
+    unordered_map<Rune, uint32_t>::const_iterator iter = wide_codes_.find(rune);
+    return iter == wide_codes_.end() ? 0 : iter->second;
+  }
+
+  uint32_t AddCode(Rune rune) {
+    const uint32_t code = ++code_count_;
+    if (rune < DENSE_RUNES) {
+      if (rune >= code_store_.size()) {
+        code_store_.resize(rune + 1, 0);
+      }
+      code_store_[rune] = code;
+      Sync();
+    } else {
+      wide_codes_[rune] = code;
+    }
+    return code;
+  }
+
+  // Labels are 1-127 for a code on its own, and 128-191 or 192-255 to start one of two or three
+  // labels, the rest of which are 1-128
+  static size_t Spell(uint32_t code, uint8_t labels[3]) {
+    if (code < 128) {
+      labels[0] = uint8_t(code);
+      return 1;
+    }
+    code -= 128;
+    if (code < (64 << 7)) {
+      labels[0] = uint8_t(128 + (code >> 7));
+      labels[1] = uint8_t((code & 127) + 1);
+      return 2;
+    }
+    code -= 64 << 7;
+    assert(code < (64 << 14));
+    labels[0] = uint8_t(192 + (code >> 14));
+    labels[1] = uint8_t(((code >> 7) & 127) + 1);
+    labels[2] = uint8_t((code & 127) + 1);
+    return 3;
+  }
+
+  int32_t Next(int32_t node, Rune rune) const {
+    const uint32_t code = Code(rune);
+    if (code == 0) {
+      return -1;
+    }
+    if (code < 128) {
+      return Child(node, code);
+    }
+
+    uint8_t labels[3];
+    const size_t count = Spell(code, labels);
+    for (size_t i = 0; i < count && node >= 0; i++) {
+      node = Child(node, labels[i]);
+    }
+    return node;
+  }
+
+  int32_t Child(int32_t node, uint32_t label) const {
+    if (units_[node].base == NO_BASE) {
+      return -1;
+    }
+    const size_t slot = size_t(units_[node].base) + label;
+    if (slot >= size_ || units_[slot].check != node) {
+      return -1;
+    }
+    return int32_t(slot);
+  }
+
+  bool IsFree(size_t slot) const {
+    return slot >= size_ || units_[slot].check < 0;
+  }
+
+  size_t NextFree(size_t slot) const {
+    return size_t(-units_[slot].check - 1);
+  }
+
+  const DictUnit* Value(int32_t node) const {
+    return values_[node] < 0 ? NULL : entries_[values_[node]];
+  }
+
+  void Sync() {
+    units_ = unit_store_.empty() ? NULL : &unit_store_[0];
+    values_ = value_store_.empty() ? NULL : &value_store_[0];
+    size_ = unit_store_.size();
+    codes_ = code_store_.empty() ? NULL : &code_store_[0];
+    code_table_size_ = code_store_.size();
+  }
+
+  // Copies mapped arrays before they are changed
+  void Detach() {
+    if (!mapped_) {
+      return;
+    }
+    unit_store_.assign(units_, units_ + size_);
+    value_store_.assign(values_, values_ + size_);
+    code_store_.assign(codes_, codes_ + code_table_size_);
+    trials_.assign(size_, 0);
+    mapped_ = false;
+    Sync();
+  }
+
+  void Link(size_t slot) {
+    trials_[slot] = 0;
+    if (free_head_ < 0) {
+      unit_store_[slot].base = unit_store_[slot].check = -int32_t(slot) - 1;
+      free_head_ = int32_t(slot);
+      return;
+    }
+    const size_t next = size_t(free_head_);
+    const size_t prev = size_t(-unit_store_[next].base - 1);
+    unit_store_[slot].base = -int32_t(prev) - 1;
+    unit_store_[slot].check = -int32_t(next) - 1;
+    unit_store_[prev].check = unit_store_[next].base = -int32_t(slot) - 1;
+  }
+
+  void Unlink(size_t slot) {
+    if (unit_store_[slot].check == UNLISTED) {
+      return;
+    }
+    const size_t next = NextFree(slot);
+    const size_t prev = size_t(-unit_store_[slot].base - 1);
+    if (next == slot) {
+      free_head_ = -1;
+      return;
+    }
+    unit_store_[prev].check = unit_store_[slot].check;
+    unit_store_[next].base = unit_store_[slot].base;
+    if (free_head_ == int32_t(slot)) {
+      free_head_ = int32_t(next);
+    }
+  }
+
+  // Slots past the end are free, and get linked in as they are needed
+  void Reserve(size_t size) {
+    size_t slot = size_;
+    if (size <= slot) {
+      return;
+    }
+    unit_store_.resize(size);
+    value_store_.resize(size, -1);
+    trials_.resize(size, 0);
+    Sync();
+    for (; slot < size; slot++) {
+      Link(slot);
+    }
+  }
+
+  // A base that puts every one of the sorted labels on a free slot
+  int32_t FindBase(const vector<uint8_t>& labels) {
+    if (free_head_ < 0) {
+      Reserve(size_ + 1);
+    }
+
+    size_t slot = size_t(free_head_);
+    for (;;) {
+      if (slot >= labels.front()) {
+        const size_t base = slot - labels.front();
+        size_t i = 1;
+        while (i < labels.size() && IsFree(base + labels[i])) {
+          i++;
+        }
+        if (i == labels.size()) {
+          Reserve(base + labels.back() + 1);
+          return int32_t(base);
+        }
+      }
+
+      size_t next = NextFree(slot);
+      if (next == size_t(free_head_)) {
+        Reserve(size_ + 1);
+        next = NextFree(slot);
+      }
+      if (++trials_[slot] >= MAX_TRIALS) {
+        Unlink(slot);
+        unit_store_[slot].base = unit_store_[slot].check = UNLISTED;
+      }
+      slot = next;
+    }
+  }
+
+  void Claim(size_t slot, int32_t parent) {
+    Reserve(slot + 1);
+    Unlink(slot);
+    unit_store_[slot].base = NO_BASE;
+    unit_store_[slot].check = parent;
+  }
+
+  void Release(size_t slot) {
+    value_store_[slot] = -1;
+    Link(slot);
+  }
+
+  vector<uint8_t> ChildLabels(int32_t node) const {
+    vector<uint8_t> labels;
+    for (uint32_t label = 1; label <= MAX_LABEL; label++) {
+      if (Child(node, label) >= 0) {
+        labels.push_back(uint8_t(label));
       }
-      kmIter = ptNode->next->find(*citer);
-      if (ptNode->next->end() == kmIter) {
-        TrieNode *nextNode = new TrieNode;
+    }
+    return labels;
+  }
 
-        ptNode->next->insert(make_pair(*citer, nextNode));
-        ptNode = nextNode;
+  int32_t AddChild(int32_t node, uint8_t label) {
+    if (unit_store_[node].base == NO_BASE) {
+      unit_store_[node].base = FindBase(vector<uint8_t>(1, label));
+    } else if (!IsFree(size_t(unit_store_[node].base) + label)) {
+      // Moves whichever family is smaller out of the way
+      const int32_t owner = unit_store_[size_t(unit_store_[node].base) + label].check;
+      vector<uint8_t> labels = ChildLabels(node);
+      const vector<uint8_t> others = ChildLabels(owner);
+      if (others.size() < labels.size() + 1) {
+        const int32_t moved = Relocate(owner, others, node);
+        if (moved >= 0) {
+          node = moved;
+        }
       } else {
-        ptNode = kmIter->second;
+        labels.insert(lower_bound(labels.begin(), labels.end(), label), label);
+        Relocate(node, labels, -1);
       }
     }
-    assert(ptNode != NULL);
-    ptNode->ptValue = ptValue;
+
+    const size_t slot = size_t(unit_store_[node].base) + label;
+    Claim(slot, node);
+    return int32_t(slot);
+  }
+
+  // Moves the children of node to a base where all of the labels fit, and returns where the
+  // child at slot watched went, or -1 if it stayed
+  int32_t Relocate(int32_t node, const vector<uint8_t>& labels, int32_t watched) {
+    const size_t from = size_t(unit_store_[node].base);
+    const size_t to = size_t(FindBase(labels));
+    int32_t moved = -1;
+
+    for (size_t i = 0; i < labels.size(); i++) {
+      const size_t src = from + labels[i];
+      if (IsFree(src) || unit_store_[src].check != node) {
+        continue; // The label being added
+      }
+      const size_t dst = to + labels[i];
+      const vector<uint8_t> grandchildren = ChildLabels(int32_t(src));
+
+      Claim(dst, node);
+      unit_store_[dst].base = unit_store_[src].base;
+      value_store_[dst] = value_store_[src];
+      for (size_t j = 0; j < grandchildren.size(); j++) {
+        unit_store_[size_t(unit_store_[src].base) + grandchildren[j]].check = int32_t(dst);
+      }
+      if (int32_t(src) == watched) {
+        moved = int32_t(dst);
+      }
+      Release(src);
+    }
+    unit_store_[node].base = int32_t(to);
+    return moved;
+  }
+
+  // Places the children of the node shared by the sorted keys [begin, end), depth labels in
+  void Build(int32_t node, const vector<vector<uint8_t> >& spellings, const vector<size_t>& order,
+        size_t begin, size_t end, size_t depth) {
+    // Shorter keys sort first; for duplicates the last one wins, as with repeated InsertNode
+    while (begin < end && spellings[order[begin]].size() == depth) {
+      value_store_[node] = int32_t(order[begin]);
+      begin++;
+    }
+    if (begin == end) {
+      return;
+    }
+
+    vector<uint8_t> labels;
+    for (size_t i = begin; i < end; i++) {
+      const uint8_t label = spellings[order[i]][depth];
+      if (labels.empty() || labels.back() != label) {
+        labels.push_back(label);
+      }
+    }
+
+    const int32_t base = FindBase(labels);
+    unit_store_[node].base = base;
+    for (size_t i = 0; i < labels.size(); i++) {
+      Claim(size_t(base) + labels[i], node);
+    }
+
+    for (size_t i = begin; i < end;) {
+      const uint8_t label = spellings[order[i]][depth];
+      size_t j = i + 1;
+      while (j < end && spellings[order[j]][depth] == label) {
+        j++;
+      }
+      Build(base + int32_t(label), spellings, order, i, j, depth + 1);
+      i = j;
+    }
   }
 
- private:
   void CreateTrie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers) {
+    code_count_ = 0;
+    free_head_ = -1;
+    Sync();
+    Claim(0, 0); // The root, which no label leads back to
     if (valuePointers.empty() || keys.empty()) {
       return;
     }
     assert(keys.size() == valuePointers.size());
+    entries_ = valuePointers;
 
+    unordered_map<Rune, size_t> counts;
     for (size_t i = 0; i < keys.size(); i++) {
-      InsertNode(keys[i], valuePointers[i]);
+      for (Unicode::const_iterator citer = keys[i].begin(); citer != keys[i].end(); ++citer) {
+        counts[*citer]++;
+      }
     }
-  }
-
-  void DeleteNode(TrieNode* node) {
-    if (NULL == node) {
-      return;
+    vector<pair<size_t, Rune> > runes;
+    for (unordered_map<Rune, size_t>::const_iterator iter = counts.begin(); iter != counts.end(); ++iter) {
+      runes.push_back(make_pair(iter->second, iter->first));
     }
-    if (NULL != node->next) {
-      for (TrieNode::NextMap::iterator it = node->next->begin(); it != node->next->end(); ++it) {
-        DeleteNode(it->second);
+    sort(runes.begin(), runes.end(), greater<pair<size_t, Rune> >());
+    for (size_t i = 0; i < runes.size(); i++) {
+      AddCode(runes[i].second);
+    }
+
+    vector<vector<uint8_t> > spellings(keys.size());
+    vector<size_t> order;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (keys[i].begin() == keys[i].end()) {
+        continue;
       }
-      delete node->next;
+      for (Unicode::const_iterator citer = keys[i].begin(); citer != keys[i].end(); ++citer) {
+        uint8_t labels[3];
+        const size_t count = Spell(Code(*citer), labels);
+        spellings[i].insert(spellings[i].end(), labels, labels + count);
+      }
+      order.push_back(i);
     }
-    delete node;
+    stable_sort(order.begin(), order.end(), SpellingLess(spellings));
+
+    Build(0, spellings, order, 0, order.size(), 0);
+    unit_store_.shrink_to_fit();
+    value_store_.shrink_to_fit();
+    trials_.shrink_to_fit();
+    Sync();
   }
 
-  TrieNode* root_;
+  struct SpellingLess {
+    const vector<vector<uint8_t> >& spellings;
+    explicit SpellingLess(const vector<vector<uint8_t> >& s): spellings(s) {
+    }
+    bool operator()(size_t a, size_t b) const {
+      return spellings[a] < spellings[b];
+    }
+  };
+
+  // Read through these, which point either into the vectors below or into a mapped image
+  const Unit* units_;
+  const int32_t* values_; // Index of the entry where a key ends, -1 elsewhere
+  size_t size_;
+  const uint32_t* codes_; // By rune, 0 for runes not in any key
+  size_t code_table_size_;
+
+  vector<Unit> unit_store_;
+  vector<int32_t> value_store_;
+  vector<uint32_t> code_store_;
+  vector<const DictUnit*> entries_;
+  bool mapped_;
+  vector<uint8_t> trials_; // Failed searches starting at each free slot
+  unordered_map<Rune, uint32_t> wide_codes_;
+  uint32_t code_count_;
+  int32_t free_head_; // -1 when no slot is free
 }; // class Trie
 } // namespace cppjieba
 
@@ -3,9 +3,13 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <vector>
 #include <ostream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "limonp/LocalVector.hpp"
 
 namespace cppjieba {
@@ -27,6 +31,27 @@ inline std::ostream& operator << (std::ostream& os, const Word& w) {
   return os << "{\"word\": \"" << w.word << "\", \"offset\": " << w.offset << "}";
 }
 
+// A word as bytes of the sentence it was cut from, without copying them
+struct WordSpan {
+  uint32_t offset;
+  uint32_t length;
+  WordSpan(uint32_t o, uint32_t l)
+   : offset(o), length(l) {
+  }
+}; // struct WordSpan
+
+// Bytes of a sentence to cut, which only have to outlive the call
+struct Sentence {
+  const char* data;
+  size_t size;
+  Sentence(const char* d, size_t s)
+   : data(d), size(s) {
+  }
+  Sentence(const string& s)
+   : data(s.data()), size(s.size()) {
+  }
+}; // struct Sentence
+
 struct RuneStr {
   Rune rune;
   uint32_t offset;
@@ -129,22 +154,377 @@ inline RuneStrLite DecodeRuneInString(const char* str, size_t len) {
   return rp;
 }
 
-inline bool DecodeRunesInString(const char* s, size_t len, RuneStrArray& runes) {
-  runes.clear();
-  runes.reserve(len / 2);
-  for (size_t i = 0; i < len;) {
+// Returned by the RuneStr decoders for input that DecodeRuneInString rejects
+const size_t DECODE_FAILED = size_t(-1);
+
+// A sequence already known to be len bytes long, as DecodeRuneInString reads it
+inline Rune DecodeSequence(const uint8_t* s, size_t len) {
+  static const uint8_t LEAD_MASKS[5] = {0, 0x7f, 0x1f, 0x0f, 0x07};
+  Rune rune = s[0] & LEAD_MASKS[len];
+  for (size_t i = 1; i < len; i++) {
+    rune = (rune << 6) | (s[i] & 0x3f);
+  }
+  return rune;
+}
+
+// One rune at a time from i until at least stop; false if DecodeRuneInString fails
+inline bool DecodeRuneStrsUntil(const char* s, size_t len, size_t stop, size_t& i, RuneStr* out, size_t& n) {
+  while (i < stop) {
     RuneStrLite rp = DecodeRuneInString(s + i, len - i);
     if (rp.len == 0) {
-      runes.clear();
       return false;
     }
-    RuneStr x(rp.rune, i, rp.len);
-    runes.push_back(x);
+    out[n++] = RuneStr(rp.rune, uint32_t(i), rp.len);
     i += rp.len;
   }
   return true;
 }
 
+// Into out, which must have room for len runes. Returns how many, or DECODE_FAILED
+inline size_t DecodeRuneStrsScalar(const char* s, size_t len, RuneStr* out) {
+  size_t i = 0, n = 0;
+  return DecodeRuneStrsUntil(s, len, len, i, out, n) ? n : DECODE_FAILED;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The vectorized decoders take blocks of 16 or 32 bytes at once. Blocks of ASCII, and of three
+// byte sequences as CJK text mostly is, are decoded in place. Other blocks are decoded by
+// position once their bytes are checked to form whole sequences, and anything else, such as
+// stray continuation bytes, goes through the scalar decoder, so that the runes always come
+// out as DecodeRuneInString would read them, malformed input included
+
+// Bit k is set for byte k of a block that is of the class
+struct ByteClasses {
+  uint32_t high; // 1xxxxxxx
+  uint32_t lead2; // 110xxxxx
+  uint32_t lead3; // 1110xxxx
+  uint32_t lead4; // 11110xxx
+  uint32_t cont; // 10xxxxxx
+}; // struct ByteClasses
+
+// The continuation bytes that the leads call for
+inline uint64_t ContinuationsOf(uint64_t lead2, uint64_t lead3, uint64_t lead4) {
+  return (lead2 | lead3 | lead4) << 1 | (lead3 | lead4) << 2 | lead4 << 3;
+}
+
+// The starts of the sequences in the first limit bytes of a block, if every continuation byte
+// among them is one a lead calls for and each lead gets all of its own. A sequence running
+// past the block is left for the next one
+inline bool FindSequences(const ByteClasses& c, size_t width, size_t& limit, uint64_t& starts) {
+  const uint64_t leads = uint64_t(c.lead2) | c.lead3 | c.lead4;
+  limit = width;
+  if (ContinuationsOf(c.lead2, c.lead3, c.lead4) >> width) {
+    limit = 63 - __builtin_clzll(leads);
+  }
+  const uint64_t within = (uint64_t(1) << limit) - 1;
+  const uint64_t invalid = c.high & ~(leads | c.cont); // 11111xxx
+  if (limit == 0 || (invalid & within) != 0
+      || ContinuationsOf(c.lead2 & within, c.lead3 & within, c.lead4 & within) != (c.cont & within)) {
+    return false;
+  }
+  starts = ~uint64_t(c.cont) & within;
+  return true;
+}
+
+// One sequence at a time, each read as four bytes, which must be readable at every start
+inline void DecodeSequences(const uint8_t* bytes, size_t i, uint64_t starts, size_t limit, RuneStr* out, size_t& n) {
+  static const uint32_t RUNE_MASKS[5] = {0, 0x7f, 0x7ff, 0xffff, 0x1fffff};
+  RuneStr* cursor = out + n;
+  while (starts != 0) {
+    const size_t begin = __builtin_ctzll(starts);
+    starts &= starts - 1;
+    const size_t length = (starts != 0 ? __builtin_ctzll(starts) : limit) - begin;
+    uint32_t word;
+    memcpy(&word, bytes + begin, 4);
+    word = __builtin_bswap32(word) >> (32 - 8 * length);
+    const uint32_t payload = (word & 0x3f) | (word >> 2 & 0xfc0) | (word >> 4 & 0x3f000) | (word >> 6 & 0xfc0000);
+    *cursor++ = RuneStr(length == 1 ? word : payload & RUNE_MASKS[length], uint32_t(i + begin), uint32_t(length));
+  }
+  n = cursor - out;
+}
+
+// Shuffles that move the 16 bit lanes set in a mask of 8 to the front
+struct CompactShuffles {
+  uint8_t lanes[256][16];
+
+  CompactShuffles() {
+    for (size_t mask = 0; mask < 256; mask++) {
+      memset(lanes[mask], 0x80, 16);
+      size_t k = 0;
+      for (size_t j = 0; j < 8; j++) {
+        if (mask >> j & 1) {
+          lanes[mask][2 * k] = uint8_t(2 * j);
+          lanes[mask][2 * k + 1] = uint8_t(2 * j + 1);
+          k++;
+        }
+      }
+    }
+  }
+
+  static const CompactShuffles& Get() {
+    static const CompactShuffles shuffles;
+    return shuffles;
+  }
+}; // struct CompactShuffles
+
+// Interleaves four runes, offsets and lengths into RuneStrs
+__attribute__((target("sse4.2"), always_inline))
+inline void StoreRuneStrs(__m128i runes, __m128i offsets, __m128i lens, RuneStr* out) {
+  __m128i* words = reinterpret_cast<__m128i*>(out);
+  _mm_storeu_si128(words, _mm_blend_epi16(_mm_blend_epi16(_mm_shuffle_epi32(runes, _MM_SHUFFLE(1, 0, 0, 0)),
+        _mm_shuffle_epi32(offsets, _MM_SHUFFLE(1, 0, 0, 0)), 0x0c), _mm_shuffle_epi32(lens, _MM_SHUFFLE(1, 0, 0, 0)), 0x30));
+  _mm_storeu_si128(words + 1, _mm_blend_epi16(_mm_blend_epi16(_mm_shuffle_epi32(runes, _MM_SHUFFLE(2, 2, 1, 1)),
+        _mm_shuffle_epi32(offsets, _MM_SHUFFLE(2, 2, 1, 1)), 0xc3), _mm_shuffle_epi32(lens, _MM_SHUFFLE(2, 2, 1, 1)), 0x0c));
+  _mm_storeu_si128(words + 2, _mm_blend_epi16(_mm_blend_epi16(_mm_shuffle_epi32(runes, _MM_SHUFFLE(3, 3, 3, 2)),
+        _mm_shuffle_epi32(offsets, _MM_SHUFFLE(3, 3, 3, 2)), 0x30), _mm_shuffle_epi32(lens, _MM_SHUFFLE(3, 3, 3, 2)), 0xc3));
+}
+
+// Runes of three byte sequences packed as b2 | b1 << 8 | b0 << 16 in each 32 bit lane
+__attribute__((target("sse4.2"), always_inline))
+inline __m128i DecodeThreeByteLanes(__m128i packed) {
+  const __m128i low = _mm_and_si128(packed, _mm_set1_epi32(0x3f));
+  const __m128i mid = _mm_and_si128(_mm_srli_epi32(packed, 2), _mm_set1_epi32(0xfc0));
+  const __m128i top = _mm_and_si128(_mm_srli_epi32(packed, 4), _mm_set1_epi32(0xf000));
+  return _mm_or_si128(low, _mm_or_si128(mid, top));
+}
+
+__attribute__((target("sse4.2"), always_inline))
+inline __m128i MatchBytes(__m128i v, char mask, char bits) {
+  return _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(mask)), _mm_set1_epi8(bits));
+}
+
+__attribute__((target("sse4.2"), always_inline))
+inline ByteClasses ClassifyBytes(__m128i v) {
+  ByteClasses c;
+  c.high = uint32_t(_mm_movemask_epi8(v));
+  c.lead2 = uint32_t(_mm_movemask_epi8(MatchBytes(v, char(0xe0), char(0xc0))));
+  c.lead3 = uint32_t(_mm_movemask_epi8(MatchBytes(v, char(0xf0), char(0xe0))));
+  c.lead4 = uint32_t(_mm_movemask_epi8(MatchBytes(v, char(0xf8), char(0xf0))));
+  c.cont = uint32_t(_mm_movemask_epi8(MatchBytes(v, char(0xc0), char(0x80))));
+  return c;
+}
+
+// Eight bytes, each taken as the start of a sequence of at most three, with the two bytes
+// after it, and the sequences in starts stored. Offsets are position + i
+__attribute__((target("sse4.2"), always_inline))
+inline void DecodeShortSequences(__m128i first, __m128i second, __m128i third, __m128i positions, size_t i,
+      uint32_t starts, const CompactShuffles& shuffles, RuneStr* out, size_t& n) {
+  const __m128i b0 = _mm_cvtepu8_epi16(first);
+  const __m128i b1 = _mm_and_si128(_mm_cvtepu8_epi16(second), _mm_set1_epi16(0x3f));
+  const __m128i b2 = _mm_and_si128(_mm_cvtepu8_epi16(third), _mm_set1_epi16(0x3f));
+  const __m128i lead2 = _mm_cvtepi8_epi16(MatchBytes(first, char(0xe0), char(0xc0)));
+  const __m128i lead3 = _mm_cvtepi8_epi16(MatchBytes(first, char(0xf0), char(0xe0)));
+
+  const __m128i two = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b0, _mm_set1_epi16(0x1f)), 6), b1);
+  const __m128i three = _mm_or_si128(_mm_slli_epi16(b0, 12), _mm_or_si128(_mm_slli_epi16(b1, 6), b2));
+  const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffles.lanes[starts]));
+  const __m128i runes = _mm_shuffle_epi8(_mm_blendv_epi8(_mm_blendv_epi8(b0, two, lead2), three, lead3), shuffle);
+  const __m128i lens = _mm_shuffle_epi8(_mm_sub_epi16(_mm_sub_epi16(_mm_set1_epi16(1), lead2), _mm_add_epi16(lead3, lead3)), shuffle);
+  const __m128i offsets = _mm_shuffle_epi8(positions, shuffle);
+
+  const __m128i base = _mm_set1_epi32(int(i));
+  StoreRuneStrs(_mm_cvtepu16_epi32(runes), _mm_add_epi32(_mm_cvtepu16_epi32(offsets), base), _mm_cvtepu16_epi32(lens), out + n);
+  const size_t count = __builtin_popcount(starts);
+  if (count > 4) {
+    StoreRuneStrs(_mm_cvtepu16_epi32(_mm_srli_si128(runes, 8)), _mm_add_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(offsets, 8)), base),
+          _mm_cvtepu16_epi32(_mm_srli_si128(lens, 8)), out + n + 4);
+  }
+  n += count;
+}
+
+// The 16 bytes at i, read as they are followed by two more for three byte sequences, or three
+// more for four byte ones. Returns the bytes decoded, or 0 if they are malformed or the string
+// ends too soon, for the scalar decoder. out must have room for 16 runes past n, as it does
+// while n <= i
+__attribute__((target("sse4.2"), always_inline))
+inline size_t DecodeBlock(const char* s, size_t len, size_t i, __m128i v, const ByteClasses& c,
+      const CompactShuffles& shuffles, RuneStr* out, size_t& n) {
+  size_t limit = 0;
+  uint64_t starts = 0;
+  if (len - i < 18 || !FindSequences(c, 16, limit, starts)) {
+    return 0;
+  }
+  if (c.lead4 != 0) {
+    if (len - i < 19) {
+      return 0;
+    }
+    DecodeSequences(reinterpret_cast<const uint8_t*>(s) + i, i, starts, limit, out, n);
+    return limit;
+  }
+  const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 1));
+  const __m128i third = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 2));
+  DecodeShortSequences(v, second, third, _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7), i, uint32_t(starts & 0xff), shuffles, out, n);
+  DecodeShortSequences(_mm_srli_si128(v, 8), _mm_srli_si128(second, 8), _mm_srli_si128(third, 8),
+        _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15), i, uint32_t(starts >> 8), shuffles, out, n);
+  return limit;
+}
+
+__attribute__((target("sse4.2")))
+inline size_t DecodeRuneStrsSse(const char* s, size_t len, size_t i, RuneStr* out, size_t n) {
+  const CompactShuffles& shuffles = CompactShuffles::Get();
+  const __m128i threeByteShuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i ones = _mm_set1_epi32(1), threes = _mm_set1_epi32(3);
+  const __m128i steps = _mm_setr_epi32(0, 1, 2, 3), threeSteps = _mm_setr_epi32(0, 3, 6, 9);
+  while (i + 18 <= len) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    const ByteClasses c = ClassifyBytes(v);
+    if (c.high == 0) {
+      for (size_t k = 0; k < 16; k += 4) {
+        int32_t bytes;
+        memcpy(&bytes, s + i + k, 4);
+        StoreRuneStrs(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)), _mm_add_epi32(_mm_set1_epi32(int(i + k)), steps), ones, out + n + k);
+      }
+      n += 16;
+      i += 16;
+    } else if ((c.lead3 & 0xfff) == 0x249 && (c.cont & 0xfff) == 0xdb6) {
+      StoreRuneStrs(DecodeThreeByteLanes(_mm_shuffle_epi8(v, threeByteShuffle)),
+            _mm_add_epi32(_mm_set1_epi32(int(i)), threeSteps), threes, out + n);
+      n += 4;
+      i += 12;
+    } else {
+      const size_t decoded = DecodeBlock(s, len, i, v, c, shuffles, out, n);
+      if (decoded > 0) {
+        i += decoded;
+      } else if (!DecodeRuneStrsUntil(s, len, i + 16, i, out, n)) {
+        return DECODE_FAILED;
+      }
+    }
+  }
+  return DecodeRuneStrsUntil(s, len, len, i, out, n) ? n : DECODE_FAILED;
+}
+
+// Interleaves eight runes, offsets and lengths into RuneStrs, lengths being the same for all
+__attribute__((target("avx2"), always_inline))
+inline void StoreRuneStrs(__m256i runes, __m256i offsets, __m256i lens, RuneStr* out) {
+  const __m256i first = _mm256_setr_epi32(0, 0, 0, 1, 1, 1, 2, 2);
+  const __m256i second = _mm256_setr_epi32(2, 3, 3, 3, 4, 4, 4, 5);
+  const __m256i third = _mm256_setr_epi32(5, 5, 6, 6, 6, 7, 7, 7);
+  __m256i* words = reinterpret_cast<__m256i*>(out);
+  _mm256_storeu_si256(words, _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(runes, first),
+        _mm256_permutevar8x32_epi32(offsets, first), 0x92), lens, 0x24));
+  _mm256_storeu_si256(words + 1, _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(runes, second),
+        _mm256_permutevar8x32_epi32(offsets, second), 0x24), lens, 0x49));
+  _mm256_storeu_si256(words + 2, _mm256_blend_epi32(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(runes, third),
+        _mm256_permutevar8x32_epi32(offsets, third), 0x49), lens, 0x92));
+}
+
+__attribute__((target("avx2"), always_inline))
+inline ByteClasses ClassifyBytes(__m256i v) {
+  ByteClasses c;
+  c.high = uint32_t(_mm256_movemask_epi8(v));
+  c.lead2 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xe0))), _mm256_set1_epi8(char(0xc0)))));
+  c.lead3 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xf0))), _mm256_set1_epi8(char(0xe0)))));
+  c.lead4 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xf8))), _mm256_set1_epi8(char(0xf0)))));
+  c.cont = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xc0))), _mm256_set1_epi8(char(0x80)))));
+  return c;
+}
+
+__attribute__((target("avx2")))
+inline size_t DecodeRuneStrsAvx2(const char* s, size_t len, RuneStr* out) {
+  const CompactShuffles& shuffles = CompactShuffles::Get();
+  const __m256i threeByteShuffle = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  const __m256i ones = _mm256_set1_epi32(1), threes = _mm256_set1_epi32(3);
+  const __m256i steps = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), threeSteps = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m128i positions = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  size_t i = 0, n = 0, limit = 0;
+  uint64_t starts = 0;
+  while (i + 32 <= len) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+    const ByteClasses c = ClassifyBytes(v);
+    if (c.high == 0) {
+      for (size_t k = 0; k < 32; k += 8) {
+        const __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + i + k)));
+        StoreRuneStrs(bytes, _mm256_add_epi32(_mm256_set1_epi32(int(i + k)), steps), ones, out + n + k);
+      }
+      n += 32;
+      i += 32;
+    } else if ((c.lead3 & 0xffffff) == 0x249249 && (c.cont & 0xffffff) == 0xdb6db6) {
+      // Eight sequences, the second four moved up to the high lane
+      const __m256i halves = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_castsi256_si128(v)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 12)), 1);
+      const __m256i packed = _mm256_shuffle_epi8(halves, threeByteShuffle);
+      const __m256i runes = _mm256_or_si256(_mm256_and_si256(packed, _mm256_set1_epi32(0x3f)),
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(packed, 2), _mm256_set1_epi32(0xfc0)),
+              _mm256_and_si256(_mm256_srli_epi32(packed, 4), _mm256_set1_epi32(0xf000))));
+      StoreRuneStrs(runes, _mm256_add_epi32(_mm256_set1_epi32(int(i)), threeSteps), threes, out + n);
+      n += 8;
+      i += 24;
+    } else if (c.lead4 == 0 && i + 34 <= len && FindSequences(c, 32, limit, starts)) {
+      for (size_t k = 0; k < 32; k += 8) {
+        DecodeShortSequences(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + i + k)),
+              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + i + k + 1)),
+              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + i + k + 2)),
+              _mm_add_epi16(positions, _mm_set1_epi16(short(k))), i, uint32_t(starts >> k & 0xff), shuffles, out, n);
+      }
+      i += limit;
+    } else if (!DecodeRuneStrsUntil(s, len, i + 32, i, out, n)) {
+      return DECODE_FAILED;
+    }
+  }
+  _mm256_zeroupper(); // Before the SSE code
+  return DecodeRuneStrsSse(s, len, i, out, n);
+}
+#endif
+
+enum DecoderIsa {
+  DECODER_SCALAR,
+  DECODER_SSE42,
+  DECODER_AVX2
+}; // enum DecoderIsa
+
+inline DecoderIsa DetectDecoderIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return DECODER_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return DECODER_SSE42;
+  }
+#endif
+  return DECODER_SCALAR;
+}
+
+inline DecoderIsa GetDecoderIsa() {
+  static const DecoderIsa detected = DetectDecoderIsa();
+  return detected;
+}
+
+inline const char* GetDecoderIsaName(DecoderIsa isa) {
+  switch (isa) {
+    case DECODER_AVX2:
+      return "avx2";
+    case DECODER_SSE42:
+      return "sse4.2";
+    default:
+      return "scalar";
+  }
+}
+
+// With the given decoder, which the CPU must support, or the best one it does
+inline size_t DecodeRuneStrs(const char* s, size_t len, RuneStr* out, DecoderIsa isa = GetDecoderIsa()) {
+#if defined(__x86_64__) || defined(__i386__)
+  switch (isa) {
+    case DECODER_AVX2:
+      return DecodeRuneStrsAvx2(s, len, out);
+    case DECODER_SSE42:
+      return DecodeRuneStrsSse(s, len, 0, out, 0);
+    default:
+      break;
+  }
+#endif
+  return DecodeRuneStrsScalar(s, len, out);
+}
+
+inline bool DecodeRunesInString(const char* s, size_t len, RuneStrArray& runes) {
+  runes.clear();
+  runes.resize(len);
+  const size_t n = DecodeRuneStrs(s, len, len > 0 ? &runes[0] : NULL);
+  runes.resize(n == DECODE_FAILED ? 0 : n);
+  return n != DECODE_FAILED;
+}
+
 inline bool DecodeRunesInString(const string& s, RuneStrArray& runes) {
   return DecodeRunesInString(s.c_str(), s.size(), runes);
 }
@@ -197,6 +577,13 @@ inline void GetWordsFromWordRanges(const string& s, const vector<WordRange>& wrs
   }
 }
 
+inline void GetSpansFromWordRanges(const vector<WordRange>& wrs, vector<WordSpan>& spans) {
+  for (size_t i = 0; i < wrs.size(); i++) {
+    assert(wrs[i].right->offset >= wrs[i].left->offset);
+    spans.push_back(WordSpan(wrs[i].left->offset, wrs[i].right->offset - wrs[i].left->offset + wrs[i].right->len));
+  }
+}
+
 inline vector<Word> GetWordsFromWordRanges(const string& s, const vector<WordRange>& wrs) {
   vector<Word> result;
   GetWordsFromWordRanges(s, wrs, result);
@@ -98,6 +98,11 @@ class LocalVector {
       free(old);
     }
   }
+  // New elements are left uninitialized, as T is primitive
+  void resize(size_t size) {
+    reserve(size);
+    size_ = size;
+  }
   bool empty() const {
     return 0 == size();
   }
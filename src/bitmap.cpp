@@ -0,0 +1,274 @@
+#include "bitmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace C3 {
+  const uint32_t bitsetWords = 1 << 10;
+
+  bool Bitmap::Container::contains(uint16_t low) const {
+    if(bits.empty()) return std::binary_search(array.begin(), array.end(), low);
+    return (bits[low >> 6] >> (low & 63)) & 1;
+  }
+
+  void _to_bits(std::vector<uint16_t> &array, std::vector<uint64_t> &bits) {
+    bits.assign(bitsetWords, 0);
+    for(auto low : array) bits[low >> 6] |= 1ull << (low & 63);
+    array.clear();
+    array.shrink_to_fit();
+  }
+
+  // Picks the smaller representation for the current cardinality
+  void Bitmap::Container::normalize(void) {
+    if(bits.empty()) {
+      if(cardinality > arrayMax) _to_bits(array, bits);
+      return;
+    }
+
+    if(cardinality > arrayMax) return;
+    array.clear();
+    array.reserve(cardinality);
+    for(uint32_t w = 0; w < bitsetWords; ++w)
+      for(uint64_t word = bits[w]; word != 0; word &= word - 1)
+        array.push_back((w << 6) | __builtin_ctzll(word));
+    bits.clear();
+    bits.shrink_to_fit();
+  }
+
+  uint32_t _popcount(const std::vector<uint64_t> &bits) {
+    uint32_t count = 0;
+    for(auto word : bits) count += __builtin_popcountll(word);
+    return count;
+  }
+
+  std::vector<Bitmap::Container>::iterator Bitmap::_find(uint16_t key) {
+    return std::lower_bound(containers.begin(), containers.end(), key,
+        [](const Container &c, uint16_t key) { return c.key < key; });
+  }
+
+  std::vector<Bitmap::Container>::const_iterator Bitmap::_find(uint16_t key) const {
+    return std::lower_bound(containers.begin(), containers.end(), key,
+        [](const Container &c, uint16_t key) { return c.key < key; });
+  }
+
+  void Bitmap::add(uint32_t value) {
+    const uint16_t key = value >> 16, low = value & 0xFFFF;
+    auto it = _find(key);
+    if(it == containers.end() || it->key != key)
+      it = containers.insert(it, Container { key, 0, {}, {} });
+
+    if(it->bits.empty()) {
+      auto pos = std::lower_bound(it->array.begin(), it->array.end(), low);
+      if(pos != it->array.end() && *pos == low) return;
+      it->array.insert(pos, low);
+    } else {
+      uint64_t &word = it->bits[low >> 6];
+      if((word >> (low & 63)) & 1) return;
+      word |= 1ull << (low & 63);
+    }
+
+    ++it->cardinality;
+    it->normalize();
+  }
+
+  void Bitmap::remove(uint32_t value) {
+    const uint16_t key = value >> 16, low = value & 0xFFFF;
+    auto it = _find(key);
+    if(it == containers.end() || it->key != key || !it->contains(low)) return;
+
+    if(it->bits.empty()) it->array.erase(std::lower_bound(it->array.begin(), it->array.end(), low));
+    else it->bits[low >> 6] &= ~(1ull << (low & 63));
+
+    if(--it->cardinality == 0) containers.erase(it);
+    else it->normalize();
+  }
+
+  bool Bitmap::contains(uint32_t value) const {
+    auto it = _find(value >> 16);
+    return it != containers.end() && it->key == (value >> 16) && it->contains(value & 0xFFFF);
+  }
+
+  uint64_t Bitmap::cardinality(void) const {
+    uint64_t count = 0;
+    for(auto &c : containers) count += c.cardinality;
+    return count;
+  }
+
+  bool Bitmap::empty(void) const {
+    return containers.empty();
+  }
+
+  Bitmap &Bitmap::operator&=(const Bitmap &other) {
+    std::vector<Container> result;
+    auto theirs = other.containers.begin();
+    for(auto &c : containers) {
+      while(theirs != other.containers.end() && theirs->key < c.key) ++theirs;
+      if(theirs == other.containers.end()) break;
+      if(theirs->key != c.key) continue;
+
+      if(c.bits.empty()) {
+        std::vector<uint16_t> kept;
+        if(theirs->bits.empty())
+          std::set_intersection(c.array.begin(), c.array.end(), theirs->array.begin(), theirs->array.end(), std::back_inserter(kept));
+        else
+          std::copy_if(c.array.begin(), c.array.end(), std::back_inserter(kept), [&](uint16_t low) { return theirs->contains(low); });
+        c.array = std::move(kept);
+        c.cardinality = c.array.size();
+      } else if(theirs->bits.empty()) {
+        std::vector<uint16_t> kept;
+        std::copy_if(theirs->array.begin(), theirs->array.end(), std::back_inserter(kept), [&](uint16_t low) { return c.contains(low); });
+        c.bits.clear();
+        c.array = std::move(kept);
+        c.cardinality = c.array.size();
+      } else {
+        for(uint32_t w = 0; w < bitsetWords; ++w) c.bits[w] &= theirs->bits[w];
+        c.cardinality = _popcount(c.bits);
+      }
+
+      if(c.cardinality == 0) continue;
+      c.normalize();
+      result.emplace_back(std::move(c));
+    }
+
+    containers = std::move(result);
+    return *this;
+  }
+
+  Bitmap &Bitmap::operator|=(const Bitmap &other) {
+    std::vector<Container> result;
+    result.reserve(containers.size() + other.containers.size());
+
+    auto mine = containers.begin();
+    for(auto &theirs : other.containers) {
+      while(mine != containers.end() && mine->key < theirs.key) result.emplace_back(std::move(*mine++));
+      if(mine == containers.end() || mine->key != theirs.key) {
+        result.push_back(theirs);
+        continue;
+      }
+
+      Container &c = *mine++;
+      if(c.bits.empty() && theirs.bits.empty()) {
+        std::vector<uint16_t> merged;
+        std::set_union(c.array.begin(), c.array.end(), theirs.array.begin(), theirs.array.end(), std::back_inserter(merged));
+        c.array = std::move(merged);
+        c.cardinality = c.array.size();
+      } else {
+        if(c.bits.empty()) _to_bits(c.array, c.bits);
+        if(theirs.bits.empty()) {
+          for(auto low : theirs.array) c.bits[low >> 6] |= 1ull << (low & 63);
+        } else {
+          for(uint32_t w = 0; w < bitsetWords; ++w) c.bits[w] |= theirs.bits[w];
+        }
+        c.cardinality = _popcount(c.bits);
+      }
+
+      c.normalize();
+      result.emplace_back(std::move(c));
+    }
+    while(mine != containers.end()) result.emplace_back(std::move(*mine++));
+
+    containers = std::move(result);
+    return *this;
+  }
+
+  Bitmap &Bitmap::operator-=(const Bitmap &other) {
+    std::vector<Container> result;
+    auto theirs = other.containers.begin();
+    for(auto &c : containers) {
+      while(theirs != other.containers.end() && theirs->key < c.key) ++theirs;
+      if(theirs == other.containers.end() || theirs->key != c.key) {
+        result.emplace_back(std::move(c));
+        continue;
+      }
+
+      if(c.bits.empty()) {
+        std::vector<uint16_t> kept;
+        std::copy_if(c.array.begin(), c.array.end(), std::back_inserter(kept), [&](uint16_t low) { return !theirs->contains(low); });
+        c.array = std::move(kept);
+        c.cardinality = c.array.size();
+      } else {
+        if(theirs->bits.empty()) {
+          for(auto low : theirs->array) c.bits[low >> 6] &= ~(1ull << (low & 63));
+        } else {
+          for(uint32_t w = 0; w < bitsetWords; ++w) c.bits[w] &= ~theirs->bits[w];
+        }
+        c.cardinality = _popcount(c.bits);
+      }
+
+      if(c.cardinality == 0) continue;
+      c.normalize();
+      result.emplace_back(std::move(c));
+    }
+
+    containers = std::move(result);
+    return *this;
+  }
+
+  std::vector<uint32_t> Bitmap::values(void) const {
+    std::vector<uint32_t> result;
+    result.reserve(cardinality());
+    for(auto &c : containers) {
+      const uint32_t high = (uint32_t) c.key << 16;
+      if(c.bits.empty()) {
+        for(auto low : c.array) result.push_back(high | low);
+        continue;
+      }
+      for(uint32_t w = 0; w < bitsetWords; ++w)
+        for(uint64_t word = c.bits[w]; word != 0; word &= word - 1)
+          result.push_back(high | (w << 6) | __builtin_ctzll(word));
+    }
+    return result;
+  }
+
+  template<typename T>
+  void _append(std::string &out, const T *data, size_t count) {
+    out.append((const char *) data, count * sizeof(T));
+  }
+
+  template<typename T>
+  bool _take(std::string_view &in, T *data, size_t count) {
+    if(in.size() < count * sizeof(T)) return false;
+    std::memcpy(data, in.data(), count * sizeof(T));
+    in.remove_prefix(count * sizeof(T));
+    return true;
+  }
+
+  // Container count, then for each: key, cardinality and either the array or the bitset.
+  // Native byte order, the database is not meant to move between architectures
+  std::string Bitmap::serialize(void) const {
+    std::string out;
+    const uint32_t count = containers.size();
+    _append(out, &count, 1);
+    for(auto &c : containers) {
+      _append(out, &c.key, 1);
+      _append(out, &c.cardinality, 1);
+      if(c.bits.empty()) _append(out, c.array.data(), c.array.size());
+      else _append(out, c.bits.data(), c.bits.size());
+    }
+    return out;
+  }
+
+  bool Bitmap::parse(std::string_view data) {
+    containers.clear();
+
+    uint32_t count;
+    if(!_take(data, &count, 1)) return false;
+    for(uint32_t i = 0; i < count; ++i) {
+      Container c { 0, 0, {}, {} };
+      if(!_take(data, &c.key, 1) || !_take(data, &c.cardinality, 1)) return false;
+      if(c.cardinality == 0 || c.cardinality > (1 << 16)) return false;
+      if(!containers.empty() && containers.back().key >= c.key) return false;
+
+      if(c.cardinality <= arrayMax) {
+        c.array.resize(c.cardinality);
+        if(!_take(data, c.array.data(), c.array.size())) return false;
+      } else {
+        c.bits.resize(bitsetWords);
+        if(!_take(data, c.bits.data(), c.bits.size())) return false;
+      }
+      containers.emplace_back(std::move(c));
+    }
+    return data.empty();
+  }
+}
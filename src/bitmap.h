@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace C3 {
+  // Roaring-style compressed bitmap of 32-bit ordinals. The high 16 bits select a container,
+  // which keeps the low 16 bits as a sorted array while sparse and as a bitset once dense
+  class Bitmap {
+  public:
+    void add(uint32_t value);
+    void remove(uint32_t value);
+    bool contains(uint32_t value) const;
+    uint64_t cardinality(void) const;
+    bool empty(void) const;
+
+    Bitmap &operator&=(const Bitmap &other);
+    Bitmap &operator|=(const Bitmap &other);
+    Bitmap &operator-=(const Bitmap &other);
+
+    std::vector<uint32_t> values(void) const; // Sorted
+
+    std::string serialize(void) const;
+    bool parse(std::string_view data);
+
+  private:
+    struct Container {
+      uint16_t key;
+      uint32_t cardinality;
+      std::vector<uint16_t> array; // Sorted, while cardinality <= arrayMax
+      std::vector<uint64_t> bits; // 1024 words otherwise
+
+      bool contains(uint16_t low) const;
+      void normalize(void);
+    };
+
+    static const uint32_t arrayMax = 4096;
+
+    std::vector<Container> containers; // Sorted by key
+
+    std::vector<Container>::iterator _find(uint16_t key);
+    std::vector<Container>::const_iterator _find(uint16_t key) const;
+  };
+}
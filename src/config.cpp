@@ -29,9 +29,32 @@
     return false; \
   } \
 
+#define READ_OPTIONAL(ident,source,target,type,expected) \
+  if(config source) { \
+    READ_CONFIG(ident,source,target,type,expected); \
+  }
+
 
 namespace C3 {
-  Config::Config() { }
+  Config::Config() :
+    search_cacheBytes(0),
+    search_segmentCache(4096),
+    search_suggestions(10),
+    search_snippets(256),
+    search_keywords(20),
+    search_related(10),
+    search_bm25K1(1.2),
+    search_bm25B(0.75),
+    search_titleBoost(3.0),
+    search_proximity(0),
+    search_seedIdf(false),
+    search_memoryIndex(false),
+    search_stopWords(true),
+    search_indexCode(false),
+    search_indexInlineCode(true),
+    search_indexUrls(false),
+    search_indexAlt(true),
+    search_indexHtml(false) { }
 
   bool Config::read(const std::string &path) {
     try {
@@ -55,8 +78,26 @@ namespace C3 {
 
       READ_CONFIG("search.dict", ["search"]["dict"], search_dict, std::string, "a string");
       READ_CONFIG("search.cache", ["search"]["cache"], search_cache, uint32_t, "an integer");
+      READ_OPTIONAL("search.cache_bytes", ["search"]["cache_bytes"], search_cacheBytes, uint64_t, "an integer");
+      READ_OPTIONAL("search.segment_cache", ["search"]["segment_cache"], search_segmentCache, uint32_t, "an integer");
       READ_CONFIG("search.preview", ["search"]["preview"], search_preview, uint32_t, "an integer");
       READ_CONFIG("search.length", ["search"]["length"], search_length, uint32_t, "an integer");
+      READ_OPTIONAL("search.suggestions", ["search"]["suggestions"], search_suggestions, uint32_t, "an integer");
+      READ_OPTIONAL("search.snippets", ["search"]["snippets"], search_snippets, uint32_t, "an integer");
+      READ_OPTIONAL("search.keywords", ["search"]["keywords"], search_keywords, uint32_t, "an integer");
+      READ_OPTIONAL("search.related", ["search"]["related"], search_related, uint32_t, "an integer");
+      READ_OPTIONAL("search.bm25_k1", ["search"]["bm25_k1"], search_bm25K1, double, "a number");
+      READ_OPTIONAL("search.bm25_b", ["search"]["bm25_b"], search_bm25B, double, "a number");
+      READ_OPTIONAL("search.title_boost", ["search"]["title_boost"], search_titleBoost, double, "a number");
+      READ_OPTIONAL("search.proximity", ["search"]["proximity"], search_proximity, double, "a number");
+      READ_OPTIONAL("search.seed_idf", ["search"]["seed_idf"], search_seedIdf, bool, "a boolean");
+      READ_OPTIONAL("search.memory_index", ["search"]["memory_index"], search_memoryIndex, bool, "a boolean");
+      READ_OPTIONAL("search.stop_words", ["search"]["stop_words"], search_stopWords, bool, "a boolean");
+      READ_OPTIONAL("search.index_code", ["search"]["index_code"], search_indexCode, bool, "a boolean");
+      READ_OPTIONAL("search.index_inline_code", ["search"]["index_inline_code"], search_indexInlineCode, bool, "a boolean");
+      READ_OPTIONAL("search.index_urls", ["search"]["index_urls"], search_indexUrls, bool, "a boolean");
+      READ_OPTIONAL("search.index_alt", ["search"]["index_alt"], search_indexAlt, bool, "a boolean");
+      READ_OPTIONAL("search.index_html", ["search"]["index_html"], search_indexHtml, bool, "a boolean");
 
       READ_CONFIG("db.path", ["db"]["path"], db_path, std::string, "a string");
       READ_CONFIG("db.cache", ["db"]["cache"], db_cache, uint64_t, "an integer");
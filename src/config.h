@@ -27,8 +27,26 @@ namespace C3 {
     // Search
     std::string search_dict;
     uint32_t search_cache;
+    uint64_t search_cacheBytes;
+    uint32_t search_segmentCache;
     uint32_t search_preview;
     uint32_t search_length;
+    uint32_t search_suggestions;
+    uint32_t search_snippets;
+    uint32_t search_keywords;
+    uint32_t search_related;
+    double search_bm25K1;
+    double search_bm25B;
+    double search_titleBoost;
+    double search_proximity;
+    bool search_seedIdf;
+    bool search_memoryIndex;
+    bool search_stopWords;
+    bool search_indexCode;
+    bool search_indexInlineCode;
+    bool search_indexUrls;
+    bool search_indexAlt;
+    bool search_indexHtml;
 
     // Database
     std::string db_path;
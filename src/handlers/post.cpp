@@ -1,4 +1,5 @@
 #include <sstream>
+#include <cstdlib>
 #include <crow.h>
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
@@ -66,14 +67,20 @@ namespace C3 {
     return handle_post_tag_list_page(req, res, tag, 1);
   }
 
-  void handle_post_tag_list_page([[maybe_unused]] const crow::request &req, crow::response &res, const std::string &tag, int page) {
+  // Comma-separated tags match posts with any of them, or with ?match=all every one
+  void handle_post_tag_list_page(const crow::request &req, crow::response &res, const std::string &tag, int page) {
     int offset = (page-1) * post_per_page;
     int count = post_per_page;
 
     bool hasNext;
     uint64_t total;
 
-    std::vector<uint64_t> ids = list_posts_by_tag(URLEncoding::url_decode(tag), offset, count, hasNext, total);
+    std::vector<std::string> tags;
+    for(auto &seg : split(tag, ',')) tags.push_back(URLEncoding::url_decode(seg));
+    const char *match = req.url_params.get("match");
+    const bool all = match != nullptr && std::string(match) == "all";
+
+    std::vector<uint64_t> ids = list_posts_by_tags(tags, all, offset, count, hasNext, total);
 
     rj::StringBuffer result;
     rj::Writer<rj::StringBuffer> writer(result);
@@ -104,6 +111,29 @@ namespace C3 {
     res.end(result.GetString());
   }
 
+  void handle_tag_counts([[maybe_unused]] const crow::request &req, crow::response &res) {
+    rj::StringBuffer result;
+    rj::Writer<rj::StringBuffer> writer(result);
+
+    writer.StartObject();
+    writer.Key("tags");
+    writer.StartArray();
+
+    for(auto &tag : count_tags()) {
+      writer.StartObject();
+      writer.Key("name");
+      writer.String(tag.first);
+      writer.Key("count");
+      writer.Uint64(tag.second);
+      writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    res.end(result.GetString());
+  }
+
   void handle_post_read([[maybe_unused]] const crow::request &req, crow::response &res, uint64_t id) {
     try {
       Post p  = get_post(id);
@@ -151,6 +181,89 @@ namespace C3 {
     }
   }
 
+  // Posts sharing the most keywords with the given one, ?limit= capped by search.related
+  void handle_post_related_url(const crow::request &req, crow::response &res, const std::string &url) {
+    uint64_t id;
+    try {
+      id = query_url(URLEncoding::url_decode(url));
+    } catch(MapperError e) {
+      res.code = 404;
+      res.end("404 Not Found");
+      return;
+    }
+
+    size_t limit = post_per_page;
+    const char *limitStr = req.url_params.get("limit");
+    if(limitStr != nullptr) limit = std::strtoul(limitStr, nullptr, 10);
+
+    try {
+      auto related = Index::related(id);
+
+      rj::StringBuffer result;
+      rj::Writer<rj::StringBuffer> writer(result);
+
+      writer.StartObject();
+      writer.Key("posts");
+      writer.StartArray();
+
+      size_t count = 0;
+      for(auto &entry : *related) {
+        if(count >= limit) break;
+        std::string p_str;
+        try {
+          p_str = get_post_str(entry.first);
+        } catch(StorageExcept &) {
+          continue; // Deleted since
+        }
+        Post p(p_str);
+        writer.StartObject();
+        writer.Key("url");
+        writer.String(p.url);
+        writer.Key("topic");
+        writer.String(p.topic);
+        writer.Key("post_time");
+        writer.Uint64(p.post_time);
+        writer.Key("score");
+        writer.Double(entry.second);
+        writer.EndObject();
+        ++count;
+      }
+
+      writer.EndArray();
+      writer.EndObject();
+
+      res.end(result.GetString());
+    } catch(...) {
+      res.code = 500;
+      res.end("500 Internal Error");
+    }
+  }
+
+  // Whether the last change of the post is searchable yet, for the editor to show
+  void handle_post_index_status([[maybe_unused]] const crow::request &req, crow::response &res, const std::string &url) {
+    uint64_t id;
+    try {
+      id = query_url(URLEncoding::url_decode(url));
+    } catch(MapperError e) {
+      res.code = 404;
+      res.end("404 Not Found");
+      return;
+    }
+
+    const Index::IndexStatus status = Index::status(id);
+    rj::StringBuffer result;
+    rj::Writer<rj::StringBuffer> writer(result);
+
+    writer.StartObject();
+    writer.Key("status");
+    if(status == Index::IndexStatus::Queued) writer.String("queued");
+    else if(status == Index::IndexStatus::Indexing) writer.String("indexing");
+    else writer.String("done");
+    writer.EndObject();
+
+    res.end(result.GetString());
+  }
+
   void handle_post_create(const crow::request &req, crow::response &res) {
     try {
       // Context
@@ -174,17 +287,24 @@ namespace C3 {
       }
 
       sort(p.tags.begin(), p.tags.end());
-      uint64_t id = add_post(p);
+      PostMutation mutation;
+      uint64_t id = mutation.add_post(p);
+      mutation.add_url(p.url, id);
+      mutation.add_entries(id, p.tags);
+      mutation.queue_index(id);
 
-      //TODO: thread safety
-      add_url(p.url, id);
-
-      //TODO: template
-      //TODO: batch
-      add_entries(id, p.tags);
+      try {
+        commit(mutation);
+      } catch(MapperError e) {
+        // Taken by a post committed since the check
+        if(e != MapperError::DuplicatedUrl) throw;
+        res.code = 200;
+        res.end("{ error: 'dulicatedUrl' }");
+        return;
+      }
       Feed::invalidate();
 
-      Index::reindex(p);
+      Index::enqueue(p);
 
       res.write("{\"id\":");
       res.write(std::to_string(id));
@@ -240,16 +360,18 @@ namespace C3 {
         }
       }
 
+      PostMutation mutation;
       if(original.url != current.url)
-        rename_url(original.url, current.url, id);
+        mutation.rename_url(original.url, current.url, id);
       //TODO: handle validation
 
-      //TODO: batch
-      add_remove_entries(id, added, removed);
-      update_post(id, current);
+      mutation.add_remove_entries(id, added, removed);
+      mutation.update_post(id, current);
+      mutation.queue_index(id);
+      commit(mutation);
 
       Feed::invalidate();
-      Index::reindex(current);
+      Index::enqueue(current);
 
       res.end("{\"ok\":0}");
     } catch(StorageExcept &e) {
@@ -279,14 +401,15 @@ namespace C3 {
     try {
       Post p = get_post(id);
 
-      remove_url(p.url);
-      //TODO: batch
-      remove_entries(id, p.tags);
-      delete_post(id);
+      PostMutation mutation;
+      mutation.remove_url(p.url);
+      mutation.remove_entries(id, p.tags);
+      mutation.delete_post(id);
+      mutation.queue_index(id);
+      commit(mutation);
 
       Feed::invalidate();
-      clear_indexes(id);
-      Index::invalidate();
+      Index::enqueue_remove(id);
 
       res.end("{\"ok\":0}");
     } catch(StorageExcept &e) {
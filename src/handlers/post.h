@@ -11,8 +11,11 @@ namespace C3 {
   void handle_post_list_page(const crow::request &req, crow::response &res, int page);
   void handle_post_tag_list(const crow::request &req, crow::response &res, const std::string &tag);
   void handle_post_tag_list_page(const crow::request &req, crow::response &res, const std::string &tag, int page);
+  void handle_tag_counts(const crow::request &req, crow::response &res);
   void handle_post_read(const crow::request &req, crow::response &res, uint64_t id);
   void handle_post_read_url(const crow::request &req, crow::response &res, const std::string &url);
+  void handle_post_related_url(const crow::request &req, crow::response &res, const std::string &url);
+  void handle_post_index_status(const crow::request &req, crow::response &res, const std::string &url);
   void handle_post_create(const crow::request &req, crow::response &res);
   void handle_post_update(const crow::request &req, crow::response &res, uint64_t id);
   void handle_post_delete(const crow::request &req, crow::response &res, uint64_t id);
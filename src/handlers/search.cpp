@@ -1,78 +1,87 @@
 #include <string>
+#include <algorithm>
 #include <crow.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
 #include "indexer.h"
 #include "util.h"
+#include "middleware.h"
 #include "handlers/search.h"
 
 namespace rj = rapidjson;
 
 namespace C3 {
-  uint32_t search_preview, search_length;
+  uint32_t search_preview, search_length, search_suggestions;
 
   void setup_search_handler(const Config &c) {
     search_preview = c.search_preview;
     search_length = c.search_length;
+    search_suggestions = c.search_suggestions;
+  }
+
+  void handle_suggest([[maybe_unused]] const crow::request &req, crow::response &res, std::string str) {
+    rj::StringBuffer result;
+    rj::Writer<rj::StringBuffer> writer(result);
+    writer.StartObject();
+    writer.Key("suggestions");
+    writer.StartArray();
+
+    for(auto &suggestion : Index::suggest(URLEncoding::url_decode(str), search_suggestions)) {
+      writer.StartObject();
+      writer.Key("query");
+      writer.String(suggestion.first);
+      writer.Key("df");
+      writer.Uint64(suggestion.second);
+      writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    res.end(result.GetString());
   }
 
   void handle_search(const crow::request &req, crow::response &res, std::string str) {
     handle_search_page(req, res, str, 1);
   }
 
-  void handle_search_page([[maybe_unused]] const crow::request &req, crow::response &res, std::string str, uint64_t page) {
-    auto records = Index::search(URLEncoding::url_decode(str));
+  // Authors also find their posts still waiting to be indexed
+  void handle_search_page(const crow::request &req, crow::response &res, std::string str, uint64_t page) {
+    uint32_t skipped = search_length * (page - 1);
+    Middleware::context &cookieCtx = _app->template get_context<Middleware>(req);
+    const bool author = cookieCtx.session.signedIn && cookieCtx.session.isAuthor;
+    auto records = Index::with_pending(Index::search(URLEncoding::url_decode(str), skipped + search_length), author);
     rj::StringBuffer result;
     rj::Writer<rj::StringBuffer> writer(result);
     writer.StartObject(); // Root
     writer.Key("results");
     writer.StartArray(); // Results
 
-    auto rec = records.begin();
-    uint32_t skipped = search_length * (page - 1);
-    while(rec != records.end() && skipped) {
-      --skipped;
-      ++rec;
-    }
-
     uint32_t i = 0;
 
-    for(; rec != records.end() && i < search_length; ++rec) {
-
-      Post p = get_post(rec->first);
-
-      uint32_t lineEnd = 0, lineCount = 0;
-      while(lineEnd < p.content.length() && p.content[lineEnd] != '\n') ++lineEnd;
+    for(size_t rec = skipped; rec < records->posts.size() && i < search_length; ++rec) {
+      const uint64_t id = records->posts[rec];
+      auto snippet = Index::snippet(id);
+      const Post &p = snippet->post;
+      const PostLayout &layout = snippet->layout;
 
-      std::vector<uint32_t> lineHits(1);
-      std::vector<uint32_t> lineEnds(1);
-      lineEnds[0] = lineEnd;
-      lineHits[0] = 0;
+      const uint32_t lineCount = layout.lineEnds.size();
+      std::vector<uint32_t> lineHits(lineCount);
       bool inbody = false;
 
       writer.StartObject(); // Record
       writer.Key("post_id");
-      writer.Uint64(rec->first);
+      writer.Uint64(id);
 
       writer.Key("hits");
       writer.StartArray(); // Hits
 
-      uint32_t offsetPtr = 0;
-      uint32_t offsetUTF8 = 0;
-
-      for(auto &hit : rec->second) {
-        uint32_t offsetAscii = std::get<0>(hit);
-
-        while(offsetPtr < offsetAscii)
-          if((p.content[offsetPtr++] & 0xC0) != 0x80) ++offsetUTF8;
-
-        uint32_t lengthAscii = std::get<1>(hit);
-        uint32_t lengthPtr = 0;
-        uint32_t lengthUTF8 = 0;
-
-        while(lengthPtr < lengthAscii)
-          if((p.content[offsetPtr + (lengthPtr++)] & 0xC0) != 0x80) ++lengthUTF8;
+      for(uint32_t h = records->bounds[rec]; h < records->bounds[rec + 1]; ++h) {
+        const Index::Hit &hit = records->hits[h];
+        const std::string &text = hit.topic ? p.topic : p.content;
+        const uint32_t offsetUTF8 = layout.codepoints(text, hit.topic, hit.offset);
+        const uint32_t lengthUTF8 = layout.codepoints(text, hit.topic, hit.offset + hit.length) - offsetUTF8;
 
         writer.StartObject(); // Hit
         writer.Key("offset");
@@ -80,22 +89,14 @@ namespace C3 {
         writer.Key("length");
         writer.Uint(lengthUTF8);
         writer.Key("topic");
-        writer.Bool(std::get<2>(hit));
+        writer.Bool(hit.topic);
         writer.EndObject(); // Hit
 
-        if(!std::get<2>(hit)){
+        if(!hit.topic) {
           inbody = true;
-          while(std::get<0>(hit) > lineEnd) {
-            ++lineCount;
-            ++lineEnd;
-            while(lineEnd < p.content.length() && p.content[lineEnd] != '\n')
-              ++lineEnd;
-            lineEnds.push_back(lineEnd);
-            lineHits.push_back(0);
-          }
+          const uint32_t line = std::lower_bound(layout.lineEnds.begin(), layout.lineEnds.end(), hit.offset) - layout.lineEnds.begin();
+          ++lineHits[std::min(line, lineCount - 1)];
         }
-
-        ++lineHits[lineCount];
       }
 
       writer.EndArray(); // Hits
@@ -115,8 +116,6 @@ namespace C3 {
 
       // Preview
 
-      ++lineCount;
-
       if(inbody) {
         uint32_t maxStart = 0;
         if(search_preview < lineCount) {
@@ -130,8 +129,8 @@ namespace C3 {
           maxSum = sum;
 
           for(uint32_t start = 1; start + search_preview <= lineCount; ++start) {
-            sum -= lineEnds[start - 1];
-            sum += lineEnds[start - 1 + search_preview];
+            sum -= lineHits[start - 1];
+            sum += lineHits[start - 1 + search_preview];
             if(sum > maxSum) {
               maxSum = sum;
               maxStart = start;
@@ -144,22 +143,16 @@ namespace C3 {
         while(maxEnd > maxStart && lineHits[maxEnd] == 0) --maxEnd;
         while(maxStart < maxEnd && lineHits[maxStart] == 0) ++maxStart;
 
-        const uint32_t startIndex = maxStart == 0 ? 0 : lineEnds[maxStart-1] +1;
-        const uint32_t endIndex = lineEnds[maxEnd];
+        const uint32_t startIndex = maxStart == 0 ? 0 : layout.lineEnds[maxStart-1] +1;
+        const uint32_t endIndex = layout.lineEnds[maxEnd];
 
         writer.Key("preview");
         writer.String(p.content.substr(startIndex, endIndex - startIndex));
       } else { // Only in title
-        uint32_t currentLine = 0;
-        uint32_t ptr = 0;
-        while(ptr < p.content.size() && currentLine < search_preview) {
-          while(ptr < p.content.size() && p.content[ptr] != '\n') ++ptr;
-          ++currentLine;
-          ++ptr;
-        }
+        const uint32_t lines = std::min(search_preview, lineCount);
 
         writer.Key("preview");
-        writer.String(p.content.substr(0, ptr - 1));
+        writer.String(p.content.substr(0, lines > 0 ? layout.lineEnds[lines - 1] : std::string::npos));
       }
 
       writer.EndObject(); // Record
@@ -169,7 +162,7 @@ namespace C3 {
 
     writer.EndArray(); // Results
     writer.Key("pages");
-    writer.Uint64((records.size() + search_length - 1) / search_length);
+    writer.Uint64((records->total + search_length - 1) / search_length);
 
     writer.EndObject(); // Root
 
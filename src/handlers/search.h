@@ -10,4 +10,5 @@ namespace C3 {
 
   void handle_search(const crow::request &req, crow::response &res, std::string str);
   void handle_search_page(const crow::request &req, crow::response &res, std::string str, uint64_t page);
+  void handle_suggest(const crow::request &req, crow::response &res, std::string str);
 }
@@ -1,24 +1,73 @@
 #include "indexer.h"
 
 #include <cppjieba/Jieba.hpp>
+#include <limonp/ThreadPool.hpp>
+#include <limonp/Md5.hpp>
 #include <vector>
 #include <list>
 #include <unordered_map>
 #include <algorithm>
+#include <unordered_set>
+#include <queue>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
 #include <mutex>
+#include <optional>
+#include <exception>
+#include <iostream>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "util.h"
+#include "searchcache.h"
+#include "memindex.h"
+#include "query.h"
+#include "setops.h"
+#include "suggest.h"
+#include "textspans.h"
+#include "related.h"
+#include "indexqueue.h"
 
 namespace C3 {
   namespace Index {
-    cppjieba::Jieba *jieba;
+    // Published with atomic_store, so segmenting never waits on a dictionary edit, and an
+    // edited dictionary is only freed once nothing cuts with it anymore
+    std::shared_ptr<const cppjieba::Jieba> jieba;
+    std::unique_ptr<cppjieba::DictImage> dict_image; // Backs jieba when it was loaded from an image
+    std::vector<std::string> dictionary_sources;
+    std::mutex dictionary_mutex;
 
-    typedef std::vector<std::pair<uint64_t, std::list<std::tuple<uint32_t, uint32_t, bool>>>> search_result;
-    uint32_t search_cache_size;
-    // TODO: switch to vector
-    std::list<std::string> search_cache_list;
-    std::unordered_map<std::string, std::pair<search_result, std::list<std::string>::iterator>> search_cache_store;
-    std::mutex search_cache_mutex;
+    typedef std::vector<std::pair<uint64_t, std::list<std::tuple<uint32_t, uint32_t, bool>>>> exhaustive_result;
+
+    std::unique_ptr<SearchCache> search_cache;
+    std::unique_ptr<SegmentCache> segment_cache;
+    std::unique_ptr<MemoryIndex> memory_index;
+    std::unique_ptr<SuggestDict> suggest_dict;
+    std::unique_ptr<RelatedIndex> related_index;
+    std::unique_ptr<IndexQueue> index_queue;
+
+    // Most recently shown posts, at the front
+    std::list<std::shared_ptr<const Snippet>> snippets;
+    std::unordered_map<uint64_t, std::list<std::shared_ptr<const Snippet>>::iterator> snippet_index;
+    std::mutex snippet_mutex;
+    size_t snippet_capacity;
+    uint64_t snippet_evictions = 0; // Snippets loaded across an eviction may be outdated
+
+    double bm25_k1, bm25_b, title_boost, proximity_weight;
+    std::unordered_map<std::string, double> seeded_idf;
+    // Views into stop_word_text, so that words are checked without copying them
+    std::unordered_set<std::string> stop_word_text;
+    std::unordered_set<std::string_view> stop_words;
+    bool indexed_spans[spanTypes];
+    size_t keyword_count; // Kept per post for related posts
 
     bool _index_cmp_pair(const std::pair<uint32_t, bool> &a, const std::tuple<uint32_t, uint32_t, bool> &b) {
       if(a.second) {
@@ -38,91 +87,579 @@ namespace C3 {
       return std::get<0>(a) < std::get<0>(b);
     }
 
+    std::string _dictionary_image(const Config &c) {
+      return c.search_dict + "/jieba.image";
+    }
+
+    // In the order cppjieba::Jieba takes them
+    std::vector<std::string> _dictionary_sources(const Config &c) {
+      return {
+        c.search_dict + "/jieba.dict.utf8",
+        c.search_dict + "/hmm_model.utf8",
+        c.search_dict + "/user.dict.utf8",
+        c.search_dict + "/idf.utf8",
+        c.search_dict + "/stop_words.utf8"
+      };
+    }
+
+    std::shared_ptr<const cppjieba::Jieba> _jieba(void) {
+      return std::atomic_load(&jieba);
+    }
+
+    void _load_dictionary(const Config &c) {
+      const auto sources = _dictionary_sources(c);
+      const std::string image = _dictionary_image(c);
+      dictionary_sources = sources;
+
+      dict_image.reset(new cppjieba::DictImage());
+      if(dict_image->Open(image, sources)) {
+        try {
+          jieba = std::make_shared<const cppjieba::Jieba>(dict_image->Reader());
+          std::cout<<"Index: Mapped dictionary image "<<image<<std::endl;
+          return;
+        } catch(const std::exception &e) {
+          std::cout<<"Index: Ignoring dictionary image: "<<e.what()<<std::endl;
+        }
+      } else if(std::ifstream(image).good())
+        std::cout<<"Index: Dictionary image is out of date, run with --compile-dict to update it"<<std::endl;
+
+      dict_image.reset();
+      jieba = std::make_shared<const cppjieba::Jieba>(sources[0], sources[1], sources[2], sources[3], sources[4]);
+    }
+
+    // Whitespace and stop words are left out of the index, and so out of queries
+    bool _indexable(std::string_view word) {
+      if(std::all_of(word.begin(), word.end(), [](char c) { return std::isspace((unsigned char) c); })) return false;
+      return stop_words.empty() || stop_words.count(word) == 0;
+    }
+
+    double _idf(const std::string &word, double df, const CorpusStats &corpus) {
+      if(seeded_idf.size() > 0) {
+        auto seeded = seeded_idf.find(word);
+        if(seeded != seeded_idf.end()) return seeded->second;
+      }
+
+      return std::log(1 + (corpus.docs - df + 0.5) / (df + 0.5));
+    }
+
+    // BM25F: each field is normalized by its own length, title weighted before saturation
+    double _bm25(uint32_t titleTf, uint32_t bodyTf, const DocStats &doc, double idf, const CorpusStats &corpus) {
+      if(corpus.docs == 0) return 0;
+
+      const double avgTitle = (double) corpus.title / corpus.docs;
+      const double avgBody = (double) corpus.body / corpus.docs;
+
+      double tf = 0;
+      if(titleTf > 0)
+        tf += title_boost * titleTf / (1 - bm25_b + bm25_b * (avgTitle > 0 ? doc.title / avgTitle : 1));
+      if(bodyTf > 0)
+        tf += bodyTf / (1 - bm25_b + bm25_b * (avgBody > 0 ? doc.body / avgBody : 1));
+
+      return idf * tf / (bm25_k1 + tf);
+    }
+
+    double _bm25(uint64_t post, const std::vector<std::pair<uint32_t, bool>> &occurs, double idf, const CorpusStats &corpus) {
+      uint32_t titleTf = 0, bodyTf = 0;
+      for(auto &occur : occurs) {
+        if(occur.second) ++titleTf;
+        else ++bodyTf;
+      }
+
+      return _bm25(titleTf, bodyTf, query_doc_stats(post), idf, corpus);
+    }
+
+    // Length normalization is at least (1 - b), so the best case for a term is its
+    // largest per-field frequencies in the shortest possible document
+    double _bm25_bound(uint32_t titleTf, uint32_t bodyTf, double idf, const CorpusStats &corpus) {
+      if(corpus.docs == 0) return 0;
+      if(bm25_b >= 1) return idf;
+
+      const double tf = (title_boost * titleTf + bodyTf) / (1 - bm25_b);
+      return idf * tf / (bm25_k1 + tf);
+    }
+
+    // Whitespace and punctuation make no sense as completions
+    bool _suggestable(const std::string &term) {
+      for(size_t i = 0; i < term.size();) {
+        const uint8_t c = term[i];
+        if(c < 0x80) {
+          if(std::isalnum(c)) return true;
+          ++i;
+          continue;
+        }
+
+        const size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+        uint32_t cp = c & (0xFF >> (length + 1));
+        for(size_t j = 1; j < length && i + j < term.size(); ++j)
+          cp = (cp << 6) | (term[i + j] & 0x3F);
+        i += length;
+
+        const bool punct = (cp >= 0x2000 && cp < 0x2070) || (cp >= 0x3000 && cp < 0x3040)
+          || (cp >= 0xFF00 && cp < 0xFF10) || (cp >= 0xFF1A && cp < 0xFF21)
+          || (cp >= 0xFF3B && cp < 0xFF41) || (cp >= 0xFF5B && cp < 0xFF66);
+        if(!punct) return true;
+      }
+      return false;
+    }
+
+    void _build_suggestions(void) {
+      std::vector<std::pair<std::string, uint64_t>> terms;
+      scan_df([&terms](const std::string &term, uint64_t df) {
+        if(_suggestable(term)) terms.emplace_back(term, df);
+      });
+      suggest_dict->build(std::move(terms));
+    }
+
+    void _build_related(void) {
+      std::unordered_map<uint64_t, PostKeywords> vectors;
+      scan_keywords([&vectors](uint64_t post, PostKeywords &&keywords) {
+        if(keywords.size() > 0) vectors.emplace(post, std::move(keywords));
+      });
+      related_index->build(std::move(vectors));
+    }
+
     void setup(const Config &c) {
-      search_cache_size = c.search_cache;
-      jieba = new cppjieba::Jieba(
-          c.search_dict + "/jieba.dict.utf8",
-          c.search_dict + "/hmm_model.utf8",
-          c.search_dict + "/user.dict.utf8",
-          c.search_dict + "/idf.utf8",
-          c.search_dict + "/stop_words.utf8");
+      search_cache.reset(new SearchCache(c.search_cacheBytes > 0 ? c.search_cacheBytes : (uint64_t) c.search_cache << 14));
+      segment_cache.reset(new SegmentCache(c.search_segmentCache));
+      bm25_k1 = c.search_bm25K1;
+      bm25_b = c.search_bm25B;
+      title_boost = c.search_titleBoost;
+      proximity_weight = c.search_proximity;
+      snippet_capacity = c.search_snippets;
+      keyword_count = c.search_keywords;
+      _load_dictionary(c);
+      if(c.search_seedIdf) seeded_idf = jieba->extractor.GetIdfMap();
+      if(c.search_stopWords)
+        for(auto &word : jieba->extractor.GetStopWords())
+          if(word.size() > 0) stop_words.insert(*stop_word_text.insert(word).first);
+
+      indexed_spans[(size_t) SpanType::Text] = true;
+      indexed_spans[(size_t) SpanType::Code] = c.search_indexCode;
+      indexed_spans[(size_t) SpanType::InlineCode] = c.search_indexInlineCode;
+      indexed_spans[(size_t) SpanType::Url] = c.search_indexUrls;
+      indexed_spans[(size_t) SpanType::Alt] = c.search_indexAlt;
+      indexed_spans[(size_t) SpanType::Html] = c.search_indexHtml;
+
+      if(c.search_memoryIndex) {
+        memory_index.reset(new MemoryIndex());
+        if(memory_index->load() == 0) {
+          bool dummy_hasNext;
+          uint64_t total;
+          list_posts(0, 0, dummy_hasNext, total);
+          if(total > 0) {
+            std::cout<<"Index: Building memory index from "<<total<<" posts"<<std::endl;
+            reindex_all(true);
+          }
+        }
+        std::cout<<"Index: "<<memory_index->size()<<" terms in memory"<<std::endl;
+      }
+
+      suggest_dict.reset(new SuggestDict());
+      _build_suggestions();
+
+      if(c.search_related > 0) {
+        related_index.reset(new RelatedIndex(c.search_related));
+        _build_related();
+        std::cout<<"Index: "<<related_index->size()<<" posts with keywords"<<std::endl;
+      }
+
+      // Posts committed before the last stop but never indexed
+      index_queue.reset(new IndexQueue());
+      const auto queued = scan_queued();
+      if(queued.size() > 0) std::cout<<"Index: Queueing "<<queued.size()<<" posts left unindexed"<<std::endl;
+      for(auto post : queued) index_queue->push(post, false);
+    }
+
+    bool compile_dictionary(const Config &c) {
+      typedef std::chrono::steady_clock clock;
+      const auto start = clock::now();
+      const auto sources = _dictionary_sources(c);
+      const std::string image = _dictionary_image(c);
+
+      // Sources are stamped before they are read, so that later edits make the image stale
+      cppjieba::ImageWriter writer;
+      writer.PutBytes(cppjieba::DictImage::Header(sources));
+      cppjieba::Jieba(sources[0], sources[1], sources[2], sources[3], sources[4]).SaveImage(writer);
+
+      if(!writer.WriteTo(image)) {
+        std::cout<<"Index: Failed to write dictionary image "<<image<<std::endl;
+        return false;
+      }
+      std::cout<<"Index: Compiled "<<image<<", "<<writer.Data().size() / 1024<<" KiB, in "
+        <<std::chrono::duration<double>(clock::now() - start).count()<<"s"<<std::endl;
+      return true;
+    }
+
+    std::shared_ptr<const Snippet> snippet(uint64_t post) {
+      uint64_t evictions;
+      {
+        std::lock_guard<std::mutex> lock(snippet_mutex);
+        auto cached = snippet_index.find(post);
+        if(cached != snippet_index.end()) {
+          snippets.splice(snippets.begin(), snippets, cached->second);
+          return *cached->second;
+        }
+        evictions = snippet_evictions;
+      }
+
+      // The stored layout is of the text last indexed. Queued posts are evicted once they
+      // are pending, so checking after the evictions were read never caches a stale one
+      const bool pending = index_queue && index_queue->pending(post);
+      Post p = get_post(post);
+      PostLayout layout;
+      if(pending) layout = PostLayout(p.topic, p.content);
+      else try {
+        layout = query_layout(post);
+      } catch(StorageExcept &) {
+        // Indexed before layouts were stored
+        layout = PostLayout(p.topic, p.content);
+      }
+      auto result = std::make_shared<const Snippet>(Snippet { std::move(p), std::move(layout) });
+      if(snippet_capacity == 0 || pending) return result;
+
+      std::lock_guard<std::mutex> lock(snippet_mutex);
+      if(evictions != snippet_evictions || snippet_index.count(post) > 0) return result;
+      snippets.push_front(result);
+      snippet_index.emplace(post, snippets.begin());
+      if(snippets.size() > snippet_capacity) {
+        snippet_index.erase(snippets.back()->post.post_time);
+        snippets.pop_back();
+      }
+      return result;
+    }
+
+    std::shared_ptr<const RelatedPosts> related(uint64_t post) {
+      if(!related_index) return std::make_shared<const RelatedPosts>();
+      return related_index->related(post);
+    }
+
+    void _evict_snippet(uint64_t post) {
+      std::lock_guard<std::mutex> lock(snippet_mutex);
+      ++snippet_evictions;
+      auto cached = snippet_index.find(post);
+      if(cached == snippet_index.end()) return;
+      snippets.erase(cached->second);
+      snippet_index.erase(cached);
+    }
+
+    void _update_suggestions(const std::unordered_set<std::string> &words) {
+      if(!suggest_dict) return;
+      for(auto &word : words)
+        if(_suggestable(word)) suggest_dict->update(word, query_df(word));
+    }
+
+    // Bumped whenever indexing stores something new for every post, so that posts indexed
+    // before get it on their next incremental reindex. 2: layouts, 3: keyword vectors
+    const uint32_t index_version = 3;
+
+    // Title and body are what the indexes are generated from, along with the index version
+    std::string _fingerprint(const Post &p) {
+      std::string text = std::to_string(index_version);
+      text.push_back('\0');
+      text += p.topic;
+      text.push_back('\0');
+      text += p.content;
+
+      limonp::MD5 md5;
+      return md5.digestMemory((limonp::BYTE *) text.data(), text.size());
+    }
+
+    // Weighted as KeywordExtractor does, but from the words already cut for the indexes, with
+    // occurrences in the title counted as title_boost
+    PostKeywords _keywords(const PostIndexes &indexes) {
+      PostKeywords keywords;
+      if(keyword_count == 0) return keywords;
+
+      auto segmenter = _jieba();
+      for(auto &it : indexes) {
+        double count = 0;
+        for(auto &occur : it.second) count += occur.second ? title_boost : 1;
+        const double weight = segmenter->extractor.Weigh(it.first, count);
+        if(weight > 0) keywords.emplace_back(it.first, weight);
+      }
+
+      const size_t kept = std::min(keyword_count, keywords.size());
+      std::partial_sort(keywords.begin(), keywords.begin() + kept, keywords.end(),
+          [](const std::pair<std::string, double> &a, const std::pair<std::string, double> &b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+          });
+      keywords.resize(kept);
+
+      double norm = 0;
+      for(auto &keyword : keywords) norm += keyword.second * keyword.second;
+      norm = std::sqrt(norm);
+      for(auto &keyword : keywords) keyword.second /= norm;
+      return keywords;
+    }
+
+    void reindex(const Post& p, bool force) {
+      _evict_snippet(p.post_time);
+      IndexedPost indexed { p.post_time, _fingerprint(p), {}, {}, {} };
+
+      // Tags may still have changed, which filtered results depend on
+      if(!force && indexed.fingerprint == query_fingerprint(p.post_time)) {
+        invalidate(p.post_time, {});
+        return;
+      }
+
+      indexed.indexes = generate(p.topic, p.content);
+      indexed.layout = PostLayout(p.topic, p.content);
+      indexed.keywords = _keywords(indexed.indexes);
+
+      auto previous = query_words(p.post_time);
+      std::unordered_set<std::string> words(previous.begin(), previous.end());
+      for(auto &it : indexed.indexes) words.insert(it.first);
+
+      auto changed = set_indexes(indexed);
+      if(memory_index) {
+        PostIndexes touched;
+        for(auto &word : changed) {
+          auto it = indexed.indexes.find(word);
+          if(it != indexed.indexes.end()) touched.emplace(word, it->second);
+        }
+        memory_index->update(p.post_time, changed, touched);
+      }
+      _update_suggestions(changed);
+      if(related_index) related_index->update(p.post_time, std::move(indexed.keywords));
+
+      // Document lengths changed as well, so every result with any of the words is stale
+      invalidate(p.post_time, words);
+    }
+
+    void remove(uint64_t post) {
+      _evict_snippet(post);
+      auto previous = query_words(post);
+      std::unordered_set<std::string> words(previous.begin(), previous.end());
+
+      // Created and deleted before it was indexed, so there is nothing to clear
+      try {
+        clear_indexes(post);
+      } catch(StorageExcept &e) {
+        if(e != StorageExcept::NotFound) throw;
+      }
+      if(memory_index) memory_index->update(post, words, {});
+      _update_suggestions(words);
+      if(related_index) related_index->update(post, {});
+      invalidate(post, words);
+    }
+
+    void enqueue(const Post& p) {
+      if(!index_queue) return reindex(p);
+      index_queue->push(p.post_time, false);
+      _evict_snippet(p.post_time);
+    }
+
+    void enqueue_remove(uint64_t post) {
+      if(!index_queue) return remove(post);
+      index_queue->push(post, true);
+      _evict_snippet(post);
     }
 
-    void reindex(const Post& p) {
-      auto indexes = generate(p.topic, p.content);
-      set_indexes(p.post_time, indexes);
-      invalidate();
+    IndexStatus status(uint64_t post) {
+      return index_queue ? index_queue->status(post) : IndexStatus::Done;
     }
 
-    void reindex_all(void) {
+    void drain(void) {
+      if(index_queue) index_queue->drain();
+    }
+
+    void stop(void) {
+      index_queue.reset();
+    }
+
+    typedef limonp::BoundedBlockingQueue<IndexedPost *> _reindex_queue;
+
+    struct _reindex_job {
+      Post post;
+      std::string fingerprint;
+      _reindex_queue *results;
+    };
+
+    void _segment(_reindex_job *job) {
+      const Post &p = job->post;
+      auto *indexed = new IndexedPost { p.post_time, std::move(job->fingerprint), generate(p.topic, p.content), PostLayout(p.topic, p.content), {} };
+      indexed->keywords = _keywords(indexed->indexes);
+      job->results->Push(indexed);
+      delete job;
+    }
+
+    // Posts are streamed to a pool of segmenting workers, and their results to a single
+    // writer committing them in batches. Unless forced, posts whose text has the stored
+    // fingerprint are skipped. Forced rebuilds go to a new index generation, which only
+    // replaces the one serving searches once complete. Caches are refreshed at the end
+    void reindex_all(bool force) {
+      typedef std::chrono::steady_clock clock;
+      const size_t batchPosts = 256;
+
+      if(force && !open_index_generation()) {
+        std::cout<<"Index: A rebuild is already running"<<std::endl;
+        return;
+      }
+
       bool dummy_hasNext;
-      uint64_t dummy_total;
-      auto posts = list_posts(0, -1, dummy_hasNext, dummy_total);
-      for(auto &p : posts)
-        reindex(p);
+      uint64_t total;
+      list_posts(0, 0, dummy_hasNext, total);
+
+      const size_t workers = std::max(1u, std::thread::hardware_concurrency());
+      _reindex_queue results(workers * 4);
+      std::atomic<uint64_t> skipped(0);
+      uint64_t written = 0;
+      std::exception_ptr error;
+
+      const auto start = clock::now();
+      std::thread writer([&]() {
+        std::vector<std::unique_ptr<IndexedPost>> pending;
+        auto reported = start;
+
+        auto flush = [&]() {
+          std::vector<const IndexedPost *> batch;
+          for(auto &indexed : pending) batch.push_back(indexed.get());
+          try {
+            if(!error) {
+              if(force) set_generation_indexes(batch);
+              else set_indexes(batch);
+            }
+          } catch(...) {
+            error = std::current_exception();
+          }
+          written += pending.size();
+          pending.clear();
+
+          const uint64_t done = written + skipped;
+          const auto now = clock::now();
+          if(now - reported < std::chrono::seconds(1) || done >= total) return;
+          reported = now;
+
+          const double elapsed = std::chrono::duration<double>(now - start).count();
+          std::cout<<"Index: "<<done<<"/"<<total<<" posts, "<<(uint64_t) (done / elapsed)<<" posts/s, ETA "
+            <<(uint64_t) ((total - done) * elapsed / done)<<"s"<<std::endl;
+        };
+
+        // Keeps draining after an error, so that the workers never block
+        while(auto *indexed = results.Pop()) {
+          pending.emplace_back(indexed);
+          if(pending.size() >= batchPosts) flush();
+        }
+        if(pending.size() > 0) flush();
+      });
+
+      // A failed scan still stops the writer, once the pool has finished what it was given
+      std::exception_ptr scanError;
+      try {
+        limonp::ThreadPool pool(workers);
+        pool.Start();
+        scan_posts([&](Post &&p) {
+          std::string fingerprint = _fingerprint(p);
+          if(!force && fingerprint == query_fingerprint(p.post_time)) {
+            ++skipped;
+            return;
+          }
+          pool.Add(limonp::NewClosure(_segment, new _reindex_job { std::move(p), std::move(fingerprint), &results }));
+        });
+      } catch(...) {
+        scanError = std::current_exception();
+      }
+      results.Push(nullptr);
+      writer.join();
+      if(scanError) error = scanError;
+      if(error) {
+        if(force) drop_index_generation();
+        std::rethrow_exception(error);
+      }
+      if(force) swap_index_generation();
+
+      if(written > 0) {
+        invalidate();
+        if(memory_index) memory_index->load();
+        if(suggest_dict) _build_suggestions();
+        if(related_index) _build_related();
+      }
+
+      std::cout<<"Index: Reindexed "<<written<<" posts, "<<skipped<<" unchanged, in "
+        <<std::chrono::duration<double>(clock::now() - start).count()<<"s with "<<workers<<" workers"<<std::endl;
     }
 
     void invalidate() {
-      std::unique_lock<std::mutex> lock(search_cache_mutex);
+      search_cache->clear();
+    }
 
-      // TODO: optimize: only invalidate results containing the post
-      search_cache_list.clear();
-      search_cache_store.clear();
+    void invalidate(uint64_t post, const std::unordered_set<std::string> &words) {
+      search_cache->evict(post, words);
     }
 
     std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>>
       generate(const std::string &title, const std::string &body) {
-        std::vector<cppjieba::Word> titleWords, bodyWords;
-        jieba->CutForSearch(title, titleWords, true);
-        jieba->CutForSearch(body, bodyWords, true);
+        // Kept per thread, so that segmenting allocates nothing once it has seen a long post
+        thread_local std::vector<cppjieba::Sentence> sentences;
+        thread_local std::vector<uint32_t> offsets;
+        thread_local std::vector<cppjieba::WordSpan> words;
+        thread_local std::vector<size_t> ends;
         std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>> map;
 
-        for(auto &seg : titleWords)
-          map[seg.word].emplace_back(seg.offset, true);
-        for(auto &seg : bodyWords)
-          map[seg.word].emplace_back(seg.offset, false);
+        // The title, then every indexed span of the body, cut in one batch. Offsets stay
+        // relative to the whole body, so hits still point into the post
+        sentences.assign(1, cppjieba::Sentence(title));
+        offsets.assign(1, 0);
+        for(auto &span : text_spans(body)) {
+          if(!indexed_spans[(size_t) span.type]) continue;
+          sentences.emplace_back(body.data() + span.offset, span.length);
+          offsets.push_back(span.offset);
+        }
+        _jieba()->CutForSearch(sentences, words, ends, true);
 
-        return map;
-      }
+        size_t next = 0;
+        for(size_t k = 0; k < sentences.size(); ++k)
+          for(; next < ends[k]; ++next) {
+            const cppjieba::WordSpan &seg = words[next];
+            const std::string_view word(sentences[k].data + seg.offset, seg.length);
+            if(_indexable(word)) map[std::string(word)].emplace_back(offsets[k] + seg.offset, k == 0);
+          }
 
-    search_result search(std::string target) {
-      std::unique_lock<std::mutex> lock(search_cache_mutex);
-      if(search_cache_store.count(target) > 0) {
-        auto &cached = search_cache_store[target];
-        search_cache_list.splice(search_cache_list.end(), search_cache_list, cached.second);
-        return cached.first;
+        return map;
       }
-      lock.unlock();
 
+    // Scores and materializes every match. Only kept as the baseline for benchmark()
+    exhaustive_result _search_exhaustive(const std::string &target) {
       auto segs = split(target, ' ');
 
       std::unordered_map<uint64_t, std::list<std::tuple<uint32_t, uint32_t, bool>>> tot;
+      std::unordered_map<uint64_t, double> totScore;
+      const CorpusStats corpus = query_corpus_stats();
 
       for(auto &seg : segs) {
         std::unordered_map<uint64_t, std::list<std::tuple<uint32_t, uint32_t, bool>>> curRes;
+        std::unordered_map<uint64_t, double> curScore;
 
         std::vector<std::string> words;
-        jieba->Cut(seg, words, true);
+        _jieba()->Cut(seg, words, true);
+        words.erase(std::remove_if(words.begin(), words.end(),
+              [](const std::string &word) { return !_indexable(word); }), words.end());
 
         bool isBegin = true;
         
         for(auto &word : words) {
           auto store = query_indexes(word);
+          const double idf = _idf(word, store.size(), corpus);
 
           if(isBegin) {
             isBegin = false;
-            for(auto &rec : store)
+            for(auto &rec : store) {
               for(auto &occur : rec.second)
                 curRes[rec.first]
                   .emplace_back(occur.first, word.length(), occur.second);
+              curScore[rec.first] = _bm25(rec.first, rec.second, idf, corpus);
+            }
           } else for(auto res = curRes.begin(); res != curRes.end(); ++res) {
-            while(res != curRes.end() && store.count(res->first) == 0)
+            while(res != curRes.end() && store.count(res->first) == 0) {
+              curScore.erase(res->first);
               res = curRes.erase(res);
+            }
 
             if(res == curRes.end()) break;
 
             const std::vector<std::pair<uint32_t, bool>> &storeOccurs = store[res->first];
             auto storeOccurIter = storeOccurs.begin();
+            curScore[res->first] += _bm25(res->first, storeOccurs, idf, corpus);
 
             for(auto occur = res->second.begin(); occur != res->second.end(); ++occur) {
               while(_index_cmp_pair(*storeOccurIter, *occur)) {
@@ -139,37 +676,995 @@ namespace C3 {
         }
 
         for(auto &res : curRes) {
+          totScore[res.first] += curScore[res.first];
           if(tot.count(res.first) == 0) tot.emplace(res.first, std::move(res.second));
           else tot[res.first].merge(res.second, _index_cmp);
         }
       }
 
-      std::vector<std::pair<uint64_t, uint64_t>> scores(tot.size());
+      std::vector<std::pair<double, uint64_t>> scores(tot.size());
       int i = 0;
       for(auto &row : tot)
-        scores[i++] = std::make_pair(row.second.size(), row.first);
+        scores[i++] = std::make_pair(totScore[row.first], row.first);
 
-      sort(scores.begin(), scores.end(), std::greater<std::pair<uint64_t, uint64_t>>());
+      sort(scores.begin(), scores.end(), std::greater<std::pair<double, uint64_t>>());
 
-      search_result records;
+      exhaustive_result records;
       for(auto &rec : scores)
         records.emplace_back(rec.second, std::move(tot[rec.second]));
 
-      lock.lock();
-      if(search_cache_store.count(target) == 0) {
-        while(search_cache_list.size() >= search_cache_size) {
-          // Pop the first element
-          search_cache_store.erase(search_cache_list.front());
-          search_cache_list.pop_front();
+      return records;
+    }
+
+    struct _term {
+      std::string word;
+      PostingsPtr postings;
+      double idf;
+      double bound;
+      uint32_t gap; // Bytes of unindexed words before it in the query, which phrases allow for
+    };
+
+    // A space-separated segment or a quoted phrase of the query. Every word in it must match
+    struct _clause {
+      std::vector<_term> terms;
+      std::vector<uint64_t> docs;
+      bool phrase;
+      double bound;
+    };
+
+    // Words of a phrase may be separated by at most this many bytes, e.g. a space
+    const uint32_t phrase_slack = 1;
+
+    struct _field {
+      const uint32_t *begin;
+      const uint32_t *end;
+    };
+
+    // Offsets in one field are sorted, and title occurrences come first
+    _field _field_of(const Postings &p, size_t i, bool title) {
+      const uint8_t *flags = p.flags.data();
+      const uint32_t split = std::partition_point(flags + p.bounds[i], flags + p.bounds[i + 1],
+          [](uint8_t f) { return f != 0; }) - flags;
+
+      const uint32_t *offsets = p.offsets.data();
+      if(title) return _field { offsets + p.bounds[i], offsets + split };
+      return _field { offsets + split, offsets + p.bounds[i + 1] };
+    }
+
+    // Walks the phrase occurrences of doc. Stops at the first one if hits is null
+    size_t _phrase_matches(const _clause &c, uint64_t doc, std::vector<Hit> *hits) {
+      const size_t n = c.terms.size();
+      std::vector<_field> fields(n);
+      size_t count = 0;
+
+      for(bool title : { true, false }) {
+        for(size_t k = 0; k < n; ++k)
+          fields[k] = _field_of(*c.terms[k].postings, c.terms[k].postings->find(doc), title);
+
+        bool exhausted = false;
+        for(const uint32_t *start = fields[0].begin; start != fields[0].end && !exhausted; ++start) {
+          uint32_t pos = *start + c.terms[0].word.length();
+          bool matched = true;
+
+          for(size_t k = 1; k < n && matched; ++k) {
+            // Later starts only need later offsets, so cursors move forward
+            fields[k].begin = SetOps::gallop(fields[k].begin, fields[k].end, pos);
+            if(fields[k].begin == fields[k].end) exhausted = true;
+            matched = !exhausted && *fields[k].begin - pos <= phrase_slack + c.terms[k].gap;
+            if(matched) pos = *fields[k].begin + c.terms[k].word.length();
+          }
+
+          if(!matched) continue;
+          ++count;
+          if(!hits) return count;
+          hits->push_back(Hit { *start, pos - *start, title });
+        }
+      }
+
+      return count;
+    }
+
+    // Boost for every pair of neighbouring query words, decaying with the bytes between them
+    double _proximity(const _clause &c, uint64_t doc) {
+      double boost = 0;
+      for(size_t k = 0; k + 1 < c.terms.size(); ++k) {
+        const Postings &a = *c.terms[k].postings, &b = *c.terms[k + 1].postings;
+        const size_t ai = a.find(doc), bi = b.find(doc);
+        const uint32_t length = c.terms[k].word.length();
+
+        uint32_t gap = UINT32_MAX;
+        for(bool title : { true, false }) {
+          _field af = _field_of(a, ai, title), bf = _field_of(b, bi, title);
+          for(const uint32_t *occur = af.begin; occur != af.end && gap > 0; ++occur) {
+            bf.begin = SetOps::gallop(bf.begin, bf.end, *occur + length);
+            if(bf.begin == bf.end) break;
+            gap = std::min(gap, *bf.begin - *occur - length);
+          }
+        }
+
+        if(gap != UINT32_MAX)
+          boost += proximity_weight * std::min(c.terms[k].idf, c.terms[k + 1].idf) / (1 + gap / 3.0);
+      }
+      return boost;
+    }
+
+    PostingsPtr _fetch_postings(const std::string &word) {
+      PostingsPtr postings = memory_index ? memory_index->get(word) : make_postings(query_indexes(word));
+      if(!postings) postings = std::make_shared<Postings>();
+      return postings;
+    }
+
+    _term _load_term(const std::string &word, const CorpusStats &corpus) {
+      _term t;
+      t.word = word;
+      t.postings = _fetch_postings(word);
+      t.idf = _idf(word, t.postings->docs.size(), corpus);
+      t.bound = _bm25_bound(t.postings->maxTitle, t.postings->maxBody, t.idf, corpus);
+      t.gap = 0;
+      return t;
+    }
+
+    // Words of every space-separated part of the text leaves, as jieba cuts them
+    typedef std::unordered_map<std::string, SegmentCache::value_type> _segments;
+
+    void _collect_parts(const QueryNode &node, _segments &segments, std::vector<std::string> &missing) {
+      if(node.type == QueryNode::Type::Text) {
+        for(auto &part : split(node.value, ' ')) {
+          if(segments.count(part)) continue;
+          auto cached = segment_cache->get(part);
+          if(!cached) missing.push_back(part);
+          segments.emplace(part, std::move(cached));
         }
+      }
+      for(auto &child : node.children) _collect_parts(child, segments, missing);
+    }
 
-        search_cache_list.emplace_back(target);
-        auto iter = std::prev(search_cache_list.end());
-        search_cache_store.emplace(target, std::make_pair(records, iter));
+    // Parts seen before come from the cache, and the rest are cut in one batch
+    _segments _segment_query(const QueryNode &query) {
+      _segments segments;
+      std::vector<std::string> missing;
+      _collect_parts(query, segments, missing);
+      if(missing.size() == 0) return segments;
+
+      const uint64_t generation = segment_cache->generation();
+      const std::vector<cppjieba::Sentence> sentences(missing.begin(), missing.end());
+      std::vector<cppjieba::WordSpan> words;
+      std::vector<size_t> ends;
+      _jieba()->Cut(sentences, words, ends, true);
+
+      size_t next = 0;
+      for(size_t k = 0; k < missing.size(); ++k) {
+        auto cut = std::make_shared<std::vector<std::string>>();
+        for(; next < ends[k]; ++next) cut->emplace_back(missing[k], words[next].offset, words[next].length);
+        segments[missing[k]] = cut;
+        segment_cache->put(missing[k], std::move(cut), generation);
       }
-      lock.unlock();
+      return segments;
+    }
 
-      return records;
+    _clause _compile_clause(const QueryNode &leaf, const _segments &segments, const CorpusStats &corpus,
+        std::unordered_set<std::string> &terms) {
+      _clause c;
+      c.phrase = leaf.phrase;
+      c.bound = 0;
+
+      std::vector<std::string> words;
+      std::vector<uint32_t> gaps;
+      uint32_t gap = 0;
+      for(auto &part : split(leaf.value, ' ')) {
+        for(auto &word : *segments.at(part)) {
+          if(!_indexable(word)) {
+            gap += word.length() + phrase_slack;
+            continue;
+          }
+          words.emplace_back(word);
+          gaps.push_back(gap);
+          gap = 0;
+        }
+      }
+
+      if(words.size() == 0) return c;
+      terms.insert(words.begin(), words.end());
+
+      for(size_t k = 0; k < words.size(); ++k) {
+        c.terms.emplace_back(_load_term(words[k], corpus));
+        if(c.phrase) c.terms.back().gap = gaps[k];
+        c.bound += c.terms.back().bound;
+      }
+      if(!c.phrase)
+        for(size_t k = 0; k + 1 < c.terms.size(); ++k)
+          c.bound += proximity_weight * std::min(c.terms[k].idf, c.terms[k + 1].idf);
+
+      // Intersect starting from the shortest posting list
+      std::vector<const std::vector<uint64_t> *> lists;
+      for(auto &t : c.terms) lists.push_back(&t.postings->docs);
+      std::sort(lists.begin(), lists.end(),
+          [](const std::vector<uint64_t> *a, const std::vector<uint64_t> *b) { return a->size() < b->size(); });
+
+      c.docs = *lists[0];
+      for(size_t i = 1; i < lists.size() && c.docs.size() > 0; ++i)
+        c.docs = SetOps::intersect(c.docs, *lists[i]);
+      if(c.phrase)
+        c.docs.erase(std::remove_if(c.docs.begin(), c.docs.end(),
+              [&c](uint64_t doc) { return _phrase_matches(c, doc, nullptr) == 0; }), c.docs.end());
+
+      return c;
+    }
+
+    typedef std::vector<uint64_t> _docs;
+
+    // The query compiled into set operations over sorted post ids. Positive text leaves
+    // become the scored clauses, everything else only narrows down the matches
+    struct _plan {
+      const CorpusStats &corpus;
+      const _segments &segments;
+      std::vector<_clause> clauses;
+      std::unordered_set<std::string> terms;
+      _docs universe;
+      bool universeLoaded;
+
+      const _docs &all(void) {
+        if(!universeLoaded) {
+          universe = query_indexed_posts();
+          universeLoaded = true;
+        }
+        return universe;
+      }
+    };
+
+    _docs _evaluate(const QueryNode &node, _plan &plan, bool positive);
+
+    void _slice(_docs &docs, uint64_t from, uint64_t to) {
+      docs.erase(std::lower_bound(docs.begin(), docs.end(), to), docs.end());
+      docs.erase(docs.begin(), std::lower_bound(docs.begin(), docs.end(), from));
+    }
+
+    // Ranges and exclusions are applied to the intersection instead of being materialized
+    _docs _conjunction(const std::vector<const QueryNode *> &musts, std::vector<const QueryNode *> nots, _plan &plan, bool positive) {
+      uint64_t from = 0, to = UINT64_MAX;
+      std::vector<std::string> tags;
+      std::vector<_docs> sets;
+      for(auto node : musts) {
+        if(node->type == QueryNode::Type::Tag) tags.push_back(node->value);
+        else if(node->type == QueryNode::Type::Range) {
+          from = std::max(from, node->from);
+          to = std::min(to, node->to);
+        } else if(node->type == QueryNode::Type::Not) nots.push_back(&node->children[0]);
+        else sets.emplace_back(_evaluate(*node, plan, positive));
+      }
+      // Tags are intersected as bitmaps
+      if(tags.size() > 0) sets.emplace_back(query_tag_posts(tags, true));
+
+      _docs result;
+      if(sets.size() == 0) {
+        const _docs &all = plan.all();
+        result.assign(std::lower_bound(all.begin(), all.end(), from), std::lower_bound(all.begin(), all.end(), to));
+      } else {
+        std::sort(sets.begin(), sets.end(), [](const _docs &a, const _docs &b) { return a.size() < b.size(); });
+        result = std::move(sets[0]);
+        for(size_t i = 1; i < sets.size() && result.size() > 0; ++i)
+          result = SetOps::intersect(result, sets[i]);
+        _slice(result, from, to);
+      }
+
+      for(auto node : nots)
+        if(result.size() > 0) result = SetOps::subtract(result, _evaluate(*node, plan, false));
+      return result;
+    }
+
+    _docs _evaluate(const QueryNode &node, _plan &plan, bool positive) {
+      switch(node.type) {
+        case QueryNode::Type::Text: {
+          _clause c = _compile_clause(node, plan.segments, plan.corpus, plan.terms);
+          _docs docs = c.docs;
+          if(positive && docs.size() > 0) plan.clauses.emplace_back(std::move(c));
+          return docs;
+        }
+        case QueryNode::Type::Tag:
+          return query_tag_posts({ node.value }, true);
+        case QueryNode::Type::Range: {
+          _docs docs = plan.all();
+          _slice(docs, node.from, node.to);
+          return docs;
+        }
+        case QueryNode::Type::Not:
+          return SetOps::subtract(plan.all(), _evaluate(node.children[0], plan, false));
+        case QueryNode::Type::And: {
+          std::vector<const QueryNode *> musts;
+          for(auto &child : node.children) musts.push_back(&child);
+          return _conjunction(musts, {}, plan, positive);
+        }
+        case QueryNode::Type::Or: {
+          if(std::all_of(node.children.begin(), node.children.end(),
+                [](const QueryNode &child) { return child.type == QueryNode::Type::Tag; })) {
+            std::vector<std::string> tags;
+            for(auto &child : node.children) tags.push_back(child.value);
+            return query_tag_posts(tags, false);
+          }
+
+          _docs result;
+          for(auto &child : node.children) result = SetOps::unite(result, _evaluate(child, plan, positive));
+          return result;
+        }
+        case QueryNode::Type::Group: {
+          std::vector<const QueryNode *> musts, shoulds, nots;
+          for(auto &child : node.children) {
+            if(child.occur == QueryNode::Occur::Must) musts.push_back(&child);
+            else if(child.occur == QueryNode::Occur::MustNot) nots.push_back(&child);
+            else shoulds.push_back(&child);
+          }
+
+          if(musts.size() > 0) {
+            // Optional items only contribute to the score
+            for(auto child : shoulds) _evaluate(*child, plan, positive);
+            return _conjunction(musts, nots, plan, positive);
+          }
+
+          _docs result;
+          if(shoulds.size() > 0)
+            for(auto child : shoulds) result = SetOps::unite(result, _evaluate(*child, plan, positive));
+          else if(nots.size() > 0) result = plan.all();
+
+          for(auto child : nots)
+            if(result.size() > 0) result = SetOps::subtract(result, _evaluate(*child, plan, false));
+          return result;
+        }
+      }
+      return {};
+    }
+
+    // Whether every match must contain some positive text, so only posts containing
+    // one of the query terms can change the results
+    bool _anchored(const QueryNode &node) {
+      switch(node.type) {
+        case QueryNode::Type::Text:
+          return true;
+        case QueryNode::Type::And:
+          return std::any_of(node.children.begin(), node.children.end(), _anchored);
+        case QueryNode::Type::Or:
+          return std::all_of(node.children.begin(), node.children.end(), _anchored);
+        case QueryNode::Type::Group: {
+          bool hasMust = false, anchoredMust = false, hasShould = false, anchoredShoulds = true;
+          for(auto &child : node.children) {
+            if(child.occur == QueryNode::Occur::Must) {
+              hasMust = true;
+              anchoredMust = anchoredMust || _anchored(child);
+            } else if(child.occur == QueryNode::Occur::Should) {
+              hasShould = true;
+              anchoredShoulds = anchoredShoulds && _anchored(child);
+            }
+          }
+          return hasMust ? anchoredMust : hasShould && anchoredShoulds;
+        }
+        default:
+          return false;
+      }
+    }
+
+    // Clauses restricted to the matches of the whole query. Matches without any scored
+    // clause, e.g. from a filter-only query, are kept in a clause scoring nothing
+    std::vector<_clause> _compile(const QueryNode &query, const CorpusStats &corpus, std::unordered_set<std::string> &terms) {
+      const _segments segments = _segment_query(query);
+      _plan plan { corpus, segments, {}, {}, {}, false };
+      const _docs matches = _evaluate(query, plan, true);
+      terms = std::move(plan.terms);
+
+      std::vector<_clause> clauses;
+      _docs scored;
+      for(auto &c : plan.clauses) {
+        c.docs = SetOps::intersect(c.docs, matches);
+        if(c.docs.size() == 0) continue;
+        scored = SetOps::unite(scored, c.docs);
+        clauses.emplace_back(std::move(c));
+      }
+
+      _docs rest = SetOps::subtract(matches, scored);
+      if(rest.size() > 0) clauses.emplace_back(_clause { {}, std::move(rest), false, 0 });
+      return clauses;
+    }
+
+    double _clause_score(const _clause &c, uint64_t doc, const CorpusStats &corpus) {
+      const DocStats stats = query_doc_stats(doc);
+      double score = 0;
+      for(auto &t : c.terms) {
+        uint32_t titleTf, bodyTf;
+        t.postings->tf(t.postings->find(doc), titleTf, bodyTf);
+        score += _bm25(titleTf, bodyTf, stats, t.idf, corpus);
+      }
+
+      if(!c.phrase && proximity_weight > 0) score += _proximity(c, doc);
+      return score;
+    }
+
+    bool _hit_cmp(const Hit &a, const Hit &b) {
+      if(a.topic != b.topic) return a.topic;
+      return a.offset < b.offset;
+    }
+
+    void _append_hits(const std::vector<_clause> &clauses, uint64_t doc, std::vector<Hit> &hits) {
+      const size_t begin = hits.size();
+      for(auto &c : clauses) {
+        if(!std::binary_search(c.docs.begin(), c.docs.end(), doc)) continue;
+        if(c.phrase) {
+          _phrase_matches(c, doc, &hits);
+          continue;
+        }
+
+        for(auto &t : c.terms) {
+          const Postings &p = *t.postings;
+          const size_t i = p.find(doc);
+          for(uint32_t j = p.bounds[i]; j < p.bounds[i + 1]; ++j)
+            hits.push_back(Hit { p.offsets[j], (uint32_t) t.word.length(), p.flags[j] != 0 });
+        }
+      }
+
+      std::stable_sort(hits.begin() + begin, hits.end(), _hit_cmp);
+    }
+
+    // MaxScore: clauses whose bounds sum up to less than the current k-th score can not
+    // introduce new results on their own, so they are only probed for candidates found
+    // in the remaining (essential) clauses, until the candidate can't reach the threshold
+    std::shared_ptr<SearchResult> _search_topk(const std::string &target, uint32_t limit) {
+      const CorpusStats corpus = query_corpus_stats();
+      const QueryNode query = parse_query(target);
+      std::unordered_set<std::string> terms;
+      auto clauses = _compile(query, corpus, terms);
+
+      auto result = std::make_shared<SearchResult>();
+      result->terms.assign(terms.begin(), terms.end());
+      result->anchored = _anchored(query);
+      result->limit = limit;
+      uint64_t &total = result->total;
+
+      std::sort(clauses.begin(), clauses.end(),
+          [](const _clause &a, const _clause &b) { return a.bound < b.bound; });
+
+      std::vector<double> prefix(clauses.size());
+      for(size_t i = 0; i < clauses.size(); ++i)
+        prefix[i] = clauses[i].bound + (i > 0 ? prefix[i - 1] : 0);
+
+      // Total number of matches, without scoring
+      total = 0;
+      {
+        std::vector<size_t> cursors(clauses.size(), 0);
+        while(true) {
+          bool found = false;
+          uint64_t doc = 0;
+          for(size_t i = 0; i < clauses.size(); ++i)
+            if(cursors[i] < clauses[i].docs.size() && (!found || clauses[i].docs[cursors[i]] < doc)) {
+              doc = clauses[i].docs[cursors[i]];
+              found = true;
+            }
+          if(!found) break;
+
+          ++total;
+          for(size_t i = 0; i < clauses.size(); ++i)
+            if(cursors[i] < clauses[i].docs.size() && clauses[i].docs[cursors[i]] == doc) ++cursors[i];
+        }
+      }
+
+      typedef std::pair<double, uint64_t> scored;
+      std::priority_queue<scored, std::vector<scored>, std::greater<scored>> heap;
+
+      if(limit > 0) {
+        std::vector<size_t> cursors(clauses.size(), 0);
+        size_t essential = 0;
+
+        while(true) {
+          bool found = false;
+          uint64_t doc = 0;
+          for(size_t i = essential; i < clauses.size(); ++i)
+            if(cursors[i] < clauses[i].docs.size() && (!found || clauses[i].docs[cursors[i]] < doc)) {
+              doc = clauses[i].docs[cursors[i]];
+              found = true;
+            }
+          if(!found) break;
+
+          double score = 0;
+          for(size_t i = essential; i < clauses.size(); ++i)
+            if(cursors[i] < clauses[i].docs.size() && clauses[i].docs[cursors[i]] == doc) {
+              score += _clause_score(clauses[i], doc, corpus);
+              ++cursors[i];
+            }
+
+          const bool full = heap.size() >= limit;
+          bool pruned = false;
+          for(size_t i = essential; i-- > 0;) {
+            if(full && score + prefix[i] < heap.top().first) {
+              pruned = true;
+              break;
+            }
+            if(std::binary_search(clauses[i].docs.begin(), clauses[i].docs.end(), doc))
+              score += _clause_score(clauses[i], doc, corpus);
+          }
+
+          if(pruned) continue;
+          if(!full) heap.emplace(score, doc);
+          else if(scored(score, doc) > heap.top()) {
+            heap.pop();
+            heap.emplace(score, doc);
+          } else continue;
+
+          if(heap.size() >= limit)
+            while(essential < clauses.size() && prefix[essential] < heap.top().first) ++essential;
+        }
+      }
+
+      std::vector<scored> top;
+      top.reserve(heap.size());
+      while(!heap.empty()) {
+        top.push_back(heap.top());
+        heap.pop();
+      }
+
+      result->posts.reserve(top.size());
+      result->bounds.reserve(top.size() + 1);
+      result->bounds.push_back(0);
+      for(auto rec = top.rbegin(); rec != top.rend(); ++rec) {
+        result->posts.push_back(rec->second);
+        _append_hits(clauses, rec->second, result->hits);
+        result->bounds.push_back(result->hits.size());
+      }
+
+      return result;
+    }
+
+    size_t SearchResult::bytes(void) const {
+      size_t size = sizeof(SearchResult)
+        + posts.capacity() * sizeof(uint64_t)
+        + bounds.capacity() * sizeof(uint32_t)
+        + hits.capacity() * sizeof(Hit);
+      for(auto &term : terms) size += sizeof(std::string) + term.capacity();
+      return size;
+    }
+
+    std::string normalize(const std::string &target) {
+      return print_query(parse_query(target));
+    }
+
+    std::shared_ptr<const SearchResult> search(const std::string &target, uint32_t limit) {
+      const std::string key = normalize(target);
+
+      // Results for a larger limit, or every match, are also good for this one
+      auto cached = search_cache->get(key);
+      if(cached && (cached->limit >= limit || cached->posts.size() == cached->total))
+        return cached;
+
+      const uint64_t generation = search_cache->generation();
+      std::shared_ptr<const SearchResult> result = _search_topk(key, limit);
+      search_cache->put(key, result, generation);
+      return result;
+    }
+
+    void _find_hits(const std::string &text, const std::string &word, bool topic, std::vector<Hit> &hits) {
+      for(size_t at = text.find(word); at != std::string::npos; at = text.find(word, at + word.size()))
+        hits.push_back(Hit { (uint32_t) at, (uint32_t) word.size(), topic });
+    }
+
+    // The delta is matched by scanning the few pending posts, as stored now, for every word
+    // of the query. Filters and exclusions are not applied to it
+    std::shared_ptr<const SearchResult> with_pending(const std::shared_ptr<const SearchResult> &result, bool author) {
+      if(!index_queue || index_queue->size() == 0) return result;
+      const auto queued = index_queue->pending();
+      std::unordered_map<uint64_t, bool> pending(queued.begin(), queued.end()); // Whether removed
+
+      auto merged = std::make_shared<SearchResult>();
+      merged->terms = result->terms;
+      merged->anchored = result->anchored;
+      merged->total = result->total;
+      merged->limit = result->limit;
+      merged->bounds.push_back(0);
+
+      // Pending posts with every word, and their hits
+      const bool matching = author && result->terms.size() > 0;
+      std::unordered_map<uint64_t, std::vector<Hit>> matches;
+      if(matching)
+        for(auto &it : pending) {
+          if(it.second) continue;
+          std::optional<Post> p;
+          try {
+            p.emplace(get_post(it.first));
+          } catch(StorageExcept &e) {
+            if(e != StorageExcept::NotFound) throw;
+            it.second = true;
+            continue;
+          }
+
+          std::vector<Hit> hits;
+          bool all = true;
+          for(auto &term : result->terms) {
+            const size_t found = hits.size();
+            _find_hits(p->topic, term, true, hits);
+            _find_hits(p->content, term, false, hits);
+            if(hits.size() == found) {
+              all = false;
+              break;
+            }
+          }
+          if(!all) continue;
+          std::sort(hits.begin(), hits.end(), _hit_cmp);
+          matches.emplace(it.first, std::move(hits));
+        }
+
+      // Matches the index has not seen yet go first, the most hits first
+      const std::unordered_set<uint64_t> indexed(result->posts.begin(), result->posts.end());
+      std::vector<std::pair<uint64_t, const std::vector<Hit> *>> unseen;
+      for(auto &it : matches)
+        if(indexed.count(it.first) == 0) unseen.emplace_back(it.first, &it.second);
+      std::sort(unseen.begin(), unseen.end(),
+          [](const std::pair<uint64_t, const std::vector<Hit> *> &a, const std::pair<uint64_t, const std::vector<Hit> *> &b) {
+            return a.second->size() != b.second->size() ? a.second->size() > b.second->size() : a.first > b.first;
+          });
+      for(auto &match : unseen) {
+        merged->posts.push_back(match.first);
+        merged->hits.insert(merged->hits.end(), match.second->begin(), match.second->end());
+        merged->bounds.push_back(merged->hits.size());
+      }
+      merged->total += unseen.size();
+
+      // Hits of the indexed version point into text that changed since, so pending posts keep
+      // their rank with the hits matched above, or none
+      for(size_t i = 0; i < result->posts.size(); ++i) {
+        const uint64_t post = result->posts[i];
+        auto it = pending.find(post);
+        if(it == pending.end())
+          merged->hits.insert(merged->hits.end(), result->hits.begin() + result->bounds[i], result->hits.begin() + result->bounds[i + 1]);
+        else if(it->second || (matching && matches.count(post) == 0)) {
+          --merged->total;
+          continue;
+        } else if(matching) {
+          auto &hits = matches.at(post);
+          merged->hits.insert(merged->hits.end(), hits.begin(), hits.end());
+        }
+        merged->posts.push_back(post);
+        merged->bounds.push_back(merged->hits.size());
+      }
+      return merged;
+    }
+
+    std::vector<std::string> _read_user_dictionary(void) {
+      std::vector<std::string> lines;
+      std::ifstream file(dictionary_sources[2]);
+      std::string line;
+      while(std::getline(file, line)) lines.push_back(line);
+      return lines;
+    }
+
+    // Written next to it and renamed over it, as dictionary images are
+    bool _write_user_dictionary(const std::vector<std::string> &lines) {
+      const std::string &path = dictionary_sources[2];
+      const std::string tmp = path + ".tmp";
+      {
+        std::ofstream file(tmp, std::ios::trunc);
+        for(auto &line : lines) file<<line<<'\n';
+        if(!file.good()) return false;
+      }
+      return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // Posts indexed with the word, or for an inserted word, those a search for it found with
+    // the previous dictionary: the ones with every piece it was cut into
+    std::vector<uint64_t> _candidate_posts(const std::string &word, bool insert, const cppjieba::Jieba &previous) {
+      std::vector<std::string> pieces;
+      if(insert) previous.Cut(word, pieces, true);
+      else pieces.push_back(word);
+
+      bool constrained = false;
+      std::vector<uint64_t> candidates;
+      for(auto &piece : pieces) {
+        if(!_indexable(piece)) continue;
+        auto postings = _fetch_postings(piece);
+        candidates = constrained ? SetOps::intersect(candidates, postings->docs) : postings->docs;
+        constrained = true;
+      }
+      return constrained ? candidates : query_indexed_posts();
+    }
+
+    bool update_dictionary(const std::string &word, bool insert) {
+      typedef std::chrono::steady_clock clock;
+      const auto start = clock::now();
+      cppjieba::Unicode runes;
+      if(word.size() == 0 || !cppjieba::DecodeRunesInString(word, runes)) {
+        std::cout<<"Index: \""<<word<<"\" is not a valid word"<<std::endl;
+        return false;
+      }
+
+      std::shared_ptr<const cppjieba::Jieba> previous;
+      {
+        std::lock_guard<std::mutex> lock(dictionary_mutex);
+        previous = _jieba();
+        auto lines = _read_user_dictionary();
+        auto matches = [&word](const std::string &line) { return line.substr(0, line.find(' ')) == word; };
+        if(std::any_of(lines.begin(), lines.end(), matches) == insert) {
+          std::cout<<"Index: \""<<word<<"\" is "<<(insert ? "already" : "not")<<" in "<<dictionary_sources[2]<<std::endl;
+          return false;
+        }
+        if(insert) lines.push_back(word);
+        else lines.erase(std::remove_if(lines.begin(), lines.end(), matches), lines.end());
+        if(!_write_user_dictionary(lines)) {
+          std::cout<<"Index: Failed to write "<<dictionary_sources[2]<<std::endl;
+          return false;
+        }
+
+        // A copy of the trie with just this edit, instead of parsing the sources again
+        auto edited = std::make_shared<cppjieba::Jieba>(*previous);
+        if(insert) edited->InsertUserWord(word);
+        else edited->DeleteUserWord(word);
+        std::atomic_store(&jieba, std::shared_ptr<const cppjieba::Jieba>(std::move(edited)));
+        segment_cache->clear();
+        invalidate();
+      }
+      std::cout<<"Index: "<<(insert ? "Inserted \"" : "Deleted \"")<<word<<"\" in "
+        <<std::chrono::duration<double>(clock::now() - start).count()<<"s"<<std::endl;
+      if(dict_image) std::cout<<"Index: Run with --compile-dict to update the dictionary image"<<std::endl;
+
+      // Their text is unchanged, so only forcing it gets them resegmented
+      const std::vector<uint64_t> candidates = _candidate_posts(word, insert, *previous);
+      uint64_t written = 0;
+      for(auto post : candidates) {
+        try {
+          const Post p = get_post(post);
+          if(p.topic.find(word) == std::string::npos && p.content.find(word) == std::string::npos) continue;
+          reindex(p, true);
+          ++written;
+        } catch(StorageExcept &) {
+          // Removed meanwhile
+        }
+      }
+      std::cout<<"Index: Reindexed "<<written<<" of "<<candidates.size()<<" candidate posts for \""<<word<<"\", in "
+        <<std::chrono::duration<double>(clock::now() - start).count()<<"s"<<std::endl;
+      return true;
+    }
+
+    // Completes the last word of the query
+    std::vector<std::pair<std::string, uint64_t>> suggest(const std::string &prefix, uint32_t limit) {
+      const size_t split = prefix.find_last_of(' ');
+      const std::string head = split == std::string::npos ? "" : prefix.substr(0, split + 1);
+      const std::string last = prefix.substr(head.size());
+      if(last.size() == 0) return {};
+
+      auto completions = suggest_dict->complete(last, limit);
+      for(auto &completion : completions) completion.first = head + completion.first;
+      return completions;
+    }
+
+    void benchmark(const std::string &target, uint32_t limit, uint32_t rounds) {
+      typedef std::chrono::steady_clock clock;
+      const std::string key = normalize(target);
+
+      auto exhaustiveStart = clock::now();
+      exhaustive_result expected;
+      for(uint32_t i = 0; i < rounds; ++i)
+        expected = _search_exhaustive(key);
+      auto exhaustiveTime = clock::now() - exhaustiveStart;
+
+      auto topkStart = clock::now();
+      std::shared_ptr<SearchResult> actual;
+      for(uint32_t i = 0; i < rounds; ++i)
+        actual = _search_topk(key, limit);
+      auto topkTime = clock::now() - topkStart;
+
+      if(expected.size() > limit) expected.resize(limit);
+
+      std::unordered_set<uint64_t> expectedIds;
+      for(auto &rec : expected) expectedIds.insert(rec.first);
+      uint32_t recalled = 0;
+      for(auto post : actual->posts) recalled += expectedIds.count(post);
+
+      auto ms = [rounds](clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count() / rounds;
+      };
+
+      std::cout<<"Matches: "<<actual->total<<std::endl
+        <<"Exhaustive: "<<ms(exhaustiveTime)<<" ms/query"<<std::endl
+        <<"Top-"<<limit<<": "<<ms(topkTime)<<" ms/query"<<std::endl
+        <<"Recall: "<<recalled<<"/"<<expectedIds.size()<<std::endl;
+    }
+
+    size_t _resident_bytes() {
+      std::ifstream statm("/proc/self/statm");
+      size_t total = 0, resident = 0;
+      statm>>total>>resident;
+      return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    // Titles and bodies of every post
+    std::vector<std::string> _post_texts(size_t &bytes) {
+      std::vector<std::string> texts;
+      bytes = 0;
+      scan_posts([&](Post &&p) {
+        texts.push_back(std::move(p.topic));
+        texts.push_back(std::move(p.content));
+        bytes += texts[texts.size() - 2].size() + texts.back().size();
+      });
+      return texts;
+    }
+
+    void benchmark_segmentation(uint32_t rounds) {
+      typedef std::chrono::steady_clock clock;
+
+      size_t bytes = 0;
+      const std::vector<std::string> texts = _post_texts(bytes);
+      if(bytes == 0) {
+        std::cout<<"No posts to segment"<<std::endl;
+        return;
+      }
+
+      // Allocations are only counted in builds with C3_COUNT_ALLOCATIONS
+#ifdef C3_COUNT_ALLOCATIONS
+      const bool countingAllocations = true;
+#else
+      const bool countingAllocations = false;
+#endif
+
+      // Words copied out as strings, against offsets into a reused buffer
+      auto run = [&](const char *name, auto &words, auto cut) {
+        for(auto &text : texts) cut(text, words); // Warms the scratch buffers
+        size_t count = 0;
+        const uint64_t allocations = thread_allocations();
+        auto start = clock::now();
+        for(uint32_t i = 0; i < rounds; ++i)
+          for(auto &text : texts) {
+            cut(text, words);
+            count += words.size();
+          }
+        const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        const double calls = (double) rounds * texts.size();
+        std::cout<<name<<": "<<bytes * rounds / seconds / 1048576<<" MiB/s, "<<count / rounds<<" words";
+        if(countingAllocations) std::cout<<", "<<(thread_allocations() - allocations) / calls<<" allocations/call";
+        std::cout<<std::endl;
+      };
+
+      const auto segmenter = _jieba();
+      std::vector<cppjieba::Word> words;
+      std::vector<cppjieba::WordSpan> spans;
+      std::cout<<"Posts: "<<texts.size() / 2<<", "<<bytes / 1024<<" KiB"<<std::endl;
+      run("Cut (words)", words, [&](const std::string &text, std::vector<cppjieba::Word> &out) { segmenter->Cut(text, out, true); });
+      run("Cut (spans)", spans, [&](const std::string &text, std::vector<cppjieba::WordSpan> &out) { segmenter->Cut(text, out, true); });
+      run("CutForSearch (words)", words,
+          [&](const std::string &text, std::vector<cppjieba::Word> &out) { segmenter->CutForSearch(text, out, true); });
+      run("CutForSearch (spans)", spans,
+          [&](const std::string &text, std::vector<cppjieba::WordSpan> &out) { segmenter->CutForSearch(text, out, true); });
+      std::cout<<"Dictionary trie: "<<segmenter->GetDictTrie()->GetTrieMemoryUsage() / 1024<<" KiB"<<std::endl
+        <<"Resident: "<<_resident_bytes() / 1048576<<" MiB"<<std::endl;
+    }
+
+    void benchmark_decoding(uint32_t rounds) {
+      typedef std::chrono::steady_clock clock;
+      using cppjieba::DecoderIsa;
+      const DecoderIsa best = cppjieba::GetDecoderIsa();
+      std::cout<<"Decoder: "<<cppjieba::GetDecoderIsaName(best)<<std::endl;
+
+      // Strings end right before an inaccessible page, so that a decoder reading past them crashes
+      const size_t page = sysconf(_SC_PAGESIZE);
+      char *guarded = (char *) mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(guarded == MAP_FAILED || mprotect(guarded + page, page, PROT_NONE) != 0) {
+        std::cout<<"Failed to map a guard page"<<std::endl;
+        return;
+      }
+
+      // Every vectorized decoder the CPU runs has to agree with the scalar one, on malformed input too
+      const std::vector<std::string> pieces = { "a", "search ", "\n", "\xe5\x86\x85\xe5\xad\x98", "\xc3\xa9",
+        "\xf0\x9f\x98\x80", "\xe4\xb8", "\xc3", "\x80", "\xbf", "\xf8", "\xff", "\xc0\x80", "\xed\xa0\x80" };
+      std::vector<cppjieba::RuneStr> expected, actual;
+      size_t fuzzed = 0, mismatches = 0;
+      auto check = [&](const std::string &text) {
+        char *data = guarded + page - text.size();
+        std::memcpy(data, text.data(), text.size());
+
+        expected.resize(text.size());
+        actual.resize(text.size());
+        const size_t n = cppjieba::DecodeRuneStrsScalar(data, text.size(), expected.data());
+        for(int isa = cppjieba::DECODER_SSE42; isa <= best; ++isa) {
+          const size_t m = cppjieba::DecodeRuneStrs(data, text.size(), actual.data(), (DecoderIsa) isa);
+          bool same = n == m;
+          for(size_t i = 0; same && n != cppjieba::DECODE_FAILED && i < n; ++i)
+            same = expected[i].rune == actual[i].rune && expected[i].offset == actual[i].offset && expected[i].len == actual[i].len;
+          mismatches += !same;
+          ++fuzzed;
+        }
+      };
+
+      // Each piece followed by ASCII up to every length around a block, then random strings
+      for(auto &piece : pieces)
+        for(size_t length = piece.size(); length < 72; ++length)
+          check(piece + std::string(length - piece.size(), 'a'));
+      std::mt19937 gen(42);
+      for(uint32_t k = 0; k < 100000 * rounds; ++k) {
+        std::string text;
+        const size_t length = gen() % 100;
+        const bool random = gen() % 4 == 0;
+        while(text.size() < length) text += random ? std::string(1, (char) gen()) : pieces[gen() % pieces.size()];
+        check(text);
+      }
+      munmap(guarded, 2 * page);
+      std::cout<<"Fuzzed: "<<fuzzed<<" strings, "<<mismatches<<" mismatches"<<std::endl;
+
+      size_t bytes = 0;
+      const std::vector<std::string> texts = _post_texts(bytes);
+      if(bytes == 0) {
+        std::cout<<"No posts to decode"<<std::endl;
+        return;
+      }
+
+      size_t longest = 0;
+      for(auto &text : texts) longest = std::max(longest, text.size());
+      std::vector<cppjieba::RuneStr> runes(longest);
+      for(int isa = cppjieba::DECODER_SCALAR; isa <= best; ++isa) {
+        size_t count = 0;
+        auto start = clock::now();
+        for(uint32_t i = 0; i < rounds; ++i)
+          for(auto &text : texts) {
+            const size_t n = cppjieba::DecodeRuneStrs(text.data(), text.size(), runes.data(), (DecoderIsa) isa);
+            if(n != cppjieba::DECODE_FAILED) count += n;
+          }
+        const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout<<cppjieba::GetDecoderIsaName((DecoderIsa) isa)<<": "<<bytes * rounds / seconds / 1048576<<" MiB/s, "
+          <<count / rounds<<" runes"<<std::endl;
+      }
+    }
+
+    void benchmark_hmm(uint32_t rounds) {
+      typedef std::chrono::steady_clock clock;
+      using cppjieba::ViterbiIsa;
+      const ViterbiIsa best = cppjieba::GetViterbiIsa();
+      const auto segmenter = _jieba();
+      const cppjieba::HMMSegment hmm(segmenter->GetHMMModel());
+      std::cout<<"Viterbi: "<<cppjieba::GetViterbiIsaName(best)<<std::endl;
+
+      // Runes the model knows, mixed with ones it does not, whose paths stay at the floor
+      std::vector<cppjieba::Rune> known;
+      for(auto &emit : segmenter->GetHMMModel()->emitProbB) known.push_back(emit.first);
+      std::sort(known.begin(), known.end());
+      std::mt19937 gen(42);
+      std::vector<cppjieba::RuneStr> runes;
+      std::vector<size_t> expected, actual;
+      size_t fuzzed = 0, mismatches = 0;
+      for(uint32_t k = 0; k < 20000 * rounds; ++k) {
+        runes.resize(1 + gen() % 80);
+        for(auto &r : runes) {
+          const uint32_t pick = gen() % 8;
+          r.rune = pick < 6 && known.size() > 0 ? known[gen() % known.size()] : pick == 6 ? 0x4E00 + gen() % 0x5200 : 0x80 + gen() % 0x10FF80;
+        }
+        hmm.Viterbi(runes.data(), runes.data() + runes.size(), expected, cppjieba::VITERBI_REFERENCE);
+        for(int isa = cppjieba::VITERBI_SCALAR; isa <= best; ++isa) {
+          hmm.Viterbi(runes.data(), runes.data() + runes.size(), actual, (ViterbiIsa) isa);
+          mismatches += expected != actual;
+          ++fuzzed;
+        }
+      }
+      std::cout<<"Fuzzed: "<<fuzzed<<" runs, "<<mismatches<<" mismatches"<<std::endl;
+
+      // Runs of non-ASCII runes, which is what the HMM is given once letters and numbers are split off
+      size_t bytes = 0;
+      std::vector<cppjieba::RuneStrArray> texts;
+      for(auto &text : _post_texts(bytes)) {
+        texts.emplace_back();
+        cppjieba::DecodeRunesInString(text, texts.back());
+      }
+      std::vector<std::pair<const cppjieba::RuneStr *, const cppjieba::RuneStr *>> spans;
+      size_t total = 0;
+      for(auto &text : texts)
+        for(size_t i = 0; i < text.size();) {
+          size_t j = i;
+          while(j < text.size() && text[j].rune >= 0x80) ++j;
+          if(j > i) spans.emplace_back(text.begin() + i, text.begin() + j);
+          total += j - i;
+          i = j + 1;
+        }
+      if(total == 0) {
+        std::cout<<"No posts with non-ASCII text"<<std::endl;
+        return;
+      }
+
+      for(int isa = cppjieba::VITERBI_REFERENCE; isa <= best; ++isa) {
+        auto start = clock::now();
+        for(uint32_t i = 0; i < rounds; ++i)
+          for(auto &span : spans) hmm.Viterbi(span.first, span.second, actual, (ViterbiIsa) isa);
+        const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout<<cppjieba::GetViterbiIsaName((ViterbiIsa) isa)<<": "<<total * rounds / seconds / 1e6<<" Mrunes/s over "
+          <<spans.size()<<" runs"<<std::endl;
+      }
     }
   }
 }
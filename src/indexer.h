@@ -2,21 +2,76 @@
 
 #include <string>
 #include <unordered_map>
-#include <list>
+#include <unordered_set>
+#include <vector>
+#include <memory>
 
 #include "config.h"
 #include "storage.h"
 
 namespace C3 {
   namespace Index {
+    struct Hit {
+      uint32_t offset;
+      uint32_t length;
+      bool topic;
+    };
+
+    // Immutable once built, shared between the cache and the readers
+    struct SearchResult {
+      std::vector<uint64_t> posts; // Ranked
+      std::vector<uint32_t> bounds; // Hits of posts[i] are hits[bounds[i], bounds[i+1])
+      std::vector<Hit> hits;
+      std::vector<std::string> terms;
+      bool anchored; // Only posts containing one of the terms can change it
+      uint64_t total;
+      uint32_t limit;
+
+      size_t bytes(void) const;
+    };
+
+    // A post as shown in search results
+    struct Snippet {
+      Post post;
+      PostLayout layout;
+    };
+
+    enum class IndexStatus {
+      Queued, Indexing, Done
+    };
+
+    // Most similar posts first, with their cosine similarity
+    typedef std::vector<std::pair<uint64_t, double>> RelatedPosts;
+
     void setup(const Config &c);
+    bool compile_dictionary(const Config &c); // Into an image that setup maps instead of parsing
 
-    void reindex(const Post& p);
-    void reindex_all(void);
+    void reindex(const Post& p, bool force = false);
+    // Reindex or remove a post in the background, and wait for every queued post
+    void enqueue(const Post& p);
+    void enqueue_remove(uint64_t post);
+    IndexStatus status(uint64_t post);
+    void drain(void);
+    void stop(void);
+    void reindex_all(bool force = false);
+    void remove(uint64_t post);
     void invalidate();
+    void invalidate(uint64_t post, const std::unordered_set<std::string> &words);
     std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>>
       generate(const std::string &title, const std::string &body);
-    std::vector<std::pair<uint64_t, std::list<std::tuple<uint32_t, uint32_t, bool>>>>
-      search(std::string target);
+    std::string normalize(const std::string &target);
+    std::shared_ptr<const SearchResult> search(const std::string &target, uint32_t limit);
+    // Drops the hits of posts changed since they were indexed, and the posts being removed.
+    // For authors, pending posts are matched against their stored text instead
+    std::shared_ptr<const SearchResult> with_pending(const std::shared_ptr<const SearchResult> &result, bool author);
+    std::shared_ptr<const Snippet> snippet(uint64_t post);
+    std::shared_ptr<const RelatedPosts> related(uint64_t post);
+    std::vector<std::pair<std::string, uint64_t>> suggest(const std::string &prefix, uint32_t limit);
+    // Inserts or deletes a user word, then reindexes the posts that contain it
+    bool update_dictionary(const std::string &word, bool insert);
+    void benchmark(const std::string &target, uint32_t limit, uint32_t rounds);
+    void benchmark_segmentation(uint32_t rounds);
+    void benchmark_decoding(uint32_t rounds);
+    void benchmark_hmm(uint32_t rounds);
   }
 }
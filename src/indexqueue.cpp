@@ -0,0 +1,101 @@
+#include "indexqueue.h"
+
+#include <iostream>
+#include <optional>
+
+namespace C3 {
+  namespace Index {
+    IndexQueue::IndexQueue() : worker(&IndexQueue::_run, this) { }
+
+    IndexQueue::~IndexQueue() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      ready.notify_all();
+      worker.join();
+    }
+
+    void IndexQueue::push(uint64_t post, bool removed) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        _entry &entry = entries[post];
+        entry.removed = entry.removed || removed;
+        if(!entry.queued) {
+          entry.queued = true;
+          order.push_back(post);
+        }
+      }
+      ready.notify_one();
+    }
+
+    IndexStatus IndexQueue::status(uint64_t post) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = entries.find(post);
+      if(it == entries.end()) return IndexStatus::Done;
+      return it->second.queued ? IndexStatus::Queued : IndexStatus::Indexing;
+    }
+
+    std::vector<std::pair<uint64_t, bool>> IndexQueue::pending(void) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<std::pair<uint64_t, bool>> result;
+      for(auto &it : entries) result.emplace_back(it.first, it.second.removed);
+      return result;
+    }
+
+    bool IndexQueue::pending(uint64_t post) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return entries.count(post) > 0;
+    }
+
+    size_t IndexQueue::size(void) const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return entries.size();
+    }
+
+    void IndexQueue::drain(void) {
+      std::unique_lock<std::mutex> lock(mutex);
+      drained.wait(lock, [this]() { return entries.empty(); });
+    }
+
+    // Entries stay until indexed, so that the post counts as pending meanwhile. Markers are
+    // read before the post, so the ones cleared are all covered by the version indexed
+    void IndexQueue::_run(void) {
+      std::unique_lock<std::mutex> lock(mutex);
+      while(true) {
+        ready.wait(lock, [this]() { return stopping || order.size() > 0; });
+        if(order.empty()) return;
+
+        const uint64_t post = order.front();
+        order.pop_front();
+        _entry &entry = entries.at(post);
+        entry.queued = false;
+        entry.indexing = true;
+        lock.unlock();
+
+        try {
+          const auto markers = query_queued(post);
+          std::optional<Post> p;
+          try {
+            p.emplace(get_post(post));
+          } catch(StorageExcept &e) {
+            if(e != StorageExcept::NotFound) throw;
+          }
+
+          // A post that is gone only needs removing, whether it was ever indexed or not
+          if(p) reindex(*p);
+          else remove(post);
+          clear_queued(markers);
+        } catch(...) {
+          std::cout<<"Index: Failed to index post "<<post<<std::endl;
+        }
+
+        lock.lock();
+        _entry &done = entries.at(post);
+        done.indexing = false;
+        if(!done.queued) entries.erase(post);
+        if(entries.empty()) drained.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "indexer.h"
+
+namespace C3 {
+  namespace Index {
+    // Posts waiting for reindex() or remove() on a background thread, in the order first
+    // queued. Each is indexed as stored by the time its turn comes, so a post queued again
+    // before that is indexed once, and always at its latest version
+    class IndexQueue {
+    public:
+      IndexQueue();
+      ~IndexQueue(); // Drains the queue first
+
+      void push(uint64_t post, bool removed);
+      IndexStatus status(uint64_t post) const;
+      // Posts not indexed yet, and whether they were removed
+      std::vector<std::pair<uint64_t, bool>> pending(void) const;
+      bool pending(uint64_t post) const;
+      size_t size(void) const;
+      void drain(void);
+
+    private:
+      struct _entry {
+        bool removed = false; // Post ids are never reused
+        bool queued = false;
+        bool indexing = false;
+      };
+
+      mutable std::mutex mutex;
+      std::condition_variable ready, drained;
+      std::deque<uint64_t> order;
+      std::unordered_map<uint64_t, _entry> entries;
+      bool stopping = false;
+      std::thread worker;
+
+      void _run(void);
+    };
+  }
+}
@@ -13,6 +13,7 @@
 #include "indexer.h"
 #include "saxreader.h"
 #include "feed.h"
+#include "setops.h"
 
 using namespace C3;
 
@@ -26,6 +27,7 @@ void join_server(const Config &c) {
     _app->port(c.server_port).run();
   }
 
+  Index::stop(); // Indexes what is still queued
   stop_storage();
   std::cout<<"Server stopped."<<std::endl;
 }
@@ -64,9 +66,12 @@ void initialize_server([[maybe_unused]] const Config &c) {
   CROW_ROUTE(app, "/internal/post/<uint>").methods("GET"_method ,"POST"_method, "DELETE"_method)(post_dispatcher);
 
   CROW_ROUTE(app, "/post/<string>").methods("GET"_method)(handle_post_read_url);
+  CROW_ROUTE(app, "/post/<string>/related").methods("GET"_method)(handle_post_related_url);
+  CROW_ROUTE(app, "/post/<string>/index").methods("GET"_method)(handle_post_index_status);
 
   CROW_ROUTE(app, "/tag/<string>").methods("GET"_method)(handle_post_tag_list);
   CROW_ROUTE(app, "/tag/<string>/<uint>").methods("GET"_method)(handle_post_tag_list_page);
+  CROW_ROUTE(app, "/tags").methods("GET"_method)(handle_tag_counts);
 
   CROW_ROUTE(app, "/account/login").methods("POST"_method)(handle_account_login);
   CROW_ROUTE(app, "/account/logout").methods("POST"_method)(handle_account_logout);
@@ -77,6 +82,7 @@ void initialize_server([[maybe_unused]] const Config &c) {
 
   CROW_ROUTE(app, "/search/<string>").methods("GET"_method)(handle_search);
   CROW_ROUTE(app, "/search/<string>/<uint>").methods("GET"_method)(handle_search_page);
+  CROW_ROUTE(app, "/suggest/<string>").methods("GET"_method)(handle_suggest);
 
   crow::logger::setLogLevel(crow::LogLevel::WARNING);
 }
@@ -108,12 +114,65 @@ void start_loop() {
         else
           std::cout<<"Invalid target: \""<<segs[1]<<"\""<<std::endl;
       }
+    } else if(segs[0] == "reindex") {
+      if(segs.size() > 2 || (segs.size() == 2 && segs[1] != "full"))
+        std::cout<<"Invalid command: usage: \"reindex [full]\""<<std::endl;
+      else {
+        // Searches keep being served from the current index meanwhile
+        const bool full = segs.size() == 2;
+        std::thread([full] {
+          try {
+            Index::reindex_all(full);
+          } catch(...) {
+            std::cout<<"Index: Reindex failed"<<std::endl;
+          }
+        }).detach();
+      }
+    } else if(segs[0] == "dict") {
+      if(segs.size() != 3 || (segs[1] != "add" && segs[1] != "remove"))
+        std::cout<<"Invalid command: usage: \"dict add|remove <word>\""<<std::endl;
+      else {
+        // Segmenting goes on with the current dictionary until the edited one is published
+        const std::string word = segs[2];
+        const bool insert = segs[1] == "add";
+        std::thread([word, insert] {
+          try {
+            Index::update_dictionary(word, insert);
+          } catch(...) {
+            std::cout<<"Index: Dictionary update failed"<<std::endl;
+          }
+        }).detach();
+      }
+    } else if(segs[0] == "bench" && segs.size() == 2 && segs[1] == "sets") {
+      SetOps::benchmark(20);
+    } else if(segs[0] == "bench" && segs.size() == 2 && segs[1] == "segment") {
+      Index::benchmark_segmentation(5);
+    } else if(segs[0] == "bench" && segs.size() == 2 && segs[1] == "decode") {
+      Index::benchmark_decoding(5);
+    } else if(segs[0] == "bench" && segs.size() == 2 && segs[1] == "hmm") {
+      Index::benchmark_hmm(5);
+    } else if(segs[0] == "bench") {
+      uint32_t limit;
+      if(segs.size() < 3 || (limit = std::strtoul(segs[1].c_str(), nullptr, 10)) == 0)
+        std::cout<<"Invalid command: usage: \"bench <k> <query>\""<<std::endl;
+      else {
+        std::string query = segs[2];
+        for(size_t i = 3; i < segs.size(); ++i) query += ' ' + segs[i];
+        Index::benchmark(query, limit, 20);
+      }
     } else if(segs[0] == "help") {
       if(segs.size() != 1) std::cout<<"Invalid command: \"help\" takes no argument"<<std::endl;
       else {
         std::cout<<"Available commands:"<<std::endl
           <<"stop"<<"\t\t\t"<<"Stops the server."<<std::endl
           <<"invalidate [feed|index]"<<"\t"<<"Invalidate caches."<<std::endl
+          <<"reindex [full]"<<"\t\t"<<"Reindex changed posts, or rebuild the index, in the background."<<std::endl
+          <<"dict add|remove <word>"<<"\t"<<"Edit the user dictionary live, then reindex the posts with the word."<<std::endl
+          <<"bench <k> <query>"<<"\t"<<"Compare top-k and exhaustive search."<<std::endl
+          <<"bench sets"<<"\t\t"<<"Compare scalar and vectorized set operations."<<std::endl
+          <<"bench segment"<<"\t\t"<<"Measure segmentation throughput, allocations and memory."<<std::endl
+          <<"bench decode"<<"\t\t"<<"Check and compare the UTF-8 decoders."<<std::endl
+          <<"bench hmm"<<"\t\t"<<"Check and compare the HMM Viterbi decoders."<<std::endl
           <<"help"<<"\t\t\t"<<"Print this message."<<std::endl;
       }
     } else {
@@ -129,7 +188,9 @@ int main(int argc, char** argv) {
     ("help", "print help message")
     ("check,C", "Perform storage check before server startup")
     ("check-authors", "Perform author check before server startup")
-    ("reindex,R", "Force reindex at startup");
+    ("reindex,R", "Reindex changed posts at startup")
+    ("full-reindex", "Resegment every post at startup")
+    ("compile-dict", "Compile the search dictionaries into an image, and exit");
   po::variables_map opts;
 
   try {
@@ -148,7 +209,8 @@ int main(int argc, char** argv) {
 
   bool flag_check = opts.count("check");
   bool flag_check_authors = flag_check || opts.count("check-authors");
-  bool flag_reindex = opts.count("reindex");
+  bool flag_full_reindex = opts.count("full-reindex");
+  bool flag_reindex = flag_full_reindex || opts.count("reindex");
 
   /* Setup */
   Config c;
@@ -157,6 +219,9 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  if(opts.count("compile-dict"))
+    return Index::compile_dictionary(c) ? 0 : 1;
+
   SAX::setup();
 
   if(!setup_storage(c.db_path, c.db_cache)) {
@@ -181,7 +246,7 @@ int main(int argc, char** argv) {
   }
 
   if(flag_reindex) {
-    Index::reindex_all();
+    Index::reindex_all(flag_full_reindex);
   }
 
   if(!validFlag) {
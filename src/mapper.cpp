@@ -2,21 +2,28 @@
 
 #include <string>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 
 namespace C3 {
+  // Changed by the storage commit leader, once the posts are written
   std::map<std::string, uint64_t> urlMap;
+  std::shared_mutex urlMutex;
 
   bool has_url(const std::string &url) {
+    std::shared_lock<std::shared_mutex> lock(urlMutex);
     return urlMap.count(url) > 0;
   }
 
   void add_url(const std::string &url, uint64_t id) {
+    std::unique_lock<std::shared_mutex> lock(urlMutex);
     auto res = urlMap.insert(std::make_pair(url, id));
     if(!res.second) throw MapperError::DuplicatedUrl;
   }
 
   uint64_t query_url(const std::string &url) {
+    std::shared_lock<std::shared_mutex> lock(urlMutex);
     try {
       return urlMap.at(url);
     } catch(std::out_of_range &e) {
@@ -25,6 +32,7 @@ namespace C3 {
   }
 
   void rename_url(const std::string &from, const std::string &to, uint64_t validator) {
+    std::unique_lock<std::shared_mutex> lock(urlMutex);
     uint64_t original;
     try {
       original = urlMap.at(from);
@@ -41,6 +49,7 @@ namespace C3 {
   }
 
   void remove_url(const std::string &url) {
+    std::unique_lock<std::shared_mutex> lock(urlMutex);
     if(urlMap.erase(url) == 0) throw MapperError::UrlNotFound;
   }
 }
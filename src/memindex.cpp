@@ -0,0 +1,222 @@
+#include "memindex.h"
+
+#include <algorithm>
+
+#include "storage.h"
+
+namespace C3 {
+  namespace Index {
+    Postings::Postings() : bounds(1, 0) { }
+
+    size_t Postings::find(uint64_t doc) const {
+      auto it = std::lower_bound(docs.begin(), docs.end(), doc);
+      if(it == docs.end() || *it != doc) return npos;
+      return it - docs.begin();
+    }
+
+    void Postings::tf(size_t i, uint32_t &title, uint32_t &body) const {
+      title = 0;
+      for(uint32_t j = bounds[i]; j < bounds[i + 1]; ++j) title += flags[j];
+      body = bounds[i + 1] - bounds[i] - title;
+    }
+
+    void Postings::append(uint64_t doc, const std::vector<std::pair<uint32_t, bool>> &occurs) {
+      // Title occurrences go first, as they are presented first
+      std::vector<std::pair<uint32_t, bool>> sorted(occurs);
+      std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint32_t, bool> &a, const std::pair<uint32_t, bool> &b) {
+        if(a.second != b.second) return a.second;
+        return a.first < b.first;
+      });
+
+      uint32_t title = 0;
+      docs.push_back(doc);
+      for(auto &occur : sorted) {
+        offsets.push_back(occur.first);
+        flags.push_back(occur.second);
+        title += occur.second;
+      }
+      bounds.push_back(offsets.size());
+
+      maxTitle = std::max(maxTitle, title);
+      maxBody = std::max(maxBody, (uint32_t) sorted.size() - title);
+    }
+
+    void Postings::append(const Postings &from, size_t i) {
+      docs.push_back(from.docs[i]);
+      offsets.insert(offsets.end(), from.offsets.begin() + from.bounds[i], from.offsets.begin() + from.bounds[i + 1]);
+      flags.insert(flags.end(), from.flags.begin() + from.bounds[i], from.flags.begin() + from.bounds[i + 1]);
+      bounds.push_back(offsets.size());
+
+      uint32_t title, body;
+      from.tf(i, title, body);
+      maxTitle = std::max(maxTitle, title);
+      maxBody = std::max(maxBody, body);
+    }
+
+    PostingsPtr make_postings(std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, bool>>> &&store) {
+      std::vector<uint64_t> docs;
+      docs.reserve(store.size());
+      for(auto &rec : store) docs.push_back(rec.first);
+      std::sort(docs.begin(), docs.end());
+
+      auto result = std::make_shared<Postings>();
+      result->docs.reserve(docs.size());
+      result->bounds.reserve(docs.size() + 1);
+      for(auto doc : docs) result->append(doc, store[doc]);
+      return result;
+    }
+
+    PostingsPtr _merge(const Postings &a, const Postings &b) {
+      auto result = std::make_shared<Postings>();
+      size_t i = 0, j = 0;
+      while(i < a.docs.size() || j < b.docs.size()) {
+        if(j == b.docs.size() || (i < a.docs.size() && a.docs[i] < b.docs[j])) result->append(a, i++);
+        else result->append(b, j++);
+      }
+      return result;
+    }
+
+    size_t MemoryIndex::load(void) {
+      std::lock_guard<std::mutex> writeLock(writeMutex);
+
+      std::vector<std::pair<std::string, PostingsPtr>> entries;
+      std::string current;
+      std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, bool>>> store;
+
+      // Keys are grouped by term, so only one term is held in the map form at a time
+      scan_indexes([&](const std::string &term, uint64_t post, std::vector<std::pair<uint32_t, bool>> &&occurs) {
+        if(term != current) {
+          if(store.size() > 0) entries.emplace_back(current, make_postings(std::move(store)));
+          store.clear();
+          current = term;
+        }
+        store.emplace(post, std::move(occurs));
+      });
+      if(store.size() > 0) entries.emplace_back(current, make_postings(std::move(store)));
+
+      std::stable_sort(entries.begin(), entries.end(),
+          [](const std::pair<std::string, PostingsPtr> &a, const std::pair<std::string, PostingsPtr> &b) { return a.first < b.first; });
+
+      std::vector<std::string> loadedTerms;
+      std::vector<PostingsPtr> loadedPostings;
+      loadedTerms.reserve(entries.size());
+      loadedPostings.reserve(entries.size());
+      for(auto &entry : entries) {
+        if(loadedTerms.size() > 0 && loadedTerms.back() == entry.first)
+          loadedPostings.back() = _merge(*loadedPostings.back(), *entry.second);
+        else {
+          loadedTerms.emplace_back(std::move(entry.first));
+          loadedPostings.emplace_back(std::move(entry.second));
+        }
+      }
+
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      terms.swap(loadedTerms);
+      postings.swap(loadedPostings);
+      added.clear();
+      dropped = 0;
+      return terms.size();
+    }
+
+    PostingsPtr MemoryIndex::_get(const std::string &term) const {
+      auto it = std::lower_bound(terms.begin(), terms.end(), term);
+      if(it != terms.end() && *it == term) return postings[it - terms.begin()];
+      auto delta = added.find(term);
+      return delta != added.end() ? delta->second : nullptr;
+    }
+
+    PostingsPtr MemoryIndex::get(const std::string &term) const {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      return _get(term);
+    }
+
+    size_t MemoryIndex::size(void) const {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      return terms.size() - dropped + added.size();
+    }
+
+    void MemoryIndex::update(uint64_t post,
+        const std::unordered_set<std::string> &previous,
+        const std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>> &indexes) {
+      std::lock_guard<std::mutex> writeLock(writeMutex);
+
+      std::vector<std::string> touched(previous.begin(), previous.end());
+      for(auto &it : indexes) touched.push_back(it.first);
+      std::sort(touched.begin(), touched.end());
+      touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+      // Only writers modify the dictionary, so it can be read without the shared lock here
+      std::vector<PostingsPtr> updated(touched.size());
+      for(size_t k = 0; k < touched.size(); ++k) {
+        PostingsPtr original = _get(touched[k]);
+        auto occurs = indexes.find(touched[k]);
+        bool inserted = occurs == indexes.end();
+
+        auto result = std::make_shared<Postings>();
+        if(original) {
+          result->docs.reserve(original->docs.size() + 1);
+          result->bounds.reserve(original->docs.size() + 2);
+          for(size_t i = 0; i < original->docs.size(); ++i) {
+            if(original->docs[i] == post) continue;
+            if(!inserted && original->docs[i] > post) {
+              result->append(post, occurs->second);
+              inserted = true;
+            }
+            result->append(*original, i);
+          }
+        }
+        if(!inserted) result->append(post, occurs->second);
+
+        if(result->docs.size() > 0) updated[k] = result;
+      }
+
+      std::unique_lock<std::shared_mutex> lock(mutex);
+
+      // Terms of the dictionary keep their place even when dropped, new ones go to the delta
+      for(size_t k = 0; k < touched.size(); ++k) {
+        auto it = std::lower_bound(terms.begin(), terms.end(), touched[k]);
+        if(it != terms.end() && *it == touched[k]) {
+          PostingsPtr &current = postings[it - terms.begin()];
+          if(!current != !updated[k]) {
+            if(updated[k]) --dropped;
+            else ++dropped;
+          }
+          current = std::move(updated[k]);
+        } else if(updated[k]) added[touched[k]] = std::move(updated[k]);
+        else added.erase(touched[k]);
+      }
+
+      if(added.size() + dropped > std::max<size_t>(64, terms.size() / 16)) _compact();
+    }
+
+    // Merges the delta in and leaves the dropped terms out, once they are a sixteenth of the
+    // dictionary, so that building a new one is amortized over as many updates
+    void MemoryIndex::_compact(void) {
+      std::vector<std::string> mergedTerms;
+      std::vector<PostingsPtr> mergedPostings;
+      mergedTerms.reserve(terms.size() - dropped + added.size());
+      mergedPostings.reserve(terms.size() - dropped + added.size());
+
+      size_t i = 0;
+      auto delta = added.begin();
+      while(i < terms.size() || delta != added.end()) {
+        if(delta == added.end() || (i < terms.size() && terms[i] < delta->first)) {
+          if(postings[i]) {
+            mergedTerms.emplace_back(std::move(terms[i]));
+            mergedPostings.emplace_back(std::move(postings[i]));
+          }
+          ++i;
+        } else {
+          mergedTerms.emplace_back(delta->first);
+          mergedPostings.emplace_back(std::move(delta->second));
+          ++delta;
+        }
+      }
+
+      terms.swap(mergedTerms);
+      postings.swap(mergedPostings);
+      added.clear();
+      dropped = 0;
+    }
+  }
+}
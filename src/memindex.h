@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace C3 {
+  namespace Index {
+    // Flat postings of a single term, in ascending doc id order
+    struct Postings {
+      std::vector<uint64_t> docs;
+      std::vector<uint32_t> bounds; // Occurrences of docs[i] are [bounds[i], bounds[i+1])
+      std::vector<uint32_t> offsets;
+      std::vector<uint8_t> flags; // 1 if in the title
+      uint32_t maxTitle = 0;
+      uint32_t maxBody = 0;
+
+      static const size_t npos = -1;
+
+      Postings();
+      size_t find(uint64_t doc) const;
+      void tf(size_t i, uint32_t &title, uint32_t &body) const;
+      void append(uint64_t doc, const std::vector<std::pair<uint32_t, bool>> &occurs);
+      void append(const Postings &from, size_t i);
+    };
+
+    typedef std::shared_ptr<const Postings> PostingsPtr;
+
+    PostingsPtr make_postings(std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, bool>>> &&store);
+
+    // Sorted term dictionary over immutable postings. Readers hold on to the postings
+    // they got, while writers publish updated copies of the touched terms. Terms added
+    // since the dictionary was built sit in a small sorted delta, and dropped ones are left
+    // without postings, until there are enough of either to compact them into a new one
+    class MemoryIndex {
+    public:
+      size_t load(void);
+      PostingsPtr get(const std::string &term) const;
+      void update(uint64_t post,
+          const std::unordered_set<std::string> &previous,
+          const std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>> &indexes);
+      size_t size(void) const;
+
+    private:
+      mutable std::shared_mutex mutex;
+      std::mutex writeMutex;
+      std::vector<std::string> terms;
+      std::vector<PostingsPtr> postings; // Null for dropped terms
+      std::map<std::string, PostingsPtr> added;
+      size_t dropped = 0;
+
+      PostingsPtr _get(const std::string &term) const;
+      void _compact(void);
+    };
+  }
+}
@@ -0,0 +1,308 @@
+#include "query.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <sstream>
+
+namespace C3 {
+  namespace Index {
+    struct _token {
+      enum class Type {
+        Word, Phrase, Filter, // Filter: a word followed directly by a quoted value, e.g. tag:"a b"
+        Open, Close, And, Or, Not, Plus, Minus
+      };
+
+      Type type;
+      std::string value;
+    };
+
+    typedef std::vector<_token>::const_iterator _cursor;
+
+    std::string _collapse(const std::string &str) {
+      std::stringstream ss(str);
+      std::string part, result;
+      while(ss>>part) result += (result.size() > 0 ? " " : "") + part;
+      return result;
+    }
+
+    std::vector<_token> _lex(const std::string &target) {
+      std::vector<_token> tokens;
+      size_t i = 0;
+      while(i < target.size()) {
+        const char c = target[i];
+        if(std::isspace((unsigned char) c)) {
+          ++i;
+        } else if(c == '(' || c == ')') {
+          tokens.push_back(_token { c == '(' ? _token::Type::Open : _token::Type::Close, "" });
+          ++i;
+        } else if(c == '"') {
+          size_t end = target.find('"', i + 1);
+          if(end == std::string::npos) end = target.size();
+
+          std::string phrase = _collapse(target.substr(i + 1, end - i - 1));
+          if(phrase.size() > 0) tokens.push_back(_token { _token::Type::Phrase, phrase });
+          i = end + 1;
+        } else if((c == '-' || c == '+') && i + 1 < target.size() && !std::isspace((unsigned char) target[i + 1])) {
+          tokens.push_back(_token { c == '-' ? _token::Type::Minus : _token::Type::Plus, "" });
+          ++i;
+        } else {
+          size_t end = i;
+          while(end < target.size() && !std::isspace((unsigned char) target[end])
+              && target[end] != '"' && target[end] != '(' && target[end] != ')') ++end;
+          std::string word = target.substr(i, end - i);
+          i = end;
+
+          if(word == "AND") tokens.push_back(_token { _token::Type::And, "" });
+          else if(word == "OR") tokens.push_back(_token { _token::Type::Or, "" });
+          else if(word == "NOT") tokens.push_back(_token { _token::Type::Not, "" });
+          else if(word.back() == ':' && i < target.size() && target[i] == '"') {
+            size_t close = target.find('"', i + 1);
+            if(close == std::string::npos) close = target.size();
+            tokens.push_back(_token { _token::Type::Filter, word + _collapse(target.substr(i + 1, close - i - 1)) });
+            i = close + 1;
+          } else tokens.push_back(_token { _token::Type::Word, word });
+        }
+      }
+      return tokens;
+    }
+
+    // Milliseconds since epoch, from either a plain number or YYYY-MM-DD (UTC)
+    bool _parse_time(const std::string &str, uint64_t &ms) {
+      const char *begin = str.data(), *end = str.data() + str.size();
+      if(std::all_of(begin, end, [](char c) { return std::isdigit((unsigned char) c); }))
+        return str.size() > 0 && std::from_chars(begin, end, ms).ec == std::errc();
+
+      int64_t y = 0;
+      unsigned m = 0, d = 0;
+      if(str.size() != 10 || str[4] != '-' || str[7] != '-'
+          || std::from_chars(begin, begin + 4, y).ptr != begin + 4
+          || std::from_chars(begin + 5, begin + 7, m).ptr != begin + 7
+          || std::from_chars(begin + 8, end, d).ptr != end
+          || m < 1 || m > 12 || d < 1 || d > 31)
+        return false;
+
+      // Days from civil date
+      y -= m <= 2;
+      const int64_t era = y / 400;
+      const unsigned yoe = y - era * 400;
+      const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+      const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+      const int64_t days = era * 146097 + doe - 719468;
+      if(days < 0) return false;
+
+      ms = days * 86400000ull;
+      return true;
+    }
+
+    QueryNode _node(QueryNode::Type type) {
+      QueryNode node;
+      node.type = type;
+      return node;
+    }
+
+    QueryNode _text(const std::string &value, bool phrase) {
+      QueryNode node = _node(QueryNode::Type::Text);
+      node.value = value;
+      node.phrase = phrase;
+      return node;
+    }
+
+    // tag:<name>, before:<time> or after:<time>. Anything else is plain text
+    QueryNode _filter(const std::string &word) {
+      const size_t colon = word.find(':');
+      if(colon != std::string::npos && colon + 1 < word.size()) {
+        const std::string kind = word.substr(0, colon), value = word.substr(colon + 1);
+
+        QueryNode node = _node(QueryNode::Type::Tag);
+        if(kind == "tag") {
+          node.value = value;
+          return node;
+        }
+
+        uint64_t ms;
+        if((kind == "before" || kind == "after") && _parse_time(value, ms)) {
+          node.type = QueryNode::Type::Range;
+          if(kind == "before") node.to = ms;
+          else node.from = ms;
+          return node;
+        }
+      }
+
+      return _text(word, false);
+    }
+
+    bool _group(_cursor &it, _cursor end, bool nested, QueryNode &out);
+    bool _or(_cursor &it, _cursor end, QueryNode &out);
+
+    bool _unary(_cursor &it, _cursor end, QueryNode &out) {
+      while(it != end) {
+        switch((it++)->type) {
+          case _token::Type::Word:
+          case _token::Type::Filter:
+            out = _filter(std::prev(it)->value);
+            return true;
+          case _token::Type::Phrase:
+            out = _text(std::prev(it)->value, true);
+            return true;
+          case _token::Type::Open:
+            if(_group(it, end, true, out)) return true;
+            break;
+          case _token::Type::Not:
+          case _token::Type::Minus: {
+            QueryNode child;
+            if(!_unary(it, end, child)) return false;
+            out = _node(QueryNode::Type::Not);
+            out.children.emplace_back(std::move(child));
+            return true;
+          }
+          case _token::Type::Plus:
+            if(!_unary(it, end, out)) return false;
+            out.occur = QueryNode::Occur::Must;
+            return true;
+          case _token::Type::Close:
+            // Closes the enclosing group, if any
+            --it;
+            return false;
+          default:
+            // Operator without a left operand
+            break;
+        }
+      }
+      return false;
+    }
+
+    bool _and(_cursor &it, _cursor end, QueryNode &out) {
+      if(!_unary(it, end, out)) return false;
+
+      while(it != end && it->type == _token::Type::And) {
+        QueryNode right;
+        if(!_unary(++it, end, right)) break;
+
+        if(out.type != QueryNode::Type::And) {
+          QueryNode left = std::move(out);
+          out = _node(QueryNode::Type::And);
+          out.children.emplace_back(std::move(left));
+        }
+        out.children.emplace_back(std::move(right));
+      }
+      return true;
+    }
+
+    bool _or(_cursor &it, _cursor end, QueryNode &out) {
+      if(!_and(it, end, out)) return false;
+
+      while(it != end && it->type == _token::Type::Or) {
+        QueryNode right;
+        if(!_and(++it, end, right)) break;
+
+        if(out.type != QueryNode::Type::Or) {
+          QueryNode left = std::move(out);
+          out = _node(QueryNode::Type::Or);
+          out.children.emplace_back(std::move(left));
+        }
+        out.children.emplace_back(std::move(right));
+      }
+      return true;
+    }
+
+    bool _has_text(const QueryNode &node) {
+      if(node.type == QueryNode::Type::Text) return true;
+      return std::any_of(node.children.begin(), node.children.end(), _has_text);
+    }
+
+    // Items are joined implicitly: bare ones are optional, at least one of them must match
+    // unless some item is required. Filters, i.e. items without any text, are always
+    // required, "-" or NOT excludes
+    bool _group(_cursor &it, _cursor end, bool nested, QueryNode &out) {
+      out = _node(QueryNode::Type::Group);
+
+      while(it != end) {
+        if(it->type == _token::Type::Close) {
+          ++it;
+          if(nested) break;
+          continue;
+        }
+
+        QueryNode item;
+        if(!_or(it, end, item)) {
+          // Dangling operator
+          if(it != end && it->type != _token::Type::Close) ++it;
+          continue;
+        }
+
+        if(item.type == QueryNode::Type::Not) {
+          QueryNode child = std::move(item.children[0]);
+          item = std::move(child);
+          item.occur = QueryNode::Occur::MustNot;
+        } else if(!_has_text(item))
+          item.occur = QueryNode::Occur::Must;
+        out.children.emplace_back(std::move(item));
+      }
+
+      if(out.children.size() == 0) return false;
+      // Parentheses around a single item change nothing, unless they scope a "+" or "-"
+      const QueryNode::Occur occur = out.children[0].occur;
+      if(nested && out.children.size() == 1
+          && (occur == QueryNode::Occur::Should || (occur == QueryNode::Occur::Must && !_has_text(out.children[0])))) {
+        QueryNode only = std::move(out.children[0]);
+        out = std::move(only);
+        out.occur = QueryNode::Occur::Should;
+      }
+      return true;
+    }
+
+    QueryNode parse_query(const std::string &target) {
+      const auto tokens = _lex(target);
+      _cursor it = tokens.begin();
+
+      QueryNode root;
+      if(!_group(it, tokens.end(), false, root)) root = _node(QueryNode::Type::Group);
+      return root;
+    }
+
+    std::string _sorted_join(std::vector<std::string> &&parts, const std::string &sep) {
+      std::sort(parts.begin(), parts.end());
+      parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+
+      std::string result;
+      for(auto &part : parts) {
+        if(result.size() > 0) result += sep;
+        result += part;
+      }
+      return result;
+    }
+
+    std::string _print(const QueryNode &node, bool nested) {
+      std::vector<std::string> parts;
+      switch(node.type) {
+        case QueryNode::Type::Text:
+          return node.phrase ? '"' + node.value + '"' : node.value;
+        case QueryNode::Type::Tag:
+          if(node.value.find_first_of(" ()") != std::string::npos) return "tag:\"" + node.value + '"';
+          return "tag:" + node.value;
+        case QueryNode::Type::Range:
+          return node.to != UINT64_MAX ? "before:" + std::to_string(node.to) : "after:" + std::to_string(node.from);
+        case QueryNode::Type::Not:
+          return "NOT " + _print(node.children[0], true);
+        case QueryNode::Type::And:
+        case QueryNode::Type::Or:
+          for(auto &child : node.children) parts.push_back(_print(child, true));
+          return '(' + _sorted_join(std::move(parts), node.type == QueryNode::Type::And ? " AND " : " OR ") + ')';
+        case QueryNode::Type::Group:
+          for(auto &child : node.children) {
+            if(child.occur == QueryNode::Occur::MustNot) parts.push_back('-' + _print(child, true));
+            else if(child.occur == QueryNode::Occur::Must && _has_text(child)) parts.push_back('+' + _print(child, true));
+            else parts.push_back(_print(child, true));
+          }
+          if(nested) return '(' + _sorted_join(std::move(parts), " ") + ')';
+          return _sorted_join(std::move(parts), " ");
+      }
+      return "";
+    }
+
+    std::string print_query(const QueryNode &node) {
+      return _print(node, false);
+    }
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace C3 {
+  namespace Index {
+    struct QueryNode {
+      enum class Type {
+        Group, // Implicitly joined items
+        Or, And, Not,
+        Text, // A space-separated segment, or a quoted phrase
+        Tag, Range
+      };
+
+      // How an item of a group takes part in it
+      enum class Occur {
+        Should, Must, MustNot
+      };
+
+      Type type = Type::Group;
+      Occur occur = Occur::Should;
+      std::string value;
+      bool phrase = false;
+      uint64_t from = 0; // Range: [from, to)
+      uint64_t to = UINT64_MAX;
+      std::vector<QueryNode> children;
+    };
+
+    QueryNode parse_query(const std::string &target);
+
+    // Canonical form: equivalent queries print the same
+    std::string print_query(const QueryNode &node);
+  }
+}
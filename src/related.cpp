@@ -0,0 +1,97 @@
+#include "related.h"
+
+#include <algorithm>
+
+namespace C3 {
+  namespace Index {
+    RelatedIndex::RelatedIndex(size_t depth) : depth(depth) { }
+
+    void RelatedIndex::build(std::unordered_map<uint64_t, PostKeywords> &&built) {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      vectors = std::move(built);
+      postings.clear();
+      for(auto &it : vectors)
+        for(auto &keyword : it.second) postings[keyword.first].emplace_back(it.first, keyword.second);
+
+      std::lock_guard<std::mutex> cacheLock(cacheMutex);
+      cache.clear();
+    }
+
+    // Neighbours of the posts sharing a keyword may change along with any of them
+    void RelatedIndex::_evict_sharing(const PostKeywords &keywords) {
+      std::lock_guard<std::mutex> cacheLock(cacheMutex);
+      if(cache.empty()) return;
+      for(auto &keyword : keywords) {
+        auto it = postings.find(keyword.first);
+        if(it == postings.end()) continue;
+        for(auto &entry : it->second) cache.erase(entry.first);
+      }
+    }
+
+    void RelatedIndex::update(uint64_t post, PostKeywords &&keywords) {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      auto previous = vectors.find(post);
+      if(previous != vectors.end()) {
+        _evict_sharing(previous->second);
+        for(auto &keyword : previous->second) {
+          auto &list = postings[keyword.first];
+          auto entry = std::find_if(list.begin(), list.end(),
+              [post](const std::pair<uint64_t, double> &e) { return e.first == post; });
+          if(entry != list.end()) {
+            *entry = list.back();
+            list.pop_back();
+          }
+          if(list.empty()) postings.erase(keyword.first);
+        }
+        vectors.erase(previous);
+      }
+
+      {
+        std::lock_guard<std::mutex> cacheLock(cacheMutex);
+        cache.erase(post);
+      }
+      if(keywords.empty()) return;
+
+      for(auto &keyword : keywords) postings[keyword.first].emplace_back(post, keyword.second);
+      _evict_sharing(keywords);
+      vectors.emplace(post, std::move(keywords));
+    }
+
+    // Vectors have unit length, so the dot products summed over the shared keywords are
+    // cosine similarities. Ties go to newer posts
+    RelatedIndex::value_type RelatedIndex::related(uint64_t post) {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      {
+        std::lock_guard<std::mutex> cacheLock(cacheMutex);
+        auto cached = cache.find(post);
+        if(cached != cache.end()) return cached->second;
+      }
+
+      auto result = std::make_shared<RelatedPosts>();
+      auto own = vectors.find(post);
+      if(own != vectors.end()) {
+        std::unordered_map<uint64_t, double> scores;
+        for(auto &keyword : own->second)
+          for(auto &entry : postings.at(keyword.first))
+            if(entry.first != post) scores[entry.first] += keyword.second * entry.second;
+
+        result->assign(scores.begin(), scores.end());
+        auto cmp = [](const std::pair<uint64_t, double> &a, const std::pair<uint64_t, double> &b) {
+          return a.second != b.second ? a.second > b.second : a.first > b.first;
+        };
+        const size_t kept = std::min(depth, result->size());
+        std::partial_sort(result->begin(), result->begin() + kept, result->end(), cmp);
+        result->resize(kept);
+      }
+
+      // Updates wait for the shared lock, so nothing computed here is outdated yet
+      std::lock_guard<std::mutex> cacheLock(cacheMutex);
+      return cache.emplace(post, std::move(result)).first->second;
+    }
+
+    size_t RelatedIndex::size(void) const {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      return vectors.size();
+    }
+  }
+}
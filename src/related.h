@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "indexer.h"
+
+namespace C3 {
+  namespace Index {
+    // Keyword vectors of every post, inverted by keyword. The neighbours of a post are found
+    // through the posts sharing its keywords, and kept until one of those posts changes
+    class RelatedIndex {
+    public:
+      typedef std::shared_ptr<const RelatedPosts> value_type;
+
+      RelatedIndex(size_t depth); // Neighbours kept per post
+
+      void build(std::unordered_map<uint64_t, PostKeywords> &&vectors);
+      void update(uint64_t post, PostKeywords &&keywords); // Removes the post if empty
+      value_type related(uint64_t post);
+      size_t size(void) const;
+
+    private:
+      const size_t depth;
+
+      mutable std::shared_mutex mutex; // Exclusive for updates
+      std::unordered_map<uint64_t, PostKeywords> vectors;
+      std::unordered_map<std::string, std::vector<std::pair<uint64_t, double>>> postings;
+
+      std::mutex cacheMutex;
+      std::unordered_map<uint64_t, value_type> cache;
+
+      void _evict_sharing(const PostKeywords &keywords);
+    };
+  }
+}
@@ -0,0 +1,169 @@
+#include "searchcache.h"
+
+#include <algorithm>
+
+namespace C3 {
+  namespace Index {
+    SearchCache::SearchCache(size_t budget) : shardBudget(budget / shard_count), _generation(0) { }
+
+    SearchCache::Shard &SearchCache::_shard(const std::string &key) {
+      return shards[std::hash<std::string>()(key) % shard_count];
+    }
+
+    SearchCache::value_type SearchCache::get(const std::string &key) {
+      Shard &shard = _shard(key);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      auto it = shard.index.find(key);
+      if(it == shard.index.end()) return nullptr;
+
+      Entry &entry = shard.slots[it->second];
+      entry.referenced = true;
+      return entry.value;
+    }
+
+    void SearchCache::put(const std::string &key, value_type value, uint64_t generation) {
+      const size_t bytes = key.size() + sizeof(Entry) + value->bytes();
+      if(bytes > shardBudget) return;
+
+      Shard &shard = _shard(key);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if(generation != _generation) return;
+
+      auto existing = shard.index.find(key);
+      if(existing != shard.index.end()) _remove(shard, existing->second);
+
+      while(shard.bytes + bytes > shardBudget) _evict_one(shard);
+
+      size_t slot;
+      if(shard.freeSlots.size() > 0) {
+        slot = shard.freeSlots.back();
+        shard.freeSlots.pop_back();
+      } else {
+        slot = shard.slots.size();
+        shard.slots.emplace_back();
+      }
+
+      shard.slots[slot] = Entry { key, std::move(value), bytes, true };
+      shard.index.emplace(key, slot);
+      shard.bytes += bytes;
+    }
+
+    uint64_t SearchCache::generation(void) const {
+      return _generation;
+    }
+
+    void SearchCache::_remove(Shard &shard, size_t slot) {
+      Entry &entry = shard.slots[slot];
+      shard.bytes -= entry.bytes;
+      shard.index.erase(entry.key);
+      entry = Entry { std::string(), nullptr, 0, false };
+      shard.freeSlots.push_back(slot);
+    }
+
+    void SearchCache::_evict_one(Shard &shard) {
+      // Referenced entries get a second chance, so this ends within two sweeps
+      while(true) {
+        if(shard.hand >= shard.slots.size()) shard.hand = 0;
+        const size_t slot = shard.hand++;
+
+        Entry &entry = shard.slots[slot];
+        if(!entry.value) continue;
+        if(entry.referenced) entry.referenced = false;
+        else return _remove(shard, slot);
+      }
+    }
+
+    void SearchCache::clear(void) {
+      ++_generation;
+      for(auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.slots.clear();
+        shard.freeSlots.clear();
+        shard.index.clear();
+        shard.hand = 0;
+        shard.bytes = 0;
+      }
+    }
+
+    void SearchCache::evict(uint64_t post, const std::unordered_set<std::string> &words) {
+      ++_generation;
+      for(auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for(size_t slot = 0; slot < shard.slots.size(); ++slot) {
+          const value_type &value = shard.slots[slot].value;
+          if(!value) continue;
+
+          bool stale = !value->anchored || std::find(value->posts.begin(), value->posts.end(), post) != value->posts.end();
+          for(auto term = value->terms.begin(); !stale && term != value->terms.end(); ++term)
+            stale = words.count(*term) > 0;
+
+          if(stale) _remove(shard, slot);
+        }
+      }
+    }
+
+    SegmentCache::SegmentCache(size_t capacity) : shardCapacity((capacity + shard_count - 1) / shard_count), _generation(0) { }
+
+    SegmentCache::Shard &SegmentCache::_shard(const std::string &key) {
+      return shards[std::hash<std::string>()(key) % shard_count];
+    }
+
+    SegmentCache::value_type SegmentCache::get(const std::string &key) {
+      Shard &shard = _shard(key);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      auto it = shard.index.find(key);
+      if(it == shard.index.end()) return nullptr;
+
+      Entry &entry = shard.slots[it->second];
+      entry.referenced = true;
+      return entry.value;
+    }
+
+    void SegmentCache::put(const std::string &key, value_type value, uint64_t generation) {
+      if(shardCapacity == 0) return;
+
+      Shard &shard = _shard(key);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if(generation != _generation) return;
+
+      auto existing = shard.index.find(key);
+      if(existing != shard.index.end()) {
+        shard.slots[existing->second].value = std::move(value);
+        return;
+      }
+
+      size_t slot = shard.slots.size();
+      if(slot < shardCapacity) shard.slots.emplace_back();
+      else {
+        // Entries are never removed one by one, so once full the hand always finds a victim
+        while(true) {
+          if(shard.hand >= shard.slots.size()) shard.hand = 0;
+          slot = shard.hand++;
+          Entry &entry = shard.slots[slot];
+          if(entry.referenced) entry.referenced = false;
+          else break;
+        }
+        shard.index.erase(shard.slots[slot].key);
+      }
+
+      shard.slots[slot] = Entry { key, std::move(value), true };
+      shard.index.emplace(key, slot);
+    }
+
+    uint64_t SegmentCache::generation(void) const {
+      return _generation;
+    }
+
+    void SegmentCache::clear(void) {
+      ++_generation;
+      for(auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.slots.clear();
+        shard.index.clear();
+        shard.hand = 0;
+      }
+    }
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "indexer.h"
+
+namespace C3 {
+  namespace Index {
+    // Sharded CLOCK cache of search results, bounded by the bytes held by its entries
+    class SearchCache {
+    public:
+      typedef std::shared_ptr<const SearchResult> value_type;
+
+      SearchCache(size_t budget);
+
+      value_type get(const std::string &key);
+
+      // Dropped if the cache was invalidated since generation() was read
+      void put(const std::string &key, value_type value, uint64_t generation);
+      uint64_t generation(void) const;
+
+      void clear(void);
+      void evict(uint64_t post, const std::unordered_set<std::string> &words);
+
+    private:
+      struct Entry {
+        std::string key;
+        value_type value;
+        size_t bytes;
+        bool referenced;
+      };
+
+      struct Shard {
+        std::mutex mutex;
+        std::vector<Entry> slots;
+        std::vector<size_t> freeSlots;
+        std::unordered_map<std::string, size_t> index;
+        size_t hand = 0;
+        size_t bytes = 0;
+      };
+
+      static const size_t shard_count = 16;
+
+      Shard shards[shard_count];
+      size_t shardBudget;
+      std::atomic<uint64_t> _generation;
+
+      Shard &_shard(const std::string &key);
+      void _remove(Shard &shard, size_t slot);
+      void _evict_one(Shard &shard);
+    };
+
+    // Sharded CLOCK cache of the words each space-separated part of a query is cut into,
+    // bounded by its number of entries
+    class SegmentCache {
+    public:
+      typedef std::shared_ptr<const std::vector<std::string>> value_type;
+
+      SegmentCache(size_t capacity);
+
+      value_type get(const std::string &key);
+
+      // Dropped if the cache was cleared since generation() was read
+      void put(const std::string &key, value_type value, uint64_t generation);
+      uint64_t generation(void) const;
+
+      void clear(void);
+
+    private:
+      struct Entry {
+        std::string key;
+        value_type value;
+        bool referenced;
+      };
+
+      struct Shard {
+        std::mutex mutex;
+        std::vector<Entry> slots;
+        std::unordered_map<std::string, size_t> index;
+        size_t hand = 0;
+      };
+
+      static const size_t shard_count = 16;
+
+      Shard shards[shard_count];
+      size_t shardCapacity;
+      std::atomic<uint64_t> _generation;
+
+      Shard &_shard(const std::string &key);
+    };
+  }
+}
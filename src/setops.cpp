@@ -0,0 +1,365 @@
+#include "setops.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SETOPS_X86
+#endif
+
+namespace C3 {
+  namespace SetOps {
+    enum class _Isa {
+      Scalar, SSE42, AVX2
+    };
+
+    _Isa _detect(void) {
+#ifdef SETOPS_X86
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx2")) return _Isa::AVX2;
+      if(__builtin_cpu_supports("sse4.2")) return _Isa::SSE42;
+#endif
+      return _Isa::Scalar;
+    }
+
+    _Isa _isa(void) {
+      static const _Isa detected = _detect();
+      return detected;
+    }
+
+    // Lists at least this many times longer than the other one are galloped through
+    const size_t skew = 32;
+
+    // Keeps a[n] where bit n of keep is set, without branching
+    template<typename T>
+    inline size_t _emit(const T *a, size_t width, uint32_t keep, T *out) {
+      size_t k = 0;
+      for(size_t n = 0; n < width; ++n) {
+        out[k] = a[n];
+        k += (keep >> n) & 1;
+      }
+      return k;
+    }
+
+    // Emits the elements of a that are in b, or with Difference, those that are not.
+    // Bits of matched mark leading elements of a already known to be in b
+    template<bool Difference, typename T>
+    size_t _merge_scalar(const T *a, size_t na, const T *b, size_t nb, T *out, uint32_t matched) {
+      size_t j = 0, k = 0;
+      for(size_t i = 0; i < na; ++i, matched >>= 1) {
+        bool found = matched & 1;
+        if(!found) {
+          while(j < nb && b[j] < a[i]) ++j;
+          found = j < nb && b[j] == a[i];
+        }
+        out[k] = a[i];
+        k += found != Difference;
+      }
+      return k;
+    }
+
+    // For a much shorter than b
+    template<bool Difference, typename T>
+    size_t _merge_gallop(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      const T *cursor = b, *end = b + nb;
+      size_t k = 0;
+      for(size_t i = 0; i < na; ++i) {
+        cursor = gallop(cursor, end, a[i]);
+        out[k] = a[i];
+        k += (cursor != end && *cursor == a[i]) != Difference;
+      }
+      return k;
+    }
+
+    // a minus a much shorter b: copies the runs between elements of b
+    template<typename T>
+    size_t _subtract_sparse(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      const T *cursor = a, *end = a + na;
+      T *written = out;
+      for(size_t j = 0; j < nb && cursor != end; ++j) {
+        const T *next = gallop(cursor, end, b[j]);
+        written = std::copy(cursor, next, written);
+        cursor = next != end && *next == b[j] ? next + 1 : next;
+      }
+      return std::copy(cursor, end, written) - out;
+    }
+
+#ifdef SETOPS_X86
+    // Bit n is set where a[n] equals any element of the block of b, by comparing
+    // against every rotation of it
+    __attribute__((target("avx2")))
+    inline uint32_t _matches_avx2(const uint64_t *a, const uint64_t *b) {
+      const __m256i va = _mm256_loadu_si256((const __m256i *) a);
+      const __m256i vb = _mm256_loadu_si256((const __m256i *) b);
+      __m256i eq = _mm256_cmpeq_epi64(va, vb);
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)));
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+      return _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    }
+
+    __attribute__((target("avx2")))
+    inline uint32_t _matches_avx2(const uint32_t *a, const uint32_t *b) {
+      const __m256i va = _mm256_loadu_si256((const __m256i *) a);
+      const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+      __m256i vb = _mm256_loadu_si256((const __m256i *) b);
+      __m256i eq = _mm256_cmpeq_epi32(va, vb);
+      for(int r = 1; r < 8; ++r) {
+        vb = _mm256_permutevar8x32_epi32(vb, rotate);
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+      }
+      return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+    }
+
+    __attribute__((target("sse4.2")))
+    inline uint32_t _matches_sse(const uint64_t *a, const uint64_t *b) {
+      const __m128i va = _mm_loadu_si128((const __m128i *) a);
+      const __m128i vb = _mm_loadu_si128((const __m128i *) b);
+      const __m128i eq = _mm_or_si128(_mm_cmpeq_epi64(va, vb), _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb, 0x4e)));
+      return _mm_movemask_pd(_mm_castsi128_pd(eq));
+    }
+
+    __attribute__((target("sse4.2")))
+    inline uint32_t _matches_sse(const uint32_t *a, const uint32_t *b) {
+      const __m128i va = _mm_loadu_si128((const __m128i *) a);
+      const __m128i vb = _mm_loadu_si128((const __m128i *) b);
+      __m128i eq = _mm_cmpeq_epi32(va, vb);
+      eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39)));
+      eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4e)));
+      eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93)));
+      return _mm_movemask_ps(_mm_castsi128_ps(eq));
+    }
+
+    // Compares blocks of a register's width: 4 or 8 lanes with AVX2, 2 or 4 with SSE.
+    // A block of a is emitted once the block of b reaches past it, so it has met every
+    // equal element of b
+    template<bool Difference, typename T>
+    __attribute__((target("avx2")))
+    size_t _merge_avx2(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      const size_t lanes = 32 / sizeof(T);
+      size_t i = 0, j = 0, k = 0;
+      uint32_t matched = 0;
+      while(i + lanes <= na && j + lanes <= nb) {
+        matched |= _matches_avx2(a + i, b + j);
+
+        const T amax = a[i + lanes - 1], bmax = b[j + lanes - 1];
+        if(amax <= bmax) {
+          k += _emit(a + i, lanes, Difference ? ~matched : matched, out + k);
+          matched = 0;
+          i += lanes;
+        }
+        if(bmax <= amax) j += lanes;
+      }
+      return k + _merge_scalar<Difference>(a + i, na - i, b + j, nb - j, out + k, matched);
+    }
+
+    template<bool Difference, typename T>
+    __attribute__((target("sse4.2")))
+    size_t _merge_sse(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      const size_t lanes = 16 / sizeof(T);
+      size_t i = 0, j = 0, k = 0;
+      uint32_t matched = 0;
+      while(i + lanes <= na && j + lanes <= nb) {
+        matched |= _matches_sse(a + i, b + j);
+
+        const T amax = a[i + lanes - 1], bmax = b[j + lanes - 1];
+        if(amax <= bmax) {
+          k += _emit(a + i, lanes, Difference ? ~matched : matched, out + k);
+          matched = 0;
+          i += lanes;
+        }
+        if(bmax <= amax) j += lanes;
+      }
+      return k + _merge_scalar<Difference>(a + i, na - i, b + j, nb - j, out + k, matched);
+    }
+#endif
+
+    template<bool Difference, typename T>
+    size_t _merge(const T *a, size_t na, const T *b, size_t nb, T *out) {
+#ifdef SETOPS_X86
+      switch(_isa()) {
+        case _Isa::AVX2:
+          return _merge_avx2<Difference>(a, na, b, nb, out);
+        case _Isa::SSE42:
+          return _merge_sse<Difference>(a, na, b, nb, out);
+        default:
+          break;
+      }
+#endif
+      return _merge_scalar<Difference>(a, na, b, nb, out, 0);
+    }
+
+    template<typename T>
+    size_t _intersect(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      if(na > nb) {
+        std::swap(a, b);
+        std::swap(na, nb);
+      }
+      if(na == 0) return 0;
+      if(nb / na >= skew) return _merge_gallop<false>(a, na, b, nb, out);
+      return _merge<false>(a, na, b, nb, out);
+    }
+
+    template<typename T>
+    size_t _subtract(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      if(na == 0) return 0;
+      if(nb == 0) {
+        std::memcpy(out, a, na * sizeof(T));
+        return na;
+      }
+      if(nb / na >= skew) return _merge_gallop<true>(a, na, b, nb, out);
+      if(na / nb >= skew) return _subtract_sparse(a, na, b, nb, out);
+      return _merge<true>(a, na, b, nb, out);
+    }
+
+    // Stays a scalar merge. Every element of both inputs is written, so there are no blocks
+    // to skip as in intersect and subtract, and a vector merge would need a sorting network
+    // per block and then another pass to drop duplicates. This branchless merge already
+    // does one compare and one store per element
+    template<typename T>
+    size_t _unite(const T *a, size_t na, const T *b, size_t nb, T *out) {
+      size_t i = 0, j = 0, k = 0;
+      while(i < na && j < nb) {
+        const T x = a[i], y = b[j];
+        out[k++] = x < y ? x : y;
+        i += x <= y;
+        j += y <= x;
+      }
+      std::memcpy(out + k, a + i, (na - i) * sizeof(T));
+      k += na - i;
+      std::memcpy(out + k, b + j, (nb - j) * sizeof(T));
+      return k + nb - j;
+    }
+
+    size_t intersect(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+      return _intersect(a, na, b, nb, out);
+    }
+
+    size_t intersect(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *out) {
+      return _intersect(a, na, b, nb, out);
+    }
+
+    size_t subtract(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+      return _subtract(a, na, b, nb, out);
+    }
+
+    size_t subtract(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *out) {
+      return _subtract(a, na, b, nb, out);
+    }
+
+    size_t unite(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+      return _unite(a, na, b, nb, out);
+    }
+
+    size_t unite(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *out) {
+      return _unite(a, na, b, nb, out);
+    }
+
+    std::vector<uint64_t> intersect(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b) {
+      std::vector<uint64_t> result(std::min(a.size(), b.size()));
+      result.resize(intersect(a.data(), a.size(), b.data(), b.size(), result.data()));
+      return result;
+    }
+
+    std::vector<uint64_t> subtract(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b) {
+      std::vector<uint64_t> result(a.size());
+      result.resize(subtract(a.data(), a.size(), b.data(), b.size(), result.data()));
+      return result;
+    }
+
+    std::vector<uint64_t> unite(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b) {
+      if(a.size() == 0) return b;
+      if(b.size() == 0) return a;
+      std::vector<uint64_t> result(a.size() + b.size());
+      result.resize(unite(a.data(), a.size(), b.data(), b.size(), result.data()));
+      return result;
+    }
+
+    template<typename T>
+    const T *_gallop(const T *begin, const T *end, T target) {
+      size_t step = 1;
+      while(begin + step < end && begin[step] < target) {
+        begin += step;
+        step <<= 1;
+      }
+      return std::lower_bound(begin, std::min(begin + step + 1, end), target);
+    }
+
+    const uint32_t *gallop(const uint32_t *begin, const uint32_t *end, uint32_t target) {
+      return _gallop(begin, end, target);
+    }
+
+    const uint64_t *gallop(const uint64_t *begin, const uint64_t *end, uint64_t target) {
+      return _gallop(begin, end, target);
+    }
+
+    const char *isa(void) {
+      switch(_isa()) {
+        case _Isa::AVX2:
+          return "avx2";
+        case _Isa::SSE42:
+          return "sse4.2";
+        default:
+          return "scalar";
+      }
+    }
+
+    template<typename T>
+    std::vector<T> _random_set(std::mt19937_64 &gen, size_t size, T range) {
+      std::uniform_int_distribution<T> dist(0, range);
+      std::vector<T> set(size);
+      for(auto &id : set) id = dist(gen);
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+      return set;
+    }
+
+    template<typename T>
+    void _benchmark(uint32_t rounds, std::mt19937_64 &gen) {
+      typedef std::chrono::steady_clock clock;
+      typedef size_t (*kernel)(const T *, size_t, const T *, size_t, T *);
+
+      for(auto sizes : { std::make_pair(100000, 100000), std::make_pair(100000, 10000), std::make_pair(1000000, 1000) }) {
+        const auto a = _random_set<T>(gen, sizes.first, 4000000), b = _random_set<T>(gen, sizes.second, 4000000);
+        std::vector<T> expected(a.size()), actual(a.size());
+
+        auto run = [&](const char *name, kernel scalar, kernel dispatched) {
+          size_t n = 0, m = 0;
+          auto scalarStart = clock::now();
+          for(uint32_t i = 0; i < rounds; ++i) n = scalar(a.data(), a.size(), b.data(), b.size(), expected.data());
+          auto scalarTime = clock::now() - scalarStart;
+
+          auto start = clock::now();
+          for(uint32_t i = 0; i < rounds; ++i) m = dispatched(a.data(), a.size(), b.data(), b.size(), actual.data());
+          auto time = clock::now() - start;
+
+          auto ms = [rounds](clock::duration d) {
+            return std::chrono::duration<double, std::milli>(d).count() / rounds;
+          };
+          const bool same = n == m && std::equal(expected.begin(), expected.begin() + n, actual.begin());
+          std::cout<<a.size()<<" "<<name<<" "<<b.size()<<" ("<<sizeof(T) * 8<<"-bit): scalar "<<ms(scalarTime)<<" ms, "
+            <<isa()<<" "<<ms(time)<<" ms"<<(same ? "" : " (MISMATCH)")<<std::endl;
+        };
+
+        run("intersect", [](const T *a, size_t na, const T *b, size_t nb, T *out) {
+          return _merge_scalar<false>(a, na, b, nb, out, 0);
+        }, _intersect<T>);
+        run("subtract", [](const T *a, size_t na, const T *b, size_t nb, T *out) {
+          return _merge_scalar<true>(a, na, b, nb, out, 0);
+        }, _subtract<T>);
+      }
+    }
+
+    void benchmark(uint32_t rounds) {
+      std::mt19937_64 gen(42);
+
+      std::cout<<"Kernels: "<<isa()<<std::endl;
+      _benchmark<uint64_t>(rounds, gen);
+      _benchmark<uint32_t>(rounds, gen);
+    }
+  }
+}
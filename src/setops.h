@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace C3 {
+  // Operations over sorted arrays without duplicates, e.g. post ids.
+  // Vectorized with SSE4.2 or AVX2 when the CPU supports it
+  namespace SetOps {
+    // out must have room for min(na, nb), na and na + nb elements respectively
+    size_t intersect(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+    size_t intersect(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *out);
+    size_t subtract(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+    size_t subtract(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *out);
+    size_t unite(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+    size_t unite(const uint64_t *a, size_t na, const uint64_t *b, size_t nb, uint64_t *out);
+
+    std::vector<uint64_t> intersect(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b);
+    std::vector<uint64_t> subtract(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b);
+    std::vector<uint64_t> unite(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b);
+
+    // First element not less than target, probing exponentially from begin
+    const uint32_t *gallop(const uint32_t *begin, const uint32_t *end, uint32_t target);
+    const uint64_t *gallop(const uint64_t *begin, const uint64_t *end, uint64_t target);
+
+    const char *isa(void);
+    void benchmark(uint32_t rounds);
+  }
+}
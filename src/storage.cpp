@@ -2,14 +2,26 @@
 #include "util.h"
 #include "mapper.h"
 #include "saxreader.h"
+#include "bitmap.h"
 
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <cassert>
+#include <algorithm>
 #include <cstdarg>
 #include <charconv>
 #include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <fstream>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <deque>
+#include <optional>
+#include <exception>
+#include <condition_variable>
 #include <leveldb/db.h>
 #include <leveldb/cache.h>
 #include <leveldb/write_batch.h>
@@ -93,13 +105,44 @@ namespace C3 {
   CommaSepComparator userCmp({ Limitor::Less, Limitor::Less });
   CommaSepComparator wordsCmp({ Limitor::Less });
   CommaSepComparator indexCmp({ Limitor::Less, Limitor::Greater }); // List from newer posts
+  CommaSepComparator statCmp({ Limitor::Less, Limitor::Less });
+  CommaSepComparator tagCmp({ Limitor::Less, Limitor::Less });
+  CommaSepComparator journalCmp({ Limitor::Less });
 
   leveldb::DB *postDB;
   leveldb::DB *commentDB;
   leveldb::DB *entryDB;
   leveldb::DB *userDB;
-  leveldb::DB *wordsDB;
-  leveldb::DB *indexDB;
+  leveldb::DB *tagDB;
+  leveldb::DB *journalDB; // Holds the commits that may not be on disk yet, and posts to index
+
+  std::string storageDir;
+  leveldb::Cache *blockCache;
+
+  // One generation of the search index: postings, words lists and their statistics
+  struct _IndexGeneration {
+    uint64_t id;
+    leveldb::DB *wordsDB;
+    leveldb::DB *indexDB;
+    leveldb::DB *statDB;
+    std::unordered_map<uint64_t, DocStats> docStats;
+    CorpusStats corpusStats = { 0, 0, 0 };
+  };
+
+  // Readers of the active generation hold generationMutex, or statMutex for the statistics.
+  // The shadow one is only built while a rebuild is running
+  _IndexGeneration active;
+  std::unique_ptr<_IndexGeneration> shadow;
+  std::unordered_set<uint64_t> shadowWritten; // Posts changed since the rebuild began
+  std::shared_mutex generationMutex;
+  std::shared_mutex statMutex;
+  std::mutex indexWriteMutex;
+
+  // Tag membership over dense post ordinals, mirrored in tagDB
+  std::unordered_map<std::string, Bitmap> tagBitmaps;
+  std::unordered_map<uint64_t, uint32_t> postOrdinals;
+  std::vector<uint64_t> ordinalPosts;
+  std::shared_mutex tagMutex;
 
   Post::Post(
       const std::string &uident,
@@ -166,6 +209,66 @@ namespace C3 {
     return buf.GetString();
   }
 
+  PostLayout::PostLayout(const std::string &title, const std::string &body) {
+    auto count = [](const std::string &text, std::vector<uint32_t> &table) {
+      uint32_t cp = 0;
+      table.reserve(text.size() / stride + 1);
+      for(size_t i = 0; i < text.size(); ++i) {
+        if(i % stride == 0) table.push_back(cp);
+        if((text[i] & 0xC0) != 0x80) ++cp;
+      }
+      if(text.size() % stride == 0) table.push_back(cp);
+    };
+    count(title, titleCodepoints);
+    count(body, bodyCodepoints);
+
+    for(size_t i = 0; i < body.size(); ++i)
+      if(body[i] == '\n') lineEnds.push_back(i);
+    lineEnds.push_back(body.size());
+  }
+
+  uint32_t PostLayout::codepoints(const std::string &text, bool title, uint32_t offset) const {
+    const std::vector<uint32_t> &table = title ? titleCodepoints : bodyCodepoints;
+    if(offset > text.size()) offset = text.size();
+    if(table.empty()) return 0;
+
+    size_t block = offset / stride;
+    if(block >= table.size()) block = table.size() - 1;
+    uint32_t cp = table[block];
+    for(size_t i = block * stride; i < offset; ++i)
+      if((text[i] & 0xC0) != 0x80) ++cp;
+    return cp;
+  }
+
+  // Sizes of the three tables, then their contents. Native byte order, like the bitmaps
+  std::string PostLayout::serialize(void) const {
+    std::string out;
+    for(auto table : { &lineEnds, &titleCodepoints, &bodyCodepoints }) {
+      const uint32_t size = table->size();
+      out.append((const char *) &size, sizeof(size));
+    }
+    for(auto table : { &lineEnds, &titleCodepoints, &bodyCodepoints })
+      out.append((const char *) table->data(), table->size() * sizeof(uint32_t));
+    return out;
+  }
+
+  bool PostLayout::parse(std::string_view data) {
+    uint32_t sizes[3];
+    if(data.size() < sizeof(sizes)) return false;
+    std::memcpy(sizes, data.data(), sizeof(sizes));
+    data.remove_prefix(sizeof(sizes));
+
+    size_t k = 0;
+    for(auto table : { &lineEnds, &titleCodepoints, &bodyCodepoints }) {
+      const size_t bytes = (size_t) sizes[k++] * sizeof(uint32_t);
+      if(data.size() < bytes) return false;
+      table->resize(bytes / sizeof(uint32_t));
+      std::memcpy(table->data(), data.data(), bytes);
+      data.remove_prefix(bytes);
+    }
+    return data.empty() && lineEnds.size() > 0;
+  }
+
   Comment::Comment(
       const std::string &uident,
       const std::string &content,
@@ -286,7 +389,7 @@ namespace C3 {
         if((unsigned) *aptr < (unsigned) *bptr)
           return *lim == Limitor::Less ? -1 : 1;
         return *lim == Limitor::Less ? 1 : -1;
-      } else if(*aptr == ',') ++lim;
+      } else if(*aptr == ',' && std::next(lim) != this->lims.cend()) ++lim;
 
       ++aptr;
       ++bptr;
@@ -303,6 +406,14 @@ namespace C3 {
 
   void CommaSepComparator::FindShortSuccessor(std::string *) const { }
 
+  bool _load_index_stats(void);
+  bool _replay_journal(void);
+  bool _load_tag_bitmaps(void);
+  void _open_index_generation(_IndexGeneration &gen, uint64_t id);
+  void _close_index_generation(_IndexGeneration &gen);
+  uint64_t _read_active_generation(void);
+  void _collect_index_generations(void);
+
   bool setup_storage(const std::string &dir, uint64_t cache) {
     // Ckeck if the folder exists
 
@@ -337,10 +448,20 @@ namespace C3 {
     INIT_DB(comment);
     INIT_DB(entry);
     INIT_DB(user);
-    INIT_DB(words);
-    INIT_DB(index);
+    INIT_DB(tag);
+    INIT_DB(journal);
+
+    storageDir = dir;
+    blockCache = cachePtr;
+    try {
+      _open_index_generation(active, _read_active_generation());
+      _collect_index_generations();
+    } catch(leveldb::Status &s) {
+      std::cout<<"Storage: Failed to open the index: "<<s.ToString()<<std::endl;
+      return false;
+    }
 
-    return true;
+    return _replay_journal() && _load_index_stats() && _load_tag_bitmaps();
   }
 
   bool setup_url_map(void) {
@@ -364,8 +485,11 @@ namespace C3 {
     delete commentDB;
     delete entryDB;
     delete userDB;
-    delete wordsDB;
-    delete indexDB;
+    delete tagDB;
+    delete journalDB;
+
+    drop_index_generation();
+    _close_index_generation(active);
   }
 
   bool check_authors(void) {
@@ -404,15 +528,10 @@ namespace C3 {
   /* Posts */
 
   uint64_t add_post(const Post &post) {
-    // Using milliseconds since Unix Epoch as post id
-    uint64_t ts = post.post_time;
-    
-    //Assume that we can't submit two post at the same millisecond 
-    leveldb::Status s = postDB->Put(leveldb::WriteOptions(), std::to_string(ts), post.to_json());
-    if(s.ok()) return ts;
-    else {
-      throw s;
-    }
+    PostMutation mutation;
+    const uint64_t id = mutation.add_post(post);
+    commit(mutation);
+    return id;
   }
 
   Post get_post(const uint64_t &id) {
@@ -430,21 +549,23 @@ namespace C3 {
   }
 
   void update_post(const uint64_t &id, const Post &post) {
-    if(!(post.post_time == id)) throw StorageExcept::IDMismatch;
-
-    // TODO: use r-value reference
-    Post np = post;
-    np.update_time = current_time();
-    leveldb::Status s = postDB->Put(leveldb::WriteOptions(), std::to_string(id), np.to_json());
-    if(!s.ok()) throw s;
+    PostMutation mutation;
+    mutation.update_post(id, post);
+    commit(mutation);
   }
-  
+
   void delete_post(const uint64_t &id) {
-    leveldb::Status s = postDB->Delete(leveldb::WriteOptions(), std::to_string(id));
-    if(!s.ok()) {
-      if(s.IsNotFound()) throw StorageExcept::NotFound;
-      else throw s;
-    }
+    PostMutation mutation;
+    mutation.delete_post(id);
+    commit(mutation);
+  }
+
+  void scan_posts(const std::function<void(Post &&)> &cb) {
+    std::unique_ptr<leveldb::Iterator> it(postDB->NewIterator(leveldb::ReadOptions()));
+    for(it->SeekToFirst(); it->Valid(); it->Next())
+      cb(Post(toStringView(it->value())));
+
+    if(!it->status().ok()) throw it->status();
   }
 
   std::vector<Post> list_posts(int offset, int count, bool &hasNext, uint64_t &total) {
@@ -525,67 +646,541 @@ namespace C3 {
   }
 
   /* Entries */
-  void _generate_remove_entries(const uint64_t &id, const std::vector<std::string> &list, leveldb::WriteBatch &batch) {
-    for(auto &it : list)
-      batch.Delete(it + "," + std::to_string(id));
+  void remove_entries(const uint64_t &id, const std::vector<std::string> &list) {
+    PostMutation mutation;
+    mutation.remove_entries(id, list);
+    commit(mutation);
   }
 
-  void _generate_add_entries(const uint64_t &id, const std::vector<std::string> &list, leveldb::WriteBatch &batch) {
-    for(auto &it : list)
-      batch.Put(it + "," + std::to_string(id), std::to_string(id));
+  void add_entries(const uint64_t &id, const std::vector<std::string> &list) {
+    PostMutation mutation;
+    mutation.add_entries(id, list);
+    commit(mutation);
   }
 
-  void remove_entries(const uint64_t &id, const std::vector<std::string> &list) {
-    leveldb::WriteBatch batch;
-    _generate_remove_entries(id, list, batch);
-    entryDB->Write(leveldb::WriteOptions(), &batch);
+  void add_remove_entries(const uint64_t &id, const std::vector<std::string> &add, const std::vector<std::string> &remove) {
+    PostMutation mutation;
+    mutation.add_remove_entries(id, add, remove);
+    commit(mutation);
   }
 
-  void add_entries(const uint64_t &id, const std::vector<std::string> &list) {
-    leveldb::WriteBatch batch;
-    _generate_add_entries(id, list, batch);
-    entryDB->Write(leveldb::WriteOptions(), &batch);
+  // Posts of all or any of the tags, sorted
+  std::vector<uint64_t> query_tag_posts(const std::vector<std::string> &tags, bool all) {
+    std::shared_lock<std::shared_mutex> lock(tagMutex);
+
+    Bitmap matched;
+    bool first = true;
+    for(auto &tag : tags) {
+      auto it = tagBitmaps.find(tag);
+      if(it == tagBitmaps.end()) {
+        if(!all) continue;
+        return {};
+      }
+
+      if(first) matched = it->second;
+      else if(all) matched &= it->second;
+      else matched |= it->second;
+      first = false;
+    }
+
+    std::vector<uint64_t> result;
+    for(auto ordinal : matched.values()) result.push_back(ordinalPosts[ordinal]);
+    lock.unlock();
+
+    std::sort(result.begin(), result.end());
+    return result;
   }
 
-  void add_remove_entries(const uint64_t &id, const std::vector<std::string> &add, const std::vector<std::string> &remove) {
-    leveldb::WriteBatch batch;
-    _generate_add_entries(id, add, batch);
-    _generate_remove_entries(id, remove, batch);
-    /* TODO: status */
-    entryDB->Write(leveldb::WriteOptions(), &batch);
+  std::vector<uint64_t> list_posts_by_tags(const std::vector<std::string> &tags, bool all, int offset, int count, bool &hasNext, uint64_t &total) {
+    const std::vector<uint64_t> posts = query_tag_posts(tags, all);
+    total = posts.size();
+
+    // Newest first
+    std::vector<uint64_t> result;
+    for(auto it = posts.rbegin() + std::min<size_t>(offset, posts.size()); it != posts.rend() && (count == -1 || (int) result.size() < count); ++it)
+      result.push_back(*it);
+
+    hasNext = offset + result.size() < total;
+    return result;
   }
 
   std::vector<uint64_t> list_posts_by_tag(const std::string &entry, int offset, int count, bool &hasNext, uint64_t &total) {
+    return list_posts_by_tags({ entry }, true, offset, count, hasNext, total);
+  }
+
+  std::vector<std::pair<std::string, uint64_t>> count_tags(void) {
+    std::vector<std::pair<std::string, uint64_t>> result;
+    {
+      std::shared_lock<std::shared_mutex> lock(tagMutex);
+      for(auto &tag : tagBitmaps) result.emplace_back(tag.first, tag.second.cardinality());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  // Ordinals follow post ids, so that older posts are packed together
+  bool _rebuild_tag_bitmaps(void) {
+    std::cout<<"Storage: Rebuilding tag bitmaps"<<std::endl;
+
+    std::vector<std::pair<std::string, uint64_t>> entries;
     std::unique_ptr<leveldb::Iterator> it(entryDB->NewIterator(leveldb::ReadOptions()));
-    it->Seek(entry);
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+      const auto key = toStringView(it->key());
+      const auto sep = key.rfind(',');
+      if(sep == std::string_view::npos) continue;
+
+      const auto value = toStringView(it->value());
+      uint64_t post;
+      std::from_chars(value.data(), value.data() + value.size(), post);
+      entries.emplace_back(std::string(key.substr(0, sep)), post);
+    }
+    if(!it->status().ok()) return false;
 
-    std::vector<uint64_t> result;
-    if(count > 0) result.reserve(count);
-    total = 0;
+    for(auto &entry : entries) ordinalPosts.push_back(entry.second);
+    std::sort(ordinalPosts.begin(), ordinalPosts.end());
+    ordinalPosts.erase(std::unique(ordinalPosts.begin(), ordinalPosts.end()), ordinalPosts.end());
 
-    while(it->Valid() && _entryEquals(it->key(), entry) && offset-- > 0) {
-      ++total;
-      it->Next();
+    leveldb::WriteBatch batch;
+    for(uint32_t ordinal = 0; ordinal < ordinalPosts.size(); ++ordinal) {
+      postOrdinals.emplace(ordinalPosts[ordinal], ordinal);
+      batch.Put("ordinal," + std::to_string(ordinalPosts[ordinal]), std::to_string(ordinal));
     }
+    batch.Put("next", std::to_string(ordinalPosts.size()));
 
-    for(int i = 0; (count == -1 || i < count) && it->Valid() && _entryEquals(it->key(), entry); ++i) {
-      const auto view = toStringView(it->value());
-      uint64_t id;
-      // TODO: check for errors
-      std::from_chars(view.data(), view.data() + view.size(), id);
-      result.push_back(id);
-      ++total;
-      it->Next();
+    for(auto &entry : entries) tagBitmaps[entry.first].add(postOrdinals[entry.second]);
+    for(auto &tag : tagBitmaps) batch.Put("tag," + tag.first, tag.second.serialize());
+
+    return tagDB->Write(leveldb::WriteOptions(), &batch).ok();
+  }
+
+  bool _load_tag_bitmaps(void) {
+    std::unique_lock<std::shared_mutex> lock(tagMutex);
+    tagBitmaps.clear();
+    postOrdinals.clear();
+    ordinalPosts.clear();
+
+    std::string next;
+    leveldb::Status s = tagDB->Get(leveldb::ReadOptions(), "next", &next);
+    if(s.IsNotFound()) return _rebuild_tag_bitmaps();
+    else if(!s.ok()) return false;
+
+    uint32_t count = 0;
+    std::from_chars(next.data(), next.data() + next.size(), count);
+    ordinalPosts.resize(count);
+
+    std::unique_ptr<leveldb::Iterator> it(tagDB->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek("ordinal"); it->Valid() && _entryEquals(it->key(), "ordinal"); it->Next()) {
+      const auto key = toStringView(it->key());
+      const auto value = toStringView(it->value());
+      uint64_t post;
+      uint32_t ordinal;
+      std::from_chars(key.data() + 8, key.data() + key.size(), post);
+      std::from_chars(value.data(), value.data() + value.size(), ordinal);
+      if(ordinal >= count) return false;
+
+      ordinalPosts[ordinal] = post;
+      postOrdinals.emplace(post, ordinal);
     }
 
-    hasNext = it->Valid() && _entryEquals(it->key(), entry);
+    for(it->Seek("tag"); it->Valid() && _entryEquals(it->key(), "tag"); it->Next()) {
+      const auto key = toStringView(it->key());
+      Bitmap &bitmap = tagBitmaps[std::string(key.substr(4))];
+      if(!bitmap.parse(toStringView(it->value()))) {
+        std::cout<<"Storage: Corrupted bitmap for tag "<<key.substr(4)<<std::endl;
+        return false;
+      }
+    }
 
-    while(it->Valid() && _entryEquals(it->key(), entry)) {
-      ++total;
-      it->Next();
+    return it->status().ok();
+  }
+
+  /* Mutations */
+
+  uint64_t PostMutation::add_post(const Post &post) {
+    // Using milliseconds since Unix Epoch as post id
+    // Assume that we can't submit two posts at the same millisecond
+    changes.push_back(Change { Change::Type::PutPost, post.post_time, post.to_json(), "", {} });
+    return post.post_time;
+  }
+
+  void PostMutation::update_post(const uint64_t &id, const Post &post) {
+    if(!(post.post_time == id)) throw StorageExcept::IDMismatch;
+
+    Post np = post;
+    np.update_time = current_time();
+    changes.push_back(Change { Change::Type::PutPost, id, np.to_json(), "", {} });
+  }
+
+  void PostMutation::delete_post(const uint64_t &id) {
+    changes.push_back(Change { Change::Type::DeletePost, id, "", "", {} });
+  }
+
+  void PostMutation::add_entries(const uint64_t &id, const std::vector<std::string> &list) {
+    if(list.size() > 0) changes.push_back(Change { Change::Type::AddEntries, id, "", "", list });
+  }
+
+  void PostMutation::remove_entries(const uint64_t &id, const std::vector<std::string> &list) {
+    if(list.size() > 0) changes.push_back(Change { Change::Type::RemoveEntries, id, "", "", list });
+  }
+
+  void PostMutation::add_remove_entries(const uint64_t &id, const std::vector<std::string> &added, const std::vector<std::string> &removed) {
+    add_entries(id, added);
+    remove_entries(id, removed);
+  }
+
+  void PostMutation::add_url(const std::string &url, uint64_t id) {
+    changes.push_back(Change { Change::Type::AddUrl, id, url, "", {} });
+  }
+
+  void PostMutation::rename_url(const std::string &from, const std::string &to, uint64_t validator) {
+    changes.push_back(Change { Change::Type::RenameUrl, validator, from, to, {} });
+  }
+
+  void PostMutation::remove_url(const std::string &url) {
+    changes.push_back(Change { Change::Type::RemoveUrl, 0, url, "", {} });
+  }
+
+  void PostMutation::queue_index(const uint64_t &id) {
+    changes.push_back(Change { Change::Type::QueueIndex, id, "", "", {} });
+  }
+
+  // Queue markers are applied to the journal after the other stores, so that a post is
+  // written by the time its marker can be seen
+  enum class _Store : char {
+    Post, Entry, Tag, Queue
+  };
+
+  // Numbered by time, so that a marker is never written again once read
+  uint64_t queuedLast = 0;
+
+  std::string _queued_key(uint64_t post) {
+    const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    queuedLast = std::max(now, queuedLast + 1);
+    const std::string digits = std::to_string(queuedLast);
+    return "queue," + std::to_string(post) + "," + std::string(20 - digits.size(), '0') + digits;
+  }
+
+  // Key changes of a commit group per database, and all of them as one journal record:
+  // the store, 'P' or 'D', then the key and the value, each after its length
+  struct _CommitBatches {
+    leveldb::WriteBatch batches[4];
+    size_t counts[4] = { 0, 0, 0, 0 };
+    std::string record;
+
+    void put(_Store store, const std::string &key, const std::string &value) {
+      batches[(size_t) store].Put(key, value);
+      ++counts[(size_t) store];
+      _append(store, 'P', key, value);
     }
 
-    return result;
+    void del(_Store store, const std::string &key) {
+      batches[(size_t) store].Delete(key);
+      ++counts[(size_t) store];
+      _append(store, 'D', key, "");
+    }
+
+    void _append(_Store store, char op, const std::string &key, const std::string &value) {
+      record.push_back((char) store);
+      record.push_back(op);
+      for(auto str : { &key, &value }) {
+        const uint32_t size = str->size();
+        record.append((const char *) &size, sizeof(size));
+        record += *str;
+      }
+    }
+
+    bool parse(std::string_view data) {
+      std::string fields[2];
+      while(data.size() > 0) {
+        if(data.size() < 2 || (uint8_t) data[0] > (uint8_t) _Store::Queue) return false;
+        const _Store store = (_Store) data[0];
+        const char op = data[1];
+        data.remove_prefix(2);
+
+        for(auto &field : fields) {
+          uint32_t size;
+          if(data.size() < sizeof(size)) return false;
+          std::memcpy(&size, data.data(), sizeof(size));
+          data.remove_prefix(sizeof(size));
+          if(data.size() < size) return false;
+          field.assign(data.data(), size);
+          data.remove_prefix(size);
+        }
+
+        if(op == 'P') put(store, fields[0], fields[1]);
+        else if(op == 'D') del(store, fields[0]);
+        else return false;
+      }
+      return true;
+    }
+
+    // A synced write flushes every earlier one of its database too, so when syncing even
+    // the empty batches are written
+    void apply(bool sync) {
+      leveldb::WriteOptions options;
+      options.sync = sync;
+      leveldb::DB *dbs[] = { postDB, entryDB, tagDB, journalDB };
+      for(size_t i = 0; i < 4; ++i) {
+        if(counts[i] == 0 && !sync) continue;
+        leveldb::Status s = dbs[i]->Write(options, &batches[i]);
+        if(!s.ok()) throw s;
+      }
+    }
+  };
+
+  // Journal records are numbered, and kept until the databases they were applied to are
+  // synced, which happens once every journalCheckpoint groups
+  const uint64_t journalCheckpoint = 64;
+  uint64_t journalNext = 0; // Number of the next record
+  uint64_t journalKept = 0; // First record still in the journal
+  uint64_t journalSynced = 0; // Records before it are on disk, and go with the next record
+
+  // Zero-padded, as journal keys sort bytewise
+  std::string _journal_key(uint64_t record) {
+    const std::string digits = std::to_string(record);
+    return "pending," + std::string(20 - digits.size(), '0') + digits;
+  }
+
+  // Finishes the commits that may not have reached the disk when the process stopped. Their
+  // changes are absolute, so applying them again in order is harmless
+  bool _replay_journal(void) {
+    _CommitBatches batches;
+    leveldb::WriteBatch records;
+    size_t count = 0;
+
+    std::unique_ptr<leveldb::Iterator> it(journalDB->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek("pending"); it->Valid() && _entryEquals(it->key(), "pending"); it->Next()) {
+      if(!batches.parse(it->value().ToString())) {
+        std::cout<<"Storage: Corrupted commit journal"<<std::endl;
+        return false;
+      }
+      records.Delete(it->key());
+      ++count;
+    }
+    if(!it->status().ok()) return false;
+    if(count == 0) return true;
+
+    std::cout<<"Storage: Replaying "<<count<<" journaled commits"<<std::endl;
+    try {
+      batches.apply(true);
+    } catch(leveldb::Status &s) {
+      std::cout<<"Storage: Failed to replay the commits: "<<s.ToString()<<std::endl;
+      return false;
+    }
+    return journalDB->Write(leveldb::WriteOptions(), &records).ok();
+  }
+
+  struct _CommitWaiter {
+    const PostMutation *mutation;
+    std::exception_ptr error;
+    bool done;
+  };
+
+  // The first waiter of the queue commits every mutation queued at that point
+  std::mutex commitMutex;
+  std::condition_variable commitCond;
+  std::deque<_CommitWaiter *> commitQueue;
+  std::exception_ptr commitFailure; // A group failed halfway, and only a restart replays it
+
+  // Checked against the URL map and the changes staged before it
+  void _check_urls(const PostMutation &mutation, std::map<std::string, std::optional<uint64_t>> &urls) {
+    auto owner = [&urls](const std::string &url) -> std::optional<uint64_t> {
+      auto it = urls.find(url);
+      if(it != urls.end()) return it->second;
+      if(!has_url(url)) return std::nullopt;
+      return query_url(url);
+    };
+
+    for(auto &change : mutation.changes) {
+      if(change.type == PostMutation::Change::Type::AddUrl) {
+        if(owner(change.key)) throw MapperError::DuplicatedUrl;
+        urls[change.key] = change.id;
+      } else if(change.type == PostMutation::Change::Type::RenameUrl) {
+        auto original = owner(change.key);
+        if(!original) throw MapperError::UrlNotFound;
+        if(*original != change.id) throw MapperError::ValidationFailed;
+        if(owner(change.to)) throw MapperError::DuplicatedUrl;
+        urls[change.to] = change.id;
+        urls[change.key] = std::nullopt;
+      } else if(change.type == PostMutation::Change::Type::RemoveUrl) {
+        if(!owner(change.key)) throw MapperError::UrlNotFound;
+        urls[change.key] = std::nullopt;
+      }
+    }
+  }
+
+  // Tag bitmaps as the group leaves them, copied from the live ones when first changed
+  struct _StagedTags {
+    std::unordered_map<std::string, Bitmap> bitmaps;
+    std::vector<uint64_t> addedPosts; // Take the ordinals after the live ones
+    std::unordered_map<uint64_t, uint32_t> addedOrdinals;
+
+    std::optional<uint32_t> ordinal(uint64_t post, bool assign, _CommitBatches &batches) {
+      auto it = addedOrdinals.find(post);
+      if(it != addedOrdinals.end()) return it->second;
+      auto live = postOrdinals.find(post);
+      if(live != postOrdinals.end()) return live->second;
+      if(!assign) return std::nullopt;
+
+      const uint32_t ordinal = ordinalPosts.size() + addedPosts.size();
+      addedPosts.push_back(post);
+      addedOrdinals.emplace(post, ordinal);
+      batches.put(_Store::Tag, "ordinal," + std::to_string(post), std::to_string(ordinal));
+      batches.put(_Store::Tag, "next", std::to_string(ordinal + 1));
+      return ordinal;
+    }
+
+    Bitmap *bitmap(const std::string &tag, bool create) {
+      auto it = bitmaps.find(tag);
+      if(it != bitmaps.end()) return &it->second;
+      auto live = tagBitmaps.find(tag);
+      if(live == tagBitmaps.end() && !create) return nullptr;
+      return &bitmaps.emplace(tag, live != tagBitmaps.end() ? live->second : Bitmap()).first->second;
+    }
+  };
+
+  void _stage(const PostMutation &mutation, _StagedTags &tags, _CommitBatches &batches) {
+    for(auto &change : mutation.changes) {
+      const std::string id = std::to_string(change.id);
+      switch(change.type) {
+        case PostMutation::Change::Type::PutPost:
+          batches.put(_Store::Post, id, change.key);
+          break;
+        case PostMutation::Change::Type::DeletePost:
+          batches.del(_Store::Post, id);
+          break;
+        case PostMutation::Change::Type::AddEntries: {
+          const uint32_t ordinal = *tags.ordinal(change.id, true, batches);
+          for(auto &tag : change.list) {
+            batches.put(_Store::Entry, tag + "," + id, id);
+            tags.bitmap(tag, true)->add(ordinal);
+          }
+          break;
+        }
+        case PostMutation::Change::Type::RemoveEntries: {
+          const auto ordinal = tags.ordinal(change.id, false, batches);
+          for(auto &tag : change.list) {
+            batches.del(_Store::Entry, tag + "," + id);
+            Bitmap *bitmap = ordinal ? tags.bitmap(tag, false) : nullptr;
+            if(bitmap) bitmap->remove(*ordinal);
+          }
+          break;
+        }
+        case PostMutation::Change::Type::QueueIndex:
+          batches.put(_Store::Queue, _queued_key(change.id), "");
+          break;
+        default:
+          break; // URLs only live in memory
+      }
+    }
+  }
+
+  // Only the leader runs this, so the URL map and tag bitmaps cannot change under it
+  void _commit_group(const std::vector<_CommitWaiter *> &group) {
+    if(commitFailure) {
+      for(auto waiter : group) waiter->error = commitFailure;
+      return;
+    }
+
+    std::map<std::string, std::optional<uint64_t>> urls;
+    _StagedTags tags;
+    _CommitBatches batches;
+    std::vector<const PostMutation *> staged;
+
+    {
+      std::shared_lock<std::shared_mutex> lock(tagMutex);
+      for(auto waiter : group) {
+        auto checked = urls;
+        try {
+          _check_urls(*waiter->mutation, checked);
+        } catch(...) {
+          waiter->error = std::current_exception();
+          continue;
+        }
+        urls.swap(checked);
+        _stage(*waiter->mutation, tags, batches);
+        staged.push_back(waiter->mutation);
+      }
+    }
+
+    for(auto &it : tags.bitmaps) {
+      if(it.second.empty()) batches.del(_Store::Tag, "tag," + it.first);
+      else batches.put(_Store::Tag, "tag," + it.first, it.second.serialize());
+    }
+    if(staged.empty()) return;
+
+    // The only synced write of an unchecked group, and its commit point
+    leveldb::WriteBatch journal;
+    for(uint64_t record = journalKept; record < journalSynced; ++record) journal.Delete(_journal_key(record));
+    journal.Put(_journal_key(journalNext), batches.record);
+    leveldb::WriteOptions synced;
+    synced.sync = true;
+    try {
+      leveldb::Status s = journalDB->Write(synced, &journal);
+      if(!s.ok()) throw s;
+    } catch(...) {
+      for(auto waiter : group) if(!waiter->error) waiter->error = std::current_exception();
+      return;
+    }
+    journalKept = journalSynced;
+    ++journalNext;
+
+    try {
+      const bool checkpoint = journalNext - journalKept >= journalCheckpoint;
+      batches.apply(checkpoint);
+      if(checkpoint) journalSynced = journalNext;
+    } catch(...) {
+      std::cout<<"Storage: A commit failed after its journal was written, refusing further ones until restarted"<<std::endl;
+      commitFailure = std::current_exception();
+      for(auto waiter : group) if(!waiter->error) waiter->error = commitFailure;
+      return;
+    }
+
+    // Written, so memory follows
+    for(auto mutation : staged)
+      for(auto &change : mutation->changes) {
+        if(change.type == PostMutation::Change::Type::AddUrl) add_url(change.key, change.id);
+        else if(change.type == PostMutation::Change::Type::RenameUrl) rename_url(change.key, change.to, change.id);
+        else if(change.type == PostMutation::Change::Type::RemoveUrl) remove_url(change.key);
+      }
+
+    std::unique_lock<std::shared_mutex> lock(tagMutex);
+    for(auto post : tags.addedPosts) {
+      postOrdinals.emplace(post, ordinalPosts.size());
+      ordinalPosts.push_back(post);
+    }
+    for(auto &it : tags.bitmaps) {
+      if(it.second.empty()) tagBitmaps.erase(it.first);
+      else tagBitmaps[it.first] = std::move(it.second);
+    }
+  }
+
+  void commit(const PostMutation &mutation) {
+    _CommitWaiter self { &mutation, nullptr, false };
+
+    std::unique_lock<std::mutex> lock(commitMutex);
+    commitQueue.push_back(&self);
+    commitCond.wait(lock, [&self]() { return self.done || commitQueue.front() == &self; });
+
+    if(!self.done) {
+      std::vector<_CommitWaiter *> group(commitQueue.begin(), commitQueue.end());
+      lock.unlock();
+      try {
+        _commit_group(group);
+      } catch(...) {
+        for(auto waiter : group) if(!waiter->error) waiter->error = std::current_exception();
+      }
+      lock.lock();
+
+      for(auto waiter : group) {
+        waiter->done = true;
+        commitQueue.pop_front();
+      }
+      commitCond.notify_all();
+    }
+
+    if(self.error) std::rethrow_exception(self.error);
   }
 
   /* Users */
@@ -608,56 +1203,454 @@ namespace C3 {
     return User(get_user_str(uident));
   }
 
+  /* Index generations */
+  std::string _generation_path(uint64_t id, const char *name) {
+    if(id == 0) return storageDir + "/" + name;
+    return storageDir + "/" + name + "." + std::to_string(id);
+  }
+
+  void _open_index_generation(_IndexGeneration &gen, uint64_t id) {
+    gen.id = id;
+    gen.docStats.clear();
+    gen.corpusStats = { 0, 0, 0 };
+
+    auto open = [id](const char *name, CommaSepComparator *cmp) {
+      leveldb::Options opt;
+      opt.create_if_missing = true;
+      opt.comparator = cmp;
+      opt.block_cache = blockCache;
+
+      leveldb::DB *db;
+      leveldb::Status s = leveldb::DB::Open(opt, _generation_path(id, name), &db);
+      if(!s.ok()) throw s;
+      return db;
+    };
+
+    gen.wordsDB = open("words", &wordsCmp);
+    gen.indexDB = open("index", &indexCmp);
+    gen.statDB = open("stat", &statCmp);
+  }
+
+  void _close_index_generation(_IndexGeneration &gen) {
+    delete gen.wordsDB;
+    delete gen.indexDB;
+    delete gen.statDB;
+    gen.wordsDB = gen.indexDB = gen.statDB = nullptr;
+  }
+
+  void _remove_index_generation(uint64_t id) {
+    for(auto name : { "words", "index", "stat" })
+      boost::filesystem::remove_all(_generation_path(id, name));
+  }
+
+  // The active generation is switched by renaming a file over it
+  uint64_t _read_active_generation(void) {
+    std::ifstream ifs(storageDir + "/INDEX");
+    uint64_t id = 0;
+    ifs>>id;
+    return id;
+  }
+
+  void _write_active_generation(uint64_t id) {
+    const std::string path = storageDir + "/INDEX";
+    {
+      std::ofstream ofs(path + ".tmp", std::ios::trunc);
+      ofs<<id<<std::endl;
+      if(!ofs) throw StorageExcept::ParseError;
+    }
+    boost::filesystem::rename(path + ".tmp", path);
+  }
+
+  // Leftovers of replaced generations, or of rebuilds that never finished
+  void _collect_index_generations(void) {
+    for(auto &entry : boost::filesystem::directory_iterator(storageDir)) {
+      const std::string name = entry.path().filename().string();
+      for(auto prefix : { "words", "index", "stat" }) {
+        const size_t length = std::strlen(prefix);
+        if(name.compare(0, length, prefix) != 0) continue;
+
+        uint64_t id = 0;
+        if(name.size() > length) {
+          if(name[length] != '.') continue;
+          auto result = std::from_chars(name.data() + length + 1, name.data() + name.size(), id);
+          if(result.ec != std::errc() || result.ptr != name.data() + name.size()) continue;
+        }
+
+        if(id == active.id) continue;
+        std::cout<<"Storage: Removing stale index generation "<<name<<std::endl;
+        boost::filesystem::remove_all(entry.path());
+      }
+    }
+  }
+
+  bool open_index_generation(void) {
+    std::lock_guard<std::mutex> writeLock(indexWriteMutex);
+    if(shadow) return false;
+
+    const uint64_t id = active.id + 1;
+    _remove_index_generation(id);
+
+    std::unique_ptr<_IndexGeneration> gen(new _IndexGeneration());
+    _open_index_generation(*gen, id);
+    shadow = std::move(gen);
+    shadowWritten.clear();
+    return true;
+  }
+
+  void swap_index_generation(void) {
+    std::lock_guard<std::mutex> writeLock(indexWriteMutex);
+    if(!shadow) return;
+
+    _write_active_generation(shadow->id);
+    {
+      std::unique_lock<std::shared_mutex> lock(generationMutex);
+      std::unique_lock<std::shared_mutex> statLock(statMutex);
+      std::swap(active, *shadow);
+    }
+
+    std::cout<<"Storage: Switched to index generation "<<active.id<<std::endl;
+    _close_index_generation(*shadow);
+    _remove_index_generation(shadow->id);
+    shadow.reset();
+    shadowWritten.clear();
+  }
+
+  void drop_index_generation(void) {
+    std::lock_guard<std::mutex> writeLock(indexWriteMutex);
+    if(!shadow) return;
+
+    _close_index_generation(*shadow);
+    _remove_index_generation(shadow->id);
+    shadow.reset();
+    shadowWritten.clear();
+  }
+
   /* Index */
-  void set_indexes(uint64_t post, const std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>> &indexes) {
-    leveldb::WriteBatch indexBatch;
+  uint64_t _query_df(const _IndexGeneration &gen, const std::string &str) {
+    std::string v;
+    leveldb::Status s = gen.statDB->Get(leveldb::ReadOptions(), "df," + str, &v);
+    if(s.IsNotFound()) return 0;
+    else if(!s.ok()) throw s;
+
+    uint64_t df = 0;
+    std::from_chars(v.data(), v.data() + v.size(), df);
+    return df;
+  }
+
+  void _commit_index_stats(_IndexGeneration &gen, const std::unordered_map<std::string, int64_t> &dfDelta,
+      const std::vector<std::pair<uint64_t, const DocStats *>> &docs) {
+    leveldb::WriteBatch batch;
+
+    for(auto &d : dfDelta) {
+      if(d.second == 0) continue;
+      int64_t df = _query_df(gen, d.first) + d.second;
+      if(df > 0) batch.Put("df," + d.first, std::to_string(df));
+      else batch.Delete("df," + d.first);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(statMutex);
+
+    for(auto &doc : docs) {
+      const uint64_t post = doc.first;
+      const DocStats *cur = doc.second;
+
+      auto prev = gen.docStats.find(post);
+      if(prev != gen.docStats.end()) {
+        --gen.corpusStats.docs;
+        gen.corpusStats.title -= prev->second.title;
+        gen.corpusStats.body -= prev->second.body;
+        gen.docStats.erase(prev);
+      }
+
+      if(cur) {
+        ++gen.corpusStats.docs;
+        gen.corpusStats.title += cur->title;
+        gen.corpusStats.body += cur->body;
+        gen.docStats.emplace(post, *cur);
+        batch.Put("doc," + std::to_string(post), std::to_string(cur->title) + ' ' + std::to_string(cur->body));
+      } else batch.Delete("doc," + std::to_string(post));
+    }
+
+    batch.Put("corpus", std::to_string(gen.corpusStats.docs)
+        + ' ' + std::to_string(gen.corpusStats.title)
+        + ' ' + std::to_string(gen.corpusStats.body));
+
+    leveldb::Status s = gen.statDB->Write(leveldb::WriteOptions(), &batch);
+    if(!s.ok()) throw s;
+  }
+
+  // One keyword per line, after its weight
+  std::string _serialize_keywords(const PostKeywords &keywords) {
+    std::stringstream out;
+    out.precision(std::numeric_limits<double>::max_digits10);
+    for(auto &keyword : keywords) out<<keyword.second<<' '<<keyword.first<<'\n';
+    return out.str();
+  }
+
+  PostKeywords _parse_keywords(const std::string &data) {
+    PostKeywords keywords;
+    std::stringstream in(data);
+    double weight;
+    std::string word;
+    while(in>>weight && in.get() == ' ' && std::getline(in, word)) keywords.emplace_back(std::move(word), weight);
+    return keywords;
+  }
+
+  // Only postings that differ from the stored ones are rewritten, and the words list
+  // only if the set of words changed
+  DocStats _generate_set_indexes(const _IndexGeneration &gen, const IndexedPost &post, leveldb::WriteBatch &indexBatch,
+      leveldb::WriteBatch &wordsBatch, std::unordered_map<std::string, int64_t> &dfDelta, std::unordered_set<std::string> &changed) {
+    const std::string id = std::to_string(post.post);
 
     std::string words;
-    leveldb::Status s = wordsDB->Get(leveldb::ReadOptions(), std::to_string(post), &words);
+    std::unordered_set<std::string> previous;
+    leveldb::Status s = gen.wordsDB->Get(leveldb::ReadOptions(), id, &words);
     if(!s.ok()) {
       if(!s.IsNotFound()) throw s;
     } else {
       std::stringstream ws(words);
       std::string w;
-      while(ws>>w)
-        indexBatch.Delete(w + ',' + std::to_string(post));
+      while(ws>>w) previous.insert(std::move(w));
+    }
+
+    bool reshaped = previous.size() != post.indexes.size();
+    for(auto &w : previous) {
+      if(post.indexes.count(w) > 0) continue;
+      indexBatch.Delete(w + ',' + id);
+      --dfDelta[w];
+      changed.insert(w);
     }
 
+    DocStats cur = { 0, 0 };
     std::stringstream curWords;
-    for(auto &it : indexes) {
+    for(auto &it : post.indexes) {
       std::stringstream indexes;
-      for(auto &occur : it.second)
+      for(auto &occur : it.second) {
         indexes<<occur.first<<' '<<(occur.second ? 't' : 'b')<<'\n';
-      indexBatch.Put(it.first + ',' + std::to_string(post), indexes.str());
+        if(occur.second) ++cur.title;
+        else ++cur.body;
+      }
       curWords<<it.first<<'\n';
+
+      const std::string key = it.first + ',' + id;
+      if(previous.count(it.first) > 0) {
+        std::string stored;
+        leveldb::Status is = gen.indexDB->Get(leveldb::ReadOptions(), key, &stored);
+        if(!is.ok() && !is.IsNotFound()) throw is;
+        if(is.ok() && stored == indexes.str()) continue;
+      } else {
+        ++dfDelta[it.first];
+        reshaped = true;
+      }
+
+      indexBatch.Put(key, indexes.str());
+      changed.insert(it.first);
     }
 
-    leveldb::Status is = indexDB->Write(leveldb::WriteOptions(), &indexBatch);
+    if(reshaped) wordsBatch.Put(id, curWords.str());
+    wordsBatch.Put("hash," + id, post.fingerprint);
+    wordsBatch.Put("layout," + id, post.layout.serialize());
+    wordsBatch.Put("keywords," + id, _serialize_keywords(post.keywords));
+    return cur;
+  }
+
+  void _set_indexes(_IndexGeneration &gen, const std::vector<const IndexedPost *> &posts, std::unordered_set<std::string> &changed) {
+    leveldb::WriteBatch indexBatch, wordsBatch;
+    std::unordered_map<std::string, int64_t> dfDelta;
+    std::vector<DocStats> stats;
+    stats.reserve(posts.size());
+    for(auto post : posts)
+      stats.push_back(_generate_set_indexes(gen, *post, indexBatch, wordsBatch, dfDelta, changed));
+
+    leveldb::Status is = gen.indexDB->Write(leveldb::WriteOptions(), &indexBatch);
     if(!is.ok()) throw is;
-    wordsDB->Put(leveldb::WriteOptions(), std::to_string(post), curWords.str());
+    leveldb::Status ws = gen.wordsDB->Write(leveldb::WriteOptions(), &wordsBatch);
+    if(!ws.ok()) throw ws;
+
+    std::vector<std::pair<uint64_t, const DocStats *>> docs;
+    for(size_t i = 0; i < posts.size(); ++i) docs.emplace_back(posts[i]->post, &stats[i]);
+    _commit_index_stats(gen, dfDelta, docs);
   }
 
-  void clear_indexes(uint64_t post) {
+  // While a generation is being built, changes are written to it as well, and the
+  // rebuild leaves the posts involved alone as it has older versions of them
+  std::unordered_set<std::string> _set_live_indexes(const std::vector<const IndexedPost *> &posts) {
+    std::lock_guard<std::mutex> writeLock(indexWriteMutex);
+
+    std::unordered_set<std::string> changed;
+    _set_indexes(active, posts, changed);
+
+    if(shadow) {
+      std::unordered_set<std::string> dummy_changed;
+      _set_indexes(*shadow, posts, dummy_changed);
+      for(auto post : posts) shadowWritten.insert(post->post);
+    }
+    return changed;
+  }
+
+  std::unordered_set<std::string> set_indexes(const IndexedPost &post) {
+    return _set_live_indexes({ &post });
+  }
+
+  // One write per database for all the posts
+  void set_indexes(const std::vector<const IndexedPost *> &posts) {
+    _set_live_indexes(posts);
+  }
+
+  void set_generation_indexes(const std::vector<const IndexedPost *> &posts) {
+    std::lock_guard<std::mutex> writeLock(indexWriteMutex);
+    if(!shadow) throw StorageExcept::NotFound;
+
+    std::vector<const IndexedPost *> stale;
+    for(auto post : posts)
+      if(shadowWritten.count(post->post) == 0) stale.push_back(post);
+
+    std::unordered_set<std::string> dummy_changed;
+    _set_indexes(*shadow, stale, dummy_changed);
+  }
+
+  bool _clear_indexes(_IndexGeneration &gen, uint64_t post) {
     leveldb::WriteBatch batch;
+    std::unordered_map<std::string, int64_t> dfDelta;
 
     std::string words;
-    leveldb::Status s = wordsDB->Get(leveldb::ReadOptions(), std::to_string(post), &words);
+    leveldb::Status s = gen.wordsDB->Get(leveldb::ReadOptions(), std::to_string(post), &words);
     if(!s.ok()) {
-      if(s.IsNotFound()) throw StorageExcept::NotFound;
+      if(s.IsNotFound()) return false;
       else throw s;
     }
 
     std::stringstream ws(words);
     std::string w;
-    while(ws>>w)
+    while(ws>>w) {
       batch.Delete(w + ',' + std::to_string(post));
+      --dfDelta[w];
+    }
+
+    gen.indexDB->Write(leveldb::WriteOptions(), &batch);
+
+    leveldb::WriteBatch wordsBatch;
+    wordsBatch.Delete(std::to_string(post));
+    wordsBatch.Delete("hash," + std::to_string(post));
+    wordsBatch.Delete("layout," + std::to_string(post));
+    wordsBatch.Delete("keywords," + std::to_string(post));
+    gen.wordsDB->Write(leveldb::WriteOptions(), &wordsBatch);
 
-    indexDB->Write(leveldb::WriteOptions(), &batch);
-    wordsDB->Delete(leveldb::WriteOptions(), std::to_string(post));
+    _commit_index_stats(gen, dfDelta, { std::make_pair(post, nullptr) });
+    return true;
+  }
+
+  void clear_indexes(uint64_t post) {
+    std::lock_guard<std::mutex> writeLock(indexWriteMutex);
+
+    const bool found = _clear_indexes(active, post);
+    if(shadow) {
+      _clear_indexes(*shadow, post);
+      shadowWritten.insert(post);
+    }
+    if(!found) throw StorageExcept::NotFound;
+  }
+
+  std::vector<std::string> query_words(uint64_t post) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::string words;
+    leveldb::Status s = active.wordsDB->Get(leveldb::ReadOptions(), std::to_string(post), &words);
+    if(!s.ok()) {
+      if(s.IsNotFound()) return {};
+      else throw s;
+    }
+
+    std::vector<std::string> result;
+    std::stringstream ws(words);
+    std::string w;
+    while(ws>>w) result.emplace_back(std::move(w));
+    return result;
+  }
+
+  std::string query_fingerprint(uint64_t post) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::string fingerprint;
+    leveldb::Status s = active.wordsDB->Get(leveldb::ReadOptions(), "hash," + std::to_string(post), &fingerprint);
+    if(!s.ok()) {
+      if(s.IsNotFound()) return "";
+      else throw s;
+    }
+    return fingerprint;
+  }
+
+  PostLayout query_layout(uint64_t post) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::string data;
+    leveldb::Status s = active.wordsDB->Get(leveldb::ReadOptions(), "layout," + std::to_string(post), &data);
+    if(!s.ok()) {
+      if(s.IsNotFound()) throw StorageExcept::NotFound;
+      else throw s;
+    }
+
+    PostLayout layout;
+    if(!layout.parse(data)) throw StorageExcept::ParseError;
+    return layout;
+  }
+
+  PostKeywords query_keywords(uint64_t post) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::string data;
+    leveldb::Status s = active.wordsDB->Get(leveldb::ReadOptions(), "keywords," + std::to_string(post), &data);
+    if(!s.ok()) {
+      if(s.IsNotFound()) return {};
+      else throw s;
+    }
+    return _parse_keywords(data);
+  }
+
+  void scan_keywords(const std::function<void(uint64_t, PostKeywords &&)> &cb) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::unique_ptr<leveldb::Iterator> it(active.wordsDB->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek("keywords"); it->Valid() && _entryEquals(it->key(), "keywords"); it->Next()) {
+      const auto key = toStringView(it->key());
+      uint64_t post;
+      std::from_chars(key.data() + 9, key.data() + key.size(), post);
+      cb(post, _parse_keywords(it->value().ToString()));
+    }
+
+    if(!it->status().ok()) throw it->status();
+  }
+
+  std::vector<std::string> query_queued(uint64_t post) {
+    const std::string prefix = "queue," + std::to_string(post);
+    std::unique_ptr<leveldb::Iterator> it(journalDB->NewIterator(leveldb::ReadOptions()));
+    std::vector<std::string> markers;
+    for(it->Seek(prefix); it->Valid() && _entryEquals(it->key(), prefix); it->Next())
+      markers.push_back(it->key().ToString());
+
+    if(!it->status().ok()) throw it->status();
+    return markers;
+  }
+
+  void clear_queued(const std::vector<std::string> &markers) {
+    leveldb::WriteBatch batch;
+    for(auto &marker : markers) batch.Delete(marker);
+    leveldb::Status s = journalDB->Write(leveldb::WriteOptions(), &batch);
+    if(!s.ok()) throw s;
+  }
+
+  std::vector<uint64_t> scan_queued(void) {
+    std::unique_ptr<leveldb::Iterator> it(journalDB->NewIterator(leveldb::ReadOptions()));
+    std::vector<uint64_t> posts;
+    for(it->Seek("queue"); it->Valid() && _entryEquals(it->key(), "queue"); it->Next()) {
+      const auto key = toStringView(it->key());
+      uint64_t post;
+      std::from_chars(key.data() + 6, key.data() + key.size(), post);
+      if(posts.empty() || posts.back() != post) posts.push_back(post);
+    }
+
+    if(!it->status().ok()) throw it->status();
+    return posts;
   }
 
   std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, bool>>> query_indexes(const std::string &str) {
-    std::unique_ptr<leveldb::Iterator> it(indexDB->NewIterator(leveldb::ReadOptions()));
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::unique_ptr<leveldb::Iterator> it(active.indexDB->NewIterator(leveldb::ReadOptions()));
     it->Seek(str);
 
     std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, bool>>> res;
@@ -679,4 +1672,145 @@ namespace C3 {
 
     return res;
   }
+
+  void scan_indexes(const std::function<void(const std::string &, uint64_t, std::vector<std::pair<uint32_t, bool>> &&)> &cb) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::unique_ptr<leveldb::Iterator> it(active.indexDB->NewIterator(leveldb::ReadOptions()));
+
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+      const auto key = toStringView(it->key());
+      const auto sep = key.rfind(',');
+      if(sep == std::string_view::npos) continue;
+
+      uint64_t post;
+      std::from_chars(key.data() + sep + 1, key.data() + key.size(), post);
+
+      std::stringstream ss(it->value().ToString());
+      uint32_t v;
+      char f;
+      std::vector<std::pair<uint32_t, bool>> l;
+      while(ss>>v>>f)
+        l.emplace_back(v, f == 't');
+
+      cb(std::string(key.substr(0, sep)), post, std::move(l));
+    }
+
+    if(!it->status().ok()) throw it->status();
+  }
+
+  /* Index statistics */
+  bool _rebuild_index_stats(void) {
+    std::cout<<"Storage: Rebuilding index statistics"<<std::endl;
+
+    std::unordered_map<std::string, uint64_t> dfs;
+    std::unique_ptr<leveldb::Iterator> it(active.indexDB->NewIterator(leveldb::ReadOptions()));
+
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+      const auto key = toStringView(it->key());
+      const auto sep = key.rfind(',');
+      if(sep == std::string_view::npos) continue;
+
+      uint64_t post;
+      std::from_chars(key.data() + sep + 1, key.data() + key.size(), post);
+      ++dfs[std::string(key.substr(0, sep))];
+
+      auto &stat = active.docStats.emplace(post, DocStats { 0, 0 }).first->second;
+      std::stringstream ss(it->value().ToString());
+      uint32_t v;
+      char f;
+      while(ss>>v>>f) {
+        if(f == 't') ++stat.title;
+        else ++stat.body;
+      }
+    }
+
+    if(!it->status().ok()) return false;
+
+    leveldb::WriteBatch batch;
+    for(auto &df : dfs)
+      batch.Put("df," + df.first, std::to_string(df.second));
+
+    for(auto &stat : active.docStats) {
+      ++active.corpusStats.docs;
+      active.corpusStats.title += stat.second.title;
+      active.corpusStats.body += stat.second.body;
+      batch.Put("doc," + std::to_string(stat.first), std::to_string(stat.second.title) + ' ' + std::to_string(stat.second.body));
+    }
+
+    batch.Put("corpus", std::to_string(active.corpusStats.docs)
+        + ' ' + std::to_string(active.corpusStats.title)
+        + ' ' + std::to_string(active.corpusStats.body));
+
+    return active.statDB->Write(leveldb::WriteOptions(), &batch).ok();
+  }
+
+  bool _load_index_stats(void) {
+    std::unique_lock<std::shared_mutex> lock(statMutex);
+    active.docStats.clear();
+    active.corpusStats = { 0, 0, 0 };
+
+    std::string corpus;
+    leveldb::Status s = active.statDB->Get(leveldb::ReadOptions(), "corpus", &corpus);
+    if(s.IsNotFound()) return _rebuild_index_stats();
+    else if(!s.ok()) return false;
+
+    std::stringstream cs(corpus);
+    cs>>active.corpusStats.docs>>active.corpusStats.title>>active.corpusStats.body;
+
+    std::unique_ptr<leveldb::Iterator> it(active.statDB->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek("doc"); it->Valid() && _entryEquals(it->key(), "doc"); it->Next()) {
+      const auto key = toStringView(it->key());
+      uint64_t post;
+      std::from_chars(key.data() + 4, key.data() + key.size(), post);
+
+      DocStats stat;
+      std::stringstream ss(it->value().ToString());
+      ss>>stat.title>>stat.body;
+      active.docStats.emplace(post, stat);
+    }
+
+    return it->status().ok();
+  }
+
+  uint64_t query_df(const std::string &str) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    return _query_df(active, str);
+  }
+
+  void scan_df(const std::function<void(const std::string &, uint64_t)> &cb) {
+    std::shared_lock<std::shared_mutex> lock(generationMutex);
+    std::unique_ptr<leveldb::Iterator> it(active.statDB->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek("df"); it->Valid() && _entryEquals(it->key(), "df"); it->Next()) {
+      const auto key = toStringView(it->key());
+      const auto value = toStringView(it->value());
+      uint64_t df = 0;
+      std::from_chars(value.data(), value.data() + value.size(), df);
+      cb(std::string(key.substr(3)), df);
+    }
+
+    if(!it->status().ok()) throw it->status();
+  }
+
+  DocStats query_doc_stats(uint64_t post) {
+    std::shared_lock<std::shared_mutex> lock(statMutex);
+    auto it = active.docStats.find(post);
+    if(it == active.docStats.end()) return DocStats { 0, 0 };
+    return it->second;
+  }
+
+  CorpusStats query_corpus_stats(void) {
+    std::shared_lock<std::shared_mutex> lock(statMutex);
+    return active.corpusStats;
+  }
+
+  std::vector<uint64_t> query_indexed_posts(void) {
+    std::vector<uint64_t> result;
+    {
+      std::shared_lock<std::shared_mutex> lock(statMutex);
+      result.reserve(active.docStats.size());
+      for(auto &stat : active.docStats) result.push_back(stat.first);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
 }
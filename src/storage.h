@@ -5,6 +5,8 @@
 #include <string_view>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <functional>
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
 #include <rapidjson/writer.h>
@@ -103,6 +105,49 @@ namespace C3 {
     }
   };
 
+  // Occurrences of each word of a post: byte offset, and whether it is in the title
+  typedef std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>> PostIndexes;
+
+  // Line ends of a post body, and the code points before every stride-th byte of the title
+  // and the body, so that previews never scan a post from its start
+  struct PostLayout {
+    static const uint32_t stride = 64;
+
+    std::vector<uint32_t> lineEnds; // Offsets of the '\n's, then the body length
+    std::vector<uint32_t> titleCodepoints;
+    std::vector<uint32_t> bodyCodepoints;
+
+    PostLayout() = default;
+    PostLayout(const std::string &title, const std::string &body);
+
+    uint32_t codepoints(const std::string &text, bool title, uint32_t offset) const; // Before the byte offset
+    std::string serialize(void) const;
+    bool parse(std::string_view data);
+  };
+
+  // Heaviest keywords of a post with their weights, scaled to a unit vector
+  typedef std::vector<std::pair<std::string, double>> PostKeywords;
+
+  // Indexes of a post, with the fingerprint and layout of the text they were generated from
+  struct IndexedPost {
+    uint64_t post;
+    std::string fingerprint;
+    PostIndexes indexes;
+    PostLayout layout;
+    PostKeywords keywords;
+  };
+
+  struct DocStats {
+    uint32_t title;
+    uint32_t body;
+  };
+
+  struct CorpusStats {
+    uint64_t docs;
+    uint64_t title;
+    uint64_t body;
+  };
+
   enum class Limitor {
     Less, Greater
   };
@@ -135,6 +180,7 @@ namespace C3 {
   Post get_post(const uint64_t &id);
   std::string get_post_str(const uint64_t &id);
   std::vector<Post> list_posts(int offset, int count, bool &hasNext, uint64_t &total);
+  void scan_posts(const std::function<void(Post &&)> &cb);
 
   /* Comments */
   uint64_t add_comment(const uint64_t post_id, const Comment &comment);
@@ -146,6 +192,44 @@ namespace C3 {
   void add_entries(const uint64_t &id, const std::vector<std::string> &list);
   void add_remove_entries(const uint64_t &id, const std::vector<std::string> &added, const std::vector<std::string> &removed);
   std::vector<uint64_t> list_posts_by_tag(const std::string &entry, int offset, int count, bool &hasNext, uint64_t &total);
+  std::vector<uint64_t> list_posts_by_tags(const std::vector<std::string> &tags, bool all, int offset, int count, bool &hasNext, uint64_t &total);
+  std::vector<uint64_t> query_tag_posts(const std::vector<std::string> &tags, bool all); // Sorted
+  std::vector<std::pair<std::string, uint64_t>> count_tags(void);
+
+  /* Mutations */
+
+  // Every key change of a post being created, updated or deleted, written as one operation by
+  // commit(). The URL map and tag bitmaps only follow once it is written
+  struct PostMutation {
+    struct Change {
+      enum class Type {
+        PutPost, DeletePost, AddEntries, RemoveEntries, AddUrl, RenameUrl, RemoveUrl, QueueIndex
+      };
+
+      Type type;
+      uint64_t id;
+      std::string key; // Post JSON, or the URL
+      std::string to; // URL renamed to
+      std::vector<std::string> list; // Tags
+    };
+
+    std::vector<Change> changes; // In order
+
+    uint64_t add_post(const Post &post);
+    void update_post(const uint64_t &id, const Post &post);
+    void delete_post(const uint64_t &id);
+    void add_entries(const uint64_t &id, const std::vector<std::string> &list);
+    void remove_entries(const uint64_t &id, const std::vector<std::string> &list);
+    void add_remove_entries(const uint64_t &id, const std::vector<std::string> &added, const std::vector<std::string> &removed);
+    void add_url(const std::string &url, uint64_t id);
+    void rename_url(const std::string &from, const std::string &to, uint64_t validator);
+    void remove_url(const std::string &url);
+    void queue_index(const uint64_t &id); // Leaves a marker until the post is indexed
+  };
+
+  // Mutations committed concurrently are written together. Throws MapperError if a URL change
+  // conflicts, leaving the others of the group unaffected
+  void commit(const PostMutation &mutation);
 
   /* Users */
   bool update_user(const User &user);
@@ -153,7 +237,30 @@ namespace C3 {
   User get_user(const std::string &uident);
 
   /* Index */
-  void set_indexes(uint64_t post, const std::unordered_map<std::string, std::vector<std::pair<uint32_t, bool>>> &indexes);
+  std::unordered_set<std::string> set_indexes(const IndexedPost &post); // Terms whose postings changed
+  void set_indexes(const std::vector<const IndexedPost *> &posts);
   void clear_indexes(uint64_t post);
+  std::vector<std::string> query_words(uint64_t post);
+  std::string query_fingerprint(uint64_t post);
+  PostLayout query_layout(uint64_t post);
+  PostKeywords query_keywords(uint64_t post);
+  void scan_keywords(const std::function<void(uint64_t, PostKeywords &&)> &cb);
+  std::vector<std::string> query_queued(uint64_t post); // Markers left by queue_index()
+  void clear_queued(const std::vector<std::string> &markers);
+  std::vector<uint64_t> scan_queued(void);
+
+  /* Index generations */
+  bool open_index_generation(void); // False if one is already being built
+  void set_generation_indexes(const std::vector<const IndexedPost *> &posts);
+  void swap_index_generation(void);
+  void drop_index_generation(void);
   std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, bool>>> query_indexes(const std::string &str);
+  void scan_indexes(const std::function<void(const std::string &, uint64_t, std::vector<std::pair<uint32_t, bool>> &&)> &cb);
+
+  /* Index statistics */
+  uint64_t query_df(const std::string &str);
+  void scan_df(const std::function<void(const std::string &, uint64_t)> &cb);
+  DocStats query_doc_stats(uint64_t post);
+  CorpusStats query_corpus_stats(void);
+  std::vector<uint64_t> query_indexed_posts(void); // Sorted
 };
@@ -0,0 +1,201 @@
+#include "suggest.h"
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+
+namespace C3 {
+  namespace Index {
+    void _put_varint(std::string &out, uint32_t value) {
+      while(value >= 0x80) {
+        out.push_back((char) (value | 0x80));
+        value >>= 7;
+      }
+      out.push_back((char) value);
+    }
+
+    uint32_t _get_varint(const std::string &in, size_t &pos) {
+      uint32_t value = 0;
+      for(int shift = 0;; shift += 7) {
+        const uint8_t byte = in[pos++];
+        value |= (uint32_t) (byte & 0x7F) << shift;
+        if(byte < 0x80) return value;
+      }
+    }
+
+    // Block heads are stored whole, the other terms as the length of the prefix shared
+    // with the previous term and the remaining suffix
+    void SuggestDict::_build(std::vector<std::pair<std::string, uint64_t>> &&terms) {
+      std::sort(terms.begin(), terms.end());
+      terms.erase(std::unique(terms.begin(), terms.end(),
+            [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) { return a.first == b.first; }),
+          terms.end());
+
+      data.clear();
+      blocks.clear();
+      weights.clear();
+      weights.reserve(terms.size());
+
+      for(size_t i = 0; i < terms.size(); ++i) {
+        const std::string &term = terms[i].first;
+        if(i % blockSize == 0) {
+          blocks.push_back(data.size());
+          _put_varint(data, term.size());
+          data += term;
+        } else {
+          const std::string &prev = terms[i - 1].first;
+          const size_t shared = std::mismatch(prev.begin(), prev.end(), term.begin(), term.end()).first - prev.begin();
+          _put_varint(data, shared);
+          _put_varint(data, term.size() - shared);
+          data.append(term, shared, std::string::npos);
+        }
+        weights.push_back(terms[i].second);
+      }
+      data.shrink_to_fit();
+
+      const size_t n = weights.size();
+      tree.assign(2 * n, 0);
+      for(size_t i = 0; i < n; ++i) tree[n + i] = i;
+      for(size_t i = n; i-- > 1;) tree[i] = _heavier(tree[2 * i], tree[2 * i + 1]);
+
+      pending.clear();
+    }
+
+    void SuggestDict::build(std::vector<std::pair<std::string, uint64_t>> &&terms) {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      _build(std::move(terms));
+    }
+
+    std::string SuggestDict::_term(size_t i) const {
+      size_t pos = blocks[i / blockSize];
+      const uint32_t length = _get_varint(data, pos);
+      std::string term = data.substr(pos, length);
+      pos += length;
+
+      for(size_t j = 0; j < i % blockSize; ++j) {
+        const uint32_t shared = _get_varint(data, pos);
+        const uint32_t suffix = _get_varint(data, pos);
+        term.resize(shared);
+        term.append(data, pos, suffix);
+        pos += suffix;
+      }
+      return term;
+    }
+
+    // Index of the first term not less than key
+    size_t SuggestDict::_lower_bound(const std::string &key) const {
+      size_t lo = 0, hi = blocks.size();
+      while(lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if(_term(mid * blockSize) < key) lo = mid + 1;
+        else hi = mid;
+      }
+      if(lo == 0) return 0;
+
+      // The key falls into the block before
+      const size_t begin = (lo - 1) * blockSize, end = std::min(lo * blockSize, weights.size());
+      size_t pos = blocks[lo - 1];
+      std::string term;
+      for(size_t i = begin; i < end; ++i) {
+        if(i == begin) {
+          const uint32_t length = _get_varint(data, pos);
+          term = data.substr(pos, length);
+          pos += length;
+        } else {
+          const uint32_t shared = _get_varint(data, pos);
+          const uint32_t suffix = _get_varint(data, pos);
+          term.resize(shared);
+          term.append(data, pos, suffix);
+          pos += suffix;
+        }
+        if(term >= key) return i;
+      }
+      return end;
+    }
+
+    uint32_t SuggestDict::_heavier(uint32_t a, uint32_t b) const {
+      if(weights[a] != weights[b]) return weights[a] > weights[b] ? a : b;
+      return std::min(a, b);
+    }
+
+    uint32_t SuggestDict::_heaviest(size_t from, size_t to) const {
+      const size_t n = weights.size();
+      uint32_t best = from;
+      for(from += n, to += n; from < to; from >>= 1, to >>= 1) {
+        if(from & 1) best = _heavier(best, tree[from++]);
+        if(to & 1) best = _heavier(best, tree[--to]);
+      }
+      return best;
+    }
+
+    void SuggestDict::_set_weight(size_t i, uint64_t weight) {
+      weights[i] = weight;
+      for(size_t node = (i + weights.size()) / 2; node >= 1; node /= 2)
+        tree[node] = _heavier(tree[2 * node], tree[2 * node + 1]);
+    }
+
+    // Known terms are reweighted in place. New ones wait in pending, until there are
+    // enough of them to be worth re-encoding the dictionary
+    void SuggestDict::update(const std::string &term, uint64_t df) {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+
+      const size_t i = _lower_bound(term);
+      if(i < weights.size() && _term(i) == term) {
+        _set_weight(i, df);
+        return;
+      }
+
+      if(df > 0) pending[term] = df;
+      else pending.erase(term);
+
+      if(pending.size() > pendingMax) {
+        std::vector<std::pair<std::string, uint64_t>> terms(pending.begin(), pending.end());
+        for(size_t j = 0; j < weights.size(); ++j)
+          if(weights[j] > 0) terms.emplace_back(_term(j), weights[j]);
+        _build(std::move(terms));
+      }
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> SuggestDict::complete(const std::string &prefix, size_t k) const {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      std::vector<std::pair<std::string, uint64_t>> result;
+
+      // Ranges ordered by their heaviest term, split around each term taken
+      typedef std::tuple<uint32_t, size_t, size_t> range;
+      auto lighter = [this](const range &a, const range &b) {
+        return _heavier(std::get<0>(a), std::get<0>(b)) != std::get<0>(a);
+      };
+      std::priority_queue<range, std::vector<range>, decltype(lighter)> ranges(lighter);
+
+      // No UTF-8 string contains 0xFF, so this sorts after every completion
+      const size_t from = _lower_bound(prefix), to = _lower_bound(prefix + '\xff');
+      if(from < to) ranges.emplace(_heaviest(from, to), from, to);
+
+      while(!ranges.empty() && result.size() < k) {
+        const auto [best, begin, end] = ranges.top();
+        ranges.pop();
+        if(weights[best] == 0) break;
+
+        result.emplace_back(_term(best), weights[best]);
+        if(begin < best) ranges.emplace(_heaviest(begin, best), begin, best);
+        if(best + 1 < end) ranges.emplace(_heaviest(best + 1, end), best + 1, end);
+      }
+
+      for(auto it = pending.lower_bound(prefix); it != pending.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+        result.emplace_back(*it);
+
+      std::sort(result.begin(), result.end(),
+          [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) {
+            if(a.second != b.second) return a.second > b.second;
+            return a.first < b.first;
+          });
+      if(result.size() > k) result.resize(k);
+      return result;
+    }
+
+    size_t SuggestDict::size(void) const {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      return weights.size() + pending.size();
+    }
+  }
+}
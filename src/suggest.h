@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+
+namespace C3 {
+  namespace Index {
+    // Terms weighted by document frequency, for prefix completion. Terms are front-coded in
+    // sorted blocks, and a segment tree over the weights yields the heaviest ones of a range
+    class SuggestDict {
+    public:
+      void build(std::vector<std::pair<std::string, uint64_t>> &&terms);
+      void update(const std::string &term, uint64_t df);
+      std::vector<std::pair<std::string, uint64_t>> complete(const std::string &prefix, size_t k) const;
+      size_t size(void) const;
+
+    private:
+      static const size_t blockSize = 16;
+      static const size_t pendingMax = 256;
+
+      mutable std::shared_mutex mutex;
+      std::string data;
+      std::vector<uint32_t> blocks; // Offset of each block in data
+      std::vector<uint64_t> weights;
+      std::vector<uint32_t> tree; // Heaviest term of each node, leaves at [n, 2n)
+      std::map<std::string, uint64_t> pending; // New terms since the last build
+
+      void _build(std::vector<std::pair<std::string, uint64_t>> &&terms);
+      std::string _term(size_t i) const;
+      size_t _lower_bound(const std::string &key) const;
+      uint32_t _heavier(uint32_t a, uint32_t b) const;
+      uint32_t _heaviest(size_t from, size_t to) const;
+      void _set_weight(size_t i, uint64_t weight);
+    };
+  }
+}
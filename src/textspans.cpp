@@ -0,0 +1,273 @@
+#include "textspans.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace C3 {
+  namespace Index {
+    void _emit(std::vector<TextSpan> &spans, size_t begin, size_t end, SpanType type) {
+      if(begin >= end) return;
+      if(spans.size() > 0) {
+        TextSpan &last = spans.back();
+        if(last.type == type && last.offset + last.length == begin) {
+          last.length = end - last.offset;
+          return;
+        }
+      }
+      spans.push_back(TextSpan { (uint32_t) begin, (uint32_t) (end - begin), type });
+    }
+
+    bool _alnum(char c) {
+      return std::isalnum((unsigned char) c) || (c & 0x80);
+    }
+
+    // Position of the ']' closing the '[' at begin, or end
+    size_t _close_bracket(const std::string &src, size_t begin, size_t end) {
+      int depth = 0;
+      for(size_t i = begin; i < end; ++i) {
+        if(src[i] == '\\') ++i;
+        else if(src[i] == '[') ++depth;
+        else if(src[i] == ']' && --depth == 0) return i;
+      }
+      return end;
+    }
+
+    // Position of the ')' closing the '(' at begin, or end
+    size_t _close_paren(const std::string &src, size_t begin, size_t end) {
+      int depth = 0;
+      for(size_t i = begin; i < end; ++i) {
+        if(src[i] == '\\') ++i;
+        else if(src[i] == '(') ++depth;
+        else if(src[i] == ')' && --depth == 0) return i;
+      }
+      return end;
+    }
+
+    // A link destination, without the optional title after it
+    void _destination(const std::string &src, size_t begin, size_t end, std::vector<TextSpan> &spans) {
+      while(begin < end && src[begin] == ' ') ++begin;
+      if(begin < end && src[begin] == '<') {
+        size_t close = src.find('>', begin);
+        if(close < end) return _emit(spans, begin + 1, close, SpanType::Url);
+      }
+
+      size_t stop = begin;
+      while(stop < end && !std::isspace((unsigned char) src[stop])) ++stop;
+      _emit(spans, begin, stop, SpanType::Url);
+    }
+
+    bool _bare_url(const std::string &src, size_t i, size_t end) {
+      for(auto scheme : { "http://", "https://", "ftp://", "www." }) {
+        const size_t length = std::strlen(scheme);
+        if(i + length <= end && src.compare(i, length, scheme) == 0) return true;
+      }
+      return false;
+    }
+
+    void _inline(const std::string &src, size_t begin, size_t end, SpanType base, std::vector<TextSpan> &spans) {
+      size_t text = begin; // Start of the pending text
+      size_t i = begin;
+
+      // Ends the pending text at i, and resumes it at next
+      auto skip = [&](size_t next) {
+        _emit(spans, text, i, base);
+        i = text = next;
+      };
+
+      while(i < end) {
+        const char c = src[i];
+
+        if(c == '\\' && i + 1 < end && std::ispunct((unsigned char) src[i + 1])) {
+          _emit(spans, text, i, base);
+          text = i + 1;
+          i += 2;
+        } else if(c == '`') {
+          size_t run = i;
+          while(run < end && src[run] == '`') ++run;
+          const size_t ticks = run - i;
+
+          size_t close = run;
+          while(close < end) {
+            close = src.find('`', close);
+            if(close >= end) break;
+            size_t closeRun = close;
+            while(closeRun < end && src[closeRun] == '`') ++closeRun;
+            if(closeRun - close == ticks) break;
+            close = closeRun;
+          }
+
+          if(close >= end) {
+            i = run;
+            continue;
+          }
+          _emit(spans, text, i, base);
+          _emit(spans, run, close, SpanType::InlineCode);
+          i = text = close + ticks;
+        } else if(c == '[' || (c == '!' && i + 1 < end && src[i + 1] == '[')) {
+          const bool image = c == '!';
+          const size_t open = image ? i + 1 : i;
+          const size_t close = _close_bracket(src, open, end);
+
+          if(close + 1 < end && src[close + 1] == '(') {
+            const size_t paren = _close_paren(src, close + 1, end);
+            if(paren < end) {
+              _emit(spans, text, i, base);
+              if(image) _emit(spans, open + 1, close, SpanType::Alt);
+              else _inline(src, open + 1, close, base, spans);
+              _destination(src, close + 2, paren, spans);
+              i = text = paren + 1;
+              continue;
+            }
+          }
+
+          // Reference links and stray brackets keep their text
+          skip(open + 1);
+        } else if(c == ']') {
+          skip(i + 1);
+        } else if(c == '<' && i + 1 < end && (std::isalpha((unsigned char) src[i + 1]) || src[i + 1] == '/' || src[i + 1] == '!')) {
+          const size_t close = src.find('>', i);
+          if(close >= end) {
+            ++i;
+            continue;
+          }
+
+          const std::string inside = src.substr(i + 1, close - i - 1);
+          const bool autolink = inside.find(' ') == std::string::npos
+            && (inside.find("://") != std::string::npos || inside.find('@') != std::string::npos);
+
+          _emit(spans, text, i, base);
+          if(autolink) _emit(spans, i + 1, close, SpanType::Url);
+          else _emit(spans, i, close + 1, SpanType::Html);
+          i = text = close + 1;
+        } else if(_bare_url(src, i, end) && (i == begin || !_alnum(src[i - 1]))) {
+          size_t stop = i;
+          while(stop < end && !std::isspace((unsigned char) src[stop]) && src[stop] != '<') ++stop;
+          while(stop > i && std::strchr(".,;:!?)'\"", src[stop - 1])) --stop;
+
+          _emit(spans, text, i, base);
+          _emit(spans, i, stop, SpanType::Url);
+          i = text = stop;
+        } else if(c == '*' || c == '~' || c == '|'
+            || (c == '_' && (i == begin || !_alnum(src[i - 1]) || i + 1 == end || !_alnum(src[i + 1])))) {
+          // Emphasis, strikethrough and table cells, but not underscores inside words
+          skip(i + 1);
+        } else ++i;
+      }
+
+      _emit(spans, text, end, base);
+    }
+
+    // Thematic breaks, setext underlines and table delimiter rows
+    bool _rule(const std::string &src, size_t begin, size_t end) {
+      if(begin == end) return false;
+      for(size_t i = begin; i < end; ++i)
+        if(!std::strchr("-*_=:| \t", src[i])) return false;
+      return true;
+    }
+
+    std::vector<TextSpan> text_spans(const std::string &src) {
+      std::vector<TextSpan> spans;
+      std::string fence; // Of the open fenced code block
+      bool blank = true, list = false, indented = false;
+
+      for(size_t pos = 0; pos < src.size();) {
+        size_t end = src.find('\n', pos);
+        if(end == std::string::npos) end = src.size();
+        const size_t next = end + 1;
+
+        size_t i = pos, indent = 0;
+        while(i < end && (src[i] == ' ' || src[i] == '\t')) {
+          indent += src[i] == '\t' ? 4 : 1;
+          ++i;
+        }
+        size_t stop = end;
+        while(stop > i && std::isspace((unsigned char) src[stop - 1])) --stop;
+
+        if(fence.size() > 0) {
+          size_t run = i;
+          while(run < stop && src[run] == fence[0]) ++run;
+          if(indent < 4 && run - i >= fence.size() && run == stop) fence.clear();
+          else _emit(spans, pos, end, SpanType::Code);
+          pos = next;
+          continue;
+        }
+
+        if(i == stop) {
+          blank = true;
+          pos = next;
+          continue;
+        }
+
+        if(indent >= 4 && (indented || (blank && !list))) {
+          indented = true;
+          _emit(spans, i, stop, SpanType::Code);
+          pos = next;
+          continue;
+        }
+        indented = false;
+
+        if(indent < 4 && stop - i >= 3 && (src.compare(i, 3, "```") == 0 || src.compare(i, 3, "~~~") == 0)) {
+          size_t run = i;
+          while(run < stop && src[run] == src[i]) ++run;
+          fence.assign(run - i, src[i]); // The info string after it is left out
+          blank = false;
+          pos = next;
+          continue;
+        }
+
+        // Block quotes, headings and list markers
+        while(i < stop && src[i] == '>') {
+          ++i;
+          while(i < stop && src[i] == ' ') ++i;
+        }
+        if(i == stop) {
+          blank = false;
+          pos = next;
+          continue;
+        }
+
+        bool marker = false;
+        if(src[i] == '#') {
+          size_t run = i;
+          while(run < stop && src[run] == '#') ++run;
+          if(run - i <= 6 && (run == stop || src[run] == ' ')) {
+            i = run;
+            while(stop > i && src[stop - 1] == '#') --stop;
+          }
+        } else if(std::strchr("-*+", src[i]) && i + 1 < stop && src[i + 1] == ' ' && !_rule(src, i, stop)) {
+          i += 2;
+          marker = true;
+        } else if(std::isdigit((unsigned char) src[i])) {
+          size_t digits = i;
+          while(digits < stop && std::isdigit((unsigned char) src[digits])) ++digits;
+          if(digits - i <= 9 && digits + 1 < stop && (src[digits] == '.' || src[digits] == ')') && src[digits + 1] == ' ') {
+            i = digits + 2;
+            marker = true;
+          }
+        }
+        list = marker || (list && (indent > 0 || !blank));
+        blank = false;
+
+        if(_rule(src, i, stop)) {
+          pos = next;
+          continue;
+        }
+
+        // Link reference definitions: [label]: destination "title"
+        if(src[i] == '[') {
+          const size_t close = _close_bracket(src, i, stop);
+          if(close + 1 < stop && src[close + 1] == ':') {
+            _destination(src, close + 2, stop, spans);
+            pos = next;
+            continue;
+          }
+        }
+
+        _inline(src, i, stop, SpanType::Text, spans);
+        pos = next;
+      }
+
+      return spans;
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace C3 {
+  namespace Index {
+    // What a byte range of a markdown document holds
+    enum class SpanType {
+      Text, // Paragraphs, headings, emphasis and link texts
+      Code, // Fenced and indented code blocks
+      InlineCode,
+      Url, // Link and image targets, autolinks and bare URLs
+      Alt, // Image descriptions
+      Html // Raw tags and comments
+    };
+
+    const size_t spanTypes = 6;
+
+    struct TextSpan {
+      uint32_t offset; // Bytes into the document
+      uint32_t length;
+      SpanType type;
+    };
+
+    // Splits markdown into spans, leaving the markup itself out. Only meant to pick what gets
+    // indexed, so it approximates CommonMark line by line rather than following it exactly
+    std::vector<TextSpan> text_spans(const std::string &src);
+  }
+}
@@ -2,6 +2,8 @@
 #include <sstream>
 #include <chrono>
 #include <memory>
+#include <new>
+#include <cstdlib>
 
 extern "C" {
 #include <mkdio.h>
@@ -10,7 +12,42 @@ extern "C" {
 
 #include "util.h"
 
+#ifdef C3_COUNT_ALLOCATIONS
+namespace {
+  thread_local uint64_t allocations = 0;
+}
+
+// Counted for the benchmarks, and otherwise the same as the default. Only built in with
+// C3_COUNT_ALLOCATIONS, so that the server keeps the allocator it is linked with
+void *operator new(std::size_t size) {
+  ++allocations;
+  if(size == 0) size = 1;
+  while(true) {
+    if(void *p = std::malloc(size)) return p;
+    std::new_handler handler = std::get_new_handler();
+    if(!handler) throw std::bad_alloc();
+    handler();
+  }
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+#endif
+
 namespace C3 {
+  uint64_t thread_allocations(void) {
+#ifdef C3_COUNT_ALLOCATIONS
+    return allocations;
+#else
+    return 0;
+#endif
+  }
+
   Randomizer::Randomizer(uint64_t a, uint64_t b) : mt(rd()), dist(a,b) { }
 
   uint64_t Randomizer::next(void) {
@@ -19,6 +19,9 @@ namespace C3 {
 
   uint64_t current_time(void);
 
+  // Calls to operator new made by this thread so far, or 0 unless built with C3_COUNT_ALLOCATIONS
+  uint64_t thread_allocations(void);
+
   std::vector<std::string> split(const std::string &, char);
 
   std::string random_chars(int);